@@ -3,127 +3,115 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <cstring>
+#include <cctype>
 #include <vector>
 #include <ctime>
 #include <map>
+#include <algorithm>
 #include <pthread.h>
 #include <sstream>
+#include <atomic>
+#include <chrono>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "avn_channel.h"
+#include "avn_driver.h"
+#include "avn_export.h"
+#include "avn_hub.h"
+#include "avn_index.h"
+#include "avn_ledger.h"
+#include "avn_wire.h"
 
 using namespace std;
 
-enum FlightType { COMMERCIAL, CARGO, EMERGENCY };           //ENUMS FLightType , Same as what is in ATC file
-
-struct AVN        //it is also same as the AVN in ATC file, kyunkay same data pipe say lakr aaaana hoata   (same as avn.cpp)
+//"YYYY-MM-DD HH:MM:SS" in local time without ctime()'s shared static buffer; each thread keeps the last minute
+//it formatted, so a page of AVNs issued close together costs one localtime_r() instead of one per field
+class DateFormatter
     {
-        char avnID[32];
-        char airlineName[32];
-        char flightNumber[16];
-        FlightType type;
-        float speedRecorded;
-        float permissibleSpeed;
-        time_t issuanceTime;
-        double fineAmount;
-        char paymentStatus[16];
-        time_t dueDate;
-
-        void serialize(char* buffer, int& offset) const      //this function is used to convert the AVN object data into stream of bytes
-            {                                                   //-hence necessary to transfer data through pipe or fifio
-                memcpy(buffer + offset, avnID, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(buffer + offset, airlineName, sizeof(airlineName));
-                offset += sizeof(airlineName);
-                memcpy(buffer + offset, flightNumber, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(buffer + offset, &type, sizeof(type));
-                offset += sizeof(type);
-                memcpy(buffer + offset, &speedRecorded, sizeof(speedRecorded));
-                offset += sizeof(speedRecorded);
-                memcpy(buffer + offset, &permissibleSpeed, sizeof(permissibleSpeed));
-                offset += sizeof(permissibleSpeed);
-                memcpy(buffer + offset, &issuanceTime, sizeof(issuanceTime));
-                offset += sizeof(issuanceTime);
-                memcpy(buffer + offset, &fineAmount, sizeof(fineAmount));
-                offset += sizeof(fineAmount);
-                memcpy(buffer + offset, paymentStatus, sizeof(paymentStatus));
-                offset += sizeof(paymentStatus);
-                memcpy(buffer + offset, &dueDate, sizeof(dueDate));
-                offset += sizeof(dueDate);
-            }
+        private:
+            struct Cache
+                {
+                    bool filled = false;
+                    time_t minute = 0;
+                    char prefix[20];        //"YYYY-MM-DD HH:MM", always 16 characters for years 1000-9999
+                };
 
-        void deserialize(const char* buffer, int& offset)            //to convert back to it's original object form
-            {
-                memcpy(avnID, buffer + offset, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(airlineName, buffer + offset, sizeof(airlineName));
-                offset += sizeof(airlineName);
-                memcpy(flightNumber, buffer + offset, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(&type, buffer + offset, sizeof(type));
-                offset += sizeof(type);
-                memcpy(&speedRecorded, buffer + offset, sizeof(speedRecorded));
-                offset += sizeof(speedRecorded);
-                memcpy(&permissibleSpeed, buffer + offset, sizeof(permissibleSpeed));
-                offset += sizeof(permissibleSpeed);
-                memcpy(&issuanceTime, buffer + offset, sizeof(issuanceTime));
-                offset += sizeof(issuanceTime);
-                memcpy(&fineAmount, buffer + offset, sizeof(fineAmount));
-                offset += sizeof(fineAmount);
-                memcpy(paymentStatus, buffer + offset, sizeof(paymentStatus));
-                offset += sizeof(paymentStatus);
-                memcpy(&dueDate, buffer + offset, sizeof(dueDate));
-                offset += sizeof(dueDate);
-            }
+        public:
+            static const size_t LENGTH = 20;     //with the terminating NUL
 
-        static int serializedSize()          //funciton to calculate and return size of stream produced by serialization funciton
-            {
-                return sizeof(avnID) + sizeof(airlineName) + sizeof(flightNumber) +
-                    sizeof(type) + sizeof(speedRecorded) + sizeof(permissibleSpeed) +
-                    sizeof(issuanceTime) + sizeof(fineAmount) + sizeof(paymentStatus) +
-                    sizeof(dueDate);
-            }
+            static void format(time_t t, char (&out)[LENGTH])
+                {
+                    thread_local Cache cache;
+                    time_t minute = t >= 0 ? t / 60 : (t - 59) / 60;    //zone offsets are whole minutes
+                    if(!cache.filled || minute != cache.minute)
+                        {
+                            struct tm tm;
+                            time_t start = minute * 60;
+                            localtime_r(&start, &tm);
+                            strftime(cache.prefix, sizeof(cache.prefix), "%Y-%m-%d %H:%M", &tm);
+                            cache.minute = minute;
+                            cache.filled = true;
+                        }
+                    int second = int(t - minute * 60);
+                    memcpy(out, cache.prefix, 16);
+                    out[16] = ':';
+                    out[17] = char('0' + second / 10);
+                    out[18] = char('0' + second % 10);
+                    out[19] = '\0';
+                }
     };
 
-struct PaymentConfirmation          //struct for payment details such as avnID, flightNum and ispaid (same as avn.cpp)
+//writes a whole page with one write() (more only if the terminal takes part of it), after anything cout still holds
+static void writeOut(const string& text)
     {
-        char avnID[32];
-        char flightNumber[16];
-        bool paymentSuccessful;
-
-        void serialize(char* buffer, int& offset) const         //converting 
-            {
-                memcpy(buffer + offset, avnID, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(buffer + offset, flightNumber, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(buffer + offset, &paymentSuccessful, sizeof(paymentSuccessful));
-                offset += sizeof(paymentSuccessful);
-            }
-
-        void deserialize(const char* buffer, int& offset)   //convertingf back to object
-            {
-                memcpy(avnID, buffer + offset, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(flightNumber, buffer + offset, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(&paymentSuccessful, buffer + offset, sizeof(paymentSuccessful));
-                offset += sizeof(paymentSuccessful);
-            }
-
-        static int serializedSize() 
+        cout << flush;
+        size_t done = 0;
+        while(done < text.size())
             {
-                return sizeof(avnID) + sizeof(flightNumber) + sizeof(paymentSuccessful);
+                ssize_t n = write(STDOUT_FILENO, text.data() + done, text.size() - done);
+                if(n < 0 && errno == EINTR)
+                    continue;
+                if(n <= 0)
+                    return;
+                done += n;
             }
-    };
+    }
 
 class AirlinePortal 
     {
         private:
-            map<string, AVN> avnRecords; //storing AVNs by avnID in a hashmap
-            pthread_mutex_t avnMutex;
-            int fdAvnPipe = -1;        //for reading from avn_to_airline.fifo
-            int fdStripePipe = -1;     //for reading from stripe_to_airline.fifo
+            AvnIndex avnRecords;       //AVNs with airline / flight / issuance time indexes, written by the ingest thread only
+            pthread_mutex_t avnMutex;  //guards subscribedAirline and resubscribe; avnRecords readers pin a snapshot instead
+            AvnLedger ledger;          //the generator's per-airline totals, mapped read-only on first use
+            int hubFd = -1;            //subscription to the generator's AVN hub, only this airline's AVNs arrive here
+            AvnChannel stripePipe;     //for reading from stripe_to_airline.fifo
             map<string, string> airlineCredentials; //to store airline credentials
             string loggedInAirline; //to track the currently loggedin airline
+            const DriverConfig* driver = nullptr;      //driver mode logs in from the config instead of the terminal
+
+            //the ingest thread owns hubFd and stripePipe and drains them as soon as epoll reports data, so AVNs
+            //and confirmations land in avnRecords while the user is still typing; the command loop only queries
+            pthread_t ingestThread;
+            int epollFd = -1;
+            int wakeFd = -1;            //eventfd, pulls the ingest thread out of epoll_wait for a relogin or shutdown
+            atomic<bool> running{false};
+            string subscribedAirline;   //airline the ingest thread (re)subscribes to
+            bool resubscribe = false;   //relogin happened, the ingest thread swaps the subscription
+
+            //the airline avnRecords holds and the generator revision it is complete up to; saved with it in
+            //portal_<airline>.snap, so a restart maps the file and only asks the hub for what changed since
+            string ingestAirline;
+            uint64_t revision = 0;
+            uint64_t requestedRevision = 0;     //sinceRevision of the last subscribe
+            bool dirty = false;                 //avnRecords changed since the last save
+            time_t lastSaved = 0;
+
+            static const int RECONNECT_MS = 1000;       //retry interval while the generator's hub is gone
+            static const int SNAPSHOT_SEC = 300;        //longest a changed index goes unsaved, bounds the catch-up after a crash
+            static const size_t DEFAULT_PAGE_SIZE = 50; //AVNs per view page
+
+            enum IngestSource { FROM_HUB, FROM_STRIPE, WAKE };
 
             string flightTypeToStr(FlightType f) 
                 {
@@ -140,55 +128,224 @@ class AirlinePortal
                         }
                 }
 
-            void displayAVNs(bool filterByAirline = false, const string& flightNumber = "", time_t searchTime = 0)      //function to display all avns of an airline
+            void appendLong(string& out, const AVN& avn)       //the full multi-line record
+                {
+                    char issued[DateFormatter::LENGTH], due[DateFormatter::LENGTH], line[256];
+                    DateFormatter::format(avn.issuanceTime, issued);
+                    DateFormatter::format(avn.dueDate, due);
+                    snprintf(line, sizeof(line), "AVN ID: %s\nAircraft ID (Flight Number): %s\nAircraft Type: %s\nPayment Status: %s\n",
+                             avn.avnID, avn.flightNumber, flightTypeToStr(avn.type).c_str(), avn.paymentStatus);
+                    out += line;
+                    snprintf(line, sizeof(line), "Violation: %s x%u (max excess %g)\nTotal Fine Amount: PKR %s\nIssuance Date/Time: %s\nDue Date: %s\n",
+                             violationRuleToStr(avn.rule), avn.violationCount, avn.maxExcess, formatMinorUnits(toMinorUnits(avn.fineAmount)).c_str(), issued, due);
+                    out += line;
+                    out += "--------------------------------\n";
+                }
+
+            void appendCompact(string& out, const AVN& avn)    //one table row
                 {
-                    pthread_mutex_lock(&avnMutex);
-                    cout << "\n===== Airline Portal: Active and Historical AVNs for " << loggedInAirline << " =====\n";
+                    char issued[DateFormatter::LENGTH], due[DateFormatter::LENGTH], line[256];
+                    DateFormatter::format(avn.issuanceTime, issued);
+                    DateFormatter::format(avn.dueDate, due);
+                    snprintf(line, sizeof(line), "%-21s %-10s %-10s %-8s %-9s %5u %14s  %s  %s\n",
+                             avn.avnID, avn.flightNumber, flightTypeToStr(avn.type).c_str(), avn.paymentStatus, violationRuleToStr(avn.rule),
+                             avn.violationCount, formatMinorUnits(toMinorUnits(avn.fineAmount)).c_str(), issued, due);
+                    out += line;
+                }
+
+            static void appendCompactHeader(string& out)
+                {
+                    char line[256];
+                    snprintf(line, sizeof(line), "%-21s %-10s %-10s %-8s %-9s %5s %14s  %-19s  %s\n",
+                             "AVN ID", "Flight", "Type", "Status", "Rule", "Count", "Fine (PKR)", "Issued", "Due");
+                    out += line;
+                }
+
+            //one page of the logged-in airline's AVNs, oldest first; page is 1-based
+            void displayAVNs(size_t page = 1, size_t pageSize = DEFAULT_PAGE_SIZE, bool longFormat = false)
+                {
+                    shared_ptr<const AvnSnapshot> snapshot = avnRecords.snapshot();        //no lock, ingest keeps publishing meanwhile
+                    size_t total = snapshot->countAirline(loggedInAirline);
+                    size_t pages = max<size_t>(1, (total + pageSize - 1) / pageSize);
+                    string out;
+                    out.reserve(256 * (pageSize + 4));
+                    out += "\n===== Airline Portal: Active and Historical AVNs for " + loggedInAirline + " (page " + to_string(page) + " of " +
+                           to_string(pages) + ", " + to_string(total) + " AVNs) =====\n";
+                    if(!longFormat && total)
+                        appendCompactHeader(out);
+                    size_t shown = 0;
+                    snapshot->forAirlinePage(loggedInAirline, (page - 1) * pageSize, pageSize, [&](const AVN& avn)
+                        {
+                            shown++;
+                            if(longFormat)
+                                appendLong(out, avn);
+                            else
+                                appendCompact(out, avn);
+                        });
+                    if(!shown) 
+                        {
+                            out += total ? "No AVNs on this page.\n" : "No matching AVNs found.\n";
+                        }
+                    else if(page < pages)
+                        {
+                            out += "Next: view --page " + to_string(page + 1) + " --size " + to_string(pageSize) + "\n";
+                        }
+                    out += "==============================================\n";
+                    writeOut(out);
+                }
+
+            void searchAVNs(const string& flightNumber, time_t searchTime)      //full records for a flight and/or issuance time
+                {
+                    shared_ptr<const AvnSnapshot> snapshot = avnRecords.snapshot();
+                    string out = "\n===== Airline Portal: Active and Historical AVNs for " + loggedInAirline + " =====\n";
                     bool found = false;
-                    for(const auto& entry : avnRecords) 
+                    auto show = [&](const AVN& avn)
                         {
-                            const AVN& avn = entry.second;
-                            //filter by airline name
-                            if(filterByAirline && strcmp(avn.airlineName, loggedInAirline.c_str()) != 0) 
-                                {
-                                    continue;
-                                }
-                            //filter by flight number and issuance time if provided
-                            if(!flightNumber.empty() && strcmp(avn.flightNumber, flightNumber.c_str()) != 0) 
-                                {
-                                    continue;
-                                }
-                            if(searchTime != 0) 
-                                {
-                                    //allow a small time window (e.g., 60 seconds) for matching issuance time
-                                    if(abs(difftime(searchTime, avn.issuanceTime)) > 60) 
-                                        {
-                                            continue;
-                                        }
-                                }
                             found = true;
-                            time_t now = time(nullptr);
-                            bool isOverdue = now > avn.dueDate && strcmp(avn.paymentStatus, "paid") != 0;
-                            cout << "AVN ID: " << avn.avnID << "\n"
-                                << "Aircraft ID (Flight Number): " << avn.flightNumber << "\n"
-                                << "Aircraft Type: " << flightTypeToStr(avn.type) << "\n"
-                                << "Payment Status: " << avn.paymentStatus << (isOverdue ? " (Overdue)" : "") << "\n"
-                                << "Total Fine Amount: PKR " << avn.fineAmount << "\n"
-                                << "Issuance Date/Time: " << ctime(&avn.issuanceTime)
-                                << "Due Date: " << ctime(&avn.dueDate) << "\n"
-                                << "--------------------------------\n";
-                        }
+                            appendLong(out, avn);
+                        };
+                    //allow a small time window (e.g., 60 seconds) for matching issuance time
+                    int64_t from = searchTime != 0 ? int64_t(searchTime) - 60 : INT64_MIN;
+                    int64_t to = searchTime != 0 ? int64_t(searchTime) + 60 : INT64_MAX;
+                    if(!flightNumber.empty())
+                        snapshot->forFlight(loggedInAirline, flightNumber, from, to, show);
+                    else
+                        snapshot->forAirline(loggedInAirline, from, to, show);
                     if(!found) 
                         {
-                            cout << "No matching AVNs found.\n";
+                            out += "No matching AVNs found.\n";
+                        }
+                    out += "==============================================\n";
+                    writeOut(out);
+                }
+
+            void showLedger()           //the generator keeps these totals up to date, reading them is one lookup
+                {
+                    if(!ledger.isOpen() && !ledger.attach()) 
+                        {
+                            cout << "[Airline Portal] Fine ledger not available yet (is the AVN Generator running?)\n" << flush;
+                            return;
+                        }
+                    LedgerTotals t;
+                    if(!ledger.totals(loggedInAirline, t)) 
+                        {
+                            if(errno == EAGAIN)
+                                cout << "[Airline Portal] Fine ledger not available (an update to it never finished)\n" << flush;
+                            else
+                                cout << "[Airline Portal] No AVNs have been issued to " << loggedInAirline << "\n" << flush;
+                            return;
+                        }
+                    cout << "\n===== Fine Ledger for " << loggedInAirline << " =====\n"
+                        << "AVNs Issued: " << t.issued << "\n"
+                        << "Unpaid (not yet due): PKR " << formatMinorUnits(t.unpaid) << "\n"
+                        << "Overdue: PKR " << formatMinorUnits(t.overdue) << "\n"
+                        << "Paid: PKR " << formatMinorUnits(t.paid) << "\n"
+                        << "==============================================\n" << flush;
+                }
+
+            //the aggregate commands below read the running totals in the pinned snapshot, their cost does not grow with history
+            void showSummary()
+                {
+                    shared_ptr<const AvnSnapshot> snapshot = avnRecords.snapshot();
+                    const AvnAggregates* t = snapshot->totals(loggedInAirline);
+                    if(!t) 
+                        {
+                            cout << "[Airline Portal] No AVNs received for " << loggedInAirline << "\n" << flush;
+                            return;
                         }
+                    cout << "\n===== AVN Summary for " << loggedInAirline << " =====\n"
+                        << "AVNs: " << t->avns << "\n"
+                        << "Unpaid Total: PKR " << formatMinorUnits(t->unpaid) << "\n"
+                        << "Overdue Total: PKR " << formatMinorUnits(t->overdue) << "\n"
+                        << "Paid Total: PKR " << formatMinorUnits(t->paid) << "\n";
+                    for(int type = COMMERCIAL; type <= EMERGENCY; type++)
+                        cout << flightTypeToStr(FlightType(type)) << " AVNs: " << t->byType[type] << "\n";
                     cout << "==============================================\n" << flush;
-                    pthread_mutex_unlock(&avnMutex);
+                }
+
+            void showTopFlights(size_t limit)
+                {
+                    shared_ptr<const AvnSnapshot> snapshot = avnRecords.snapshot();
+                    const AvnAggregates* t = snapshot->totals(loggedInAirline);
+                    cout << "\n===== Top Offending Flights for " << loggedInAirline << " =====\n";
+                    size_t shown = 0;
+                    if(t)
+                        for(auto it = t->ranking.rbegin(); it != t->ranking.rend() && shown < limit; ++it, shown++)
+                            {
+                                const FlightTally& flight = t->flights.at(get<2>(*it));
+                                cout << shown + 1 << ". " << get<2>(*it) << ": " << flight.violations << " violations in " << flight.avns
+                                    << " AVNs, PKR " << formatMinorUnits(flight.fines) << "\n";
+                            }
+                    if(!shown)
+                        cout << "No AVNs received.\n";
+                    cout << "==============================================\n" << flush;
+                }
+
+            void showDailyFines(size_t days)
+                {
+                    shared_ptr<const AvnSnapshot> snapshot = avnRecords.snapshot();
+                    const AvnAggregates* t = snapshot->totals(loggedInAirline);
+                    cout << "\n===== Fines per Day for " << loggedInAirline << " (latest " << days << " days with AVNs) =====\n";
+                    size_t shown = 0;
+                    if(t)
+                        for(auto it = t->perDay.rbegin(); it != t->perDay.rend() && shown < days; ++it, shown++)
+                            {
+                                time_t day = it->first * 86400;
+                                char date[16];
+                                strftime(date, sizeof(date), "%Y-%m-%d", gmtime(&day));
+                                cout << date << ": " << it->second.avns << " AVNs, PKR " << formatMinorUnits(it->second.fines) << "\n";
+                            }
+                    if(!shown)
+                        cout << "No AVNs received.\n";
+                    cout << "==============================================\n" << flush;
+                }
+
+            void showOverdue()
+                {
+                    shared_ptr<const AvnSnapshot> snapshot = avnRecords.snapshot();
+                    const AvnAggregates* t = snapshot->totals(loggedInAirline);
+                    string out = "\n===== Overdue AVNs for " + loggedInAirline + " =====\n";
+                    if(!t || t->overdueList.empty())
+                        out += "No overdue AVNs.\n";
+                    else
+                        for(const AvnTimeEntry& entry : t->overdueList)        //oldest due date first
+                            {
+                                const AVN& avn = snapshot->record(entry.slot);
+                                char due[DateFormatter::LENGTH], line[160];
+                                DateFormatter::format(avn.dueDate, due);
+                                snprintf(line, sizeof(line), "%s Flight %s, PKR %s, due %s\n", avn.avnID, avn.flightNumber,
+                                         formatMinorUnits(toMinorUnits(avn.fineAmount)).c_str(), due);
+                                out += line;
+                            }
+                    out += "==============================================\n";
+                    writeOut(out);
+                }
+
+            void exportAVNs(const string& path)        //the logged-in airline's AVNs from one snapshot, streamed a row group at a time
+                {
+                    shared_ptr<const AvnSnapshot> snapshot = avnRecords.snapshot();
+                    AvnExporter exporter;
+                    if(!exporter.open(path, exportFormatFor(path))) 
+                        {
+                            cout << "[ERROR] Failed to create " << path << ": " << strerror(errno) << endl << flush;
+                            return;
+                        }
+                    snapshot->forAirline(loggedInAirline, [&](const AVN& avn)
+                        {
+                            exporter.add(avn);
+                        });
+                    uint64_t rows = exporter.rows();
+                    if(!exporter.close()) 
+                        {
+                            cout << "[ERROR] Failed to write " << path << ": " << strerror(errno) << endl << flush;
+                            return;
+                        }
+                    cout << "[Airline Portal] Exported " << rows << " AVN(s) to " << path << "\n" << flush;
                 }
 
             time_t parseDateTime(const string& dateTimeStr)     //setting date-time format
                 {
-                    struct tm tm = {0};
+                    struct tm tm = {};
                     if(strptime(dateTimeStr.c_str(), "%Y-%m-%d %H:%M:%S", &tm) == nullptr) {
                         cout << "[ERROR] Invalid date-time format. Use YYYY-MM-DD HH:MM:SS\n" << flush;
                         return 0;
@@ -198,6 +355,19 @@ class AirlinePortal
 
             bool authenticate()         //authentication to airline portal
                 {
+                    if(driver) 
+                        {
+                            const DriverLogin& login = driver->logins.front();
+                            auto it = airlineCredentials.find(login.airline);
+                            if(it == airlineCredentials.end() || it->second != login.password) 
+                                {
+                                    cout << "[ERROR] Driver config credentials for " << login.airline << " were rejected" << endl << flush;
+                                    return false;
+                                }
+                            loggedInAirline = login.airline;
+                            cout << "[Airline Portal] Logged in as " << login.airline << " from the driver config\n" << flush;
+                            return true;
+                        }
                     while(1)
                         {
                             string username, password;
@@ -205,6 +375,11 @@ class AirlinePortal
                             getline(cin, username);
                             cout << "[Airline Portal] Enter password: ";
                             getline(cin, password);
+                            if(!cin)        //stdin closed (e.g. started by the supervisor without the terminal)
+                                {
+                                    cout << "\n[Airline Portal] No input available, cannot log in\n" << flush;
+                                    return false;
+                                }
 
                             auto it = airlineCredentials.find(username);
                             if(it != airlineCredentials.end() && it->second == password) 
@@ -220,11 +395,93 @@ class AirlinePortal
                         }  
                 }
 
+            bool watch(int fd, IngestSource source)
+                {
+                    epoll_event ev;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = EPOLLIN;
+                    ev.data.u32 = source;
+                    return fd >= 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+                }
+
+            static string snapshotPath(const string& airline)
+                {
+                    string path = "portal_";
+                    for(char c : airline)
+                        path += isalnum((unsigned char)c) ? c : '_';
+                    return path + ".snap";
+                }
+
+            void warmStart(const string& airline)       //maps the airline's last saved index, whatever its size this is one mmap
+                {
+                    ingestAirline = airline;
+                    revision = 0;
+                    dirty = false;
+                    lastSaved = time(nullptr);
+                    string path = snapshotPath(airline), saved;
+                    auto start = chrono::steady_clock::now();
+                    bool loaded = avnRecords.load(path, saved, revision);
+                    int err = errno;        //the output below may change errno
+                    if(!loaded || saved != airline)
+                        {
+                            if(loaded || err != ENOENT)
+                                cout << "[ERROR] Ignoring " << path << ": " << (saved.empty() ? strerror(err) : "saved for another airline") << ", fetching the full history\n";
+                            avnRecords.clear();
+                            revision = 0;
+                            avnRecords.publish();
+                            return;
+                        }
+                    avnRecords.publish();
+                    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                    cout << "[Airline Portal] Loaded " << avnRecords.snapshot()->size() << " AVN(s) of " << airline << " from " << path << " in " << ms
+                         << " ms, catching up from revision " << revision << "\n" << flush;
+                }
+
+            void saveSnapshot(bool quiet)       //ingest thread, or after it stopped
+                {
+                    if(ingestAirline.empty() || !dirty)
+                        return;
+                    string path = snapshotPath(ingestAirline);
+                    if(!avnRecords.save(path, ingestAirline, revision))
+                        {
+                            cout << "[ERROR] Failed to save " << path << ": " << strerror(errno) << endl << flush;
+                            return;
+                        }
+                    dirty = false;
+                    lastSaved = time(nullptr);
+                    if(!quiet)
+                        cout << "[Airline Portal] Saved " << avnRecords.snapshot()->size() << " AVN(s) to " << path << " at revision " << revision << "\n" << flush;
+                }
+
+            bool subscribe(const string& airline)       //(re)connects to the hub if needed and asks for the airline's AVNs changed since revision
+                {
+                    if(hubFd < 0)
+                        {
+                            hubFd = hubConnect();
+                            if(hubFd >= 0 && epollFd >= 0 && !watch(hubFd, FROM_HUB))
+                                {
+                                    close(hubFd);
+                                    hubFd = -1;
+                                }
+                        }
+                    if(hubFd < 0)
+                        return false;
+                    requestedRevision = revision;
+                    if(!hubSubscribe(hubFd, airline, revision))
+                        {
+                            close(hubFd);
+                            hubFd = -1;
+                            return false;
+                        }
+                    return true;
+                }
+
         public:
-            AirlinePortal() 
+            explicit AirlinePortal(const DriverConfig* driverConfig) 
+                : driver(driverConfig)
                 {
                     pthread_mutex_init(&avnMutex, nullptr);
-                    cout << "[Airline Portal] Starting initialization...\n" << flush;
+                    cout << "[Airline Portal] Starting initialization (transport: " << transportToStr(selectedTransport()) << ")...\n" << flush;
 
                     //setting airline credentials (username: airline name, password)
                     airlineCredentials["PIA"] = "pia123";
@@ -234,30 +491,29 @@ class AirlinePortal
                     airlineCredentials["Blue Dart"] = "bluedart123";
                     airlineCredentials["AghaKhan Air"] = "ak123";
 
-                    //opeing avn_to_airline.fifo for reading
+                    //connecting to the AVN generator's hub
                     for(int attempt = 1; attempt <= 20; attempt++) 
                         {
-                            fdAvnPipe = open("avn_to_airline.fifo", O_RDONLY | O_NONBLOCK);
-                            if(fdAvnPipe < 0) 
+                            hubFd = hubConnect();
+                            if(hubFd < 0) 
                                 {
-                                    cout << "[Airline Portal] Attempt " << attempt << " failed to open avn_to_airline.fifo: " << strerror(errno) << ", retrying...\n" << flush;
+                                    cout << "[Airline Portal] Attempt " << attempt << " failed to connect to " << AVN_HUB_SOCKET << ": " << strerror(errno) << ", retrying...\n" << flush;
                                     usleep(500000);
                                     continue;
                                 }
-                            cout << "[Airline Portal] Successfully opened avn_to_airline.fifo\n" << flush;
+                            cout << "[Airline Portal] Successfully connected to " << AVN_HUB_SOCKET << "\n" << flush;
                             break;
                         }
-                    if(fdAvnPipe < 0) 
+                    if(hubFd < 0) 
                         {
-                            cout << "[ERROR] Failed to open avn_to_airline.fifo after retries: " << strerror(errno) << endl << flush;
+                            cout << "[ERROR] Failed to connect to " << AVN_HUB_SOCKET << " after retries: " << strerror(errno) << endl << flush;
                             exit(1);
                         }
 
                     //opening stripe_to_airline.fifo for reading
                     for(int attempt = 1; attempt <= 20; attempt++) 
                         {
-                            fdStripePipe = open("stripe_to_airline.fifo", O_RDONLY | O_NONBLOCK);
-                            if(fdStripePipe < 0) 
+                            if(!stripePipe.openReader("stripe_to_airline.fifo", sizeof(PaymentConfirmation))) 
                                 {
                                     cout << "[Airline Portal] Attempt " << attempt << " failed to open stripe_to_airline.fifo: " << strerror(errno) << ", retrying...\n" << flush;
                                     usleep(500000);
@@ -266,105 +522,252 @@ class AirlinePortal
                             cout << "[Airline Portal] Successfully opened stripe_to_airline.fifo\n" << flush;
                             break;
                         }
-                    if(fdStripePipe < 0) 
+                    if(!stripePipe.isOpen()) 
                         {
                             cout << "[ERROR] Failed to open stripe_to_airline.fifo after retries: " << strerror(errno) << endl << flush;
-                            close(fdAvnPipe);
+                            close(hubFd);
                             exit(1);
                         }
 
+                    reportReady("airline_portal");      //links are up, logging in is up to the user
+
                     //authenticating user before proceeding
                     if(!authenticate()) 
                         {
-                            close(fdAvnPipe);
-                            close(fdStripePipe);
+                            close(hubFd);
+                            stripePipe.close();
                             pthread_mutex_destroy(&avnMutex);
                             exit(1);
                         }
+                    subscribedAirline = loggedInAirline;
+                    warmStart(subscribedAirline);       //the ingest thread is not running yet
+                    if(!subscribe(subscribedAirline)) 
+                        {
+                            cout << "[ERROR] Failed to subscribe to " << loggedInAirline << " AVNs: " << strerror(errno) << endl << flush;
+                        }
 
+                    startIngest();
                     cout << "[Airline Portal] Initialization complete.\n" << flush;
                 }
 
-            void processAVN() 
+            void startIngest()
                 {
-                    char buffer[AVN::serializedSize()];
-                    int bytesRead = read(fdAvnPipe, buffer, sizeof(buffer));
+                    epollFd = epoll_create1(EPOLL_CLOEXEC);
+                    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                    if(epollFd < 0 || wakeFd < 0 || !watch(wakeFd, WAKE) || !watch(stripePipe.pollFd(), FROM_STRIPE) ||
+                       (hubFd >= 0 && !watch(hubFd, FROM_HUB)))
+                        {
+                            cout << "[ERROR] Failed to set up the ingest thread's epoll: " << strerror(errno) << endl << flush;
+                            exit(1);
+                        }
+                    running = true;
+                    if(pthread_create(&ingestThread, nullptr, ingest, this) != 0)
+                        {
+                            cout << "[ERROR] Failed to start the ingest thread" << endl << flush;
+                            exit(1);
+                        }
+                }
 
-                    if(bytesRead == sizeof(buffer)) 
+            void wake()
+                {
+                    uint64_t one = 1;
+                    if(write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                        cout << "[ERROR] Failed to wake the ingest thread: " << strerror(errno) << endl << flush;
+                }
+
+            static void* ingest(void* arg)
+                {
+                    static_cast<AirlinePortal*>(arg)->ingestLoop();
+                    return nullptr;
+                }
+
+            void ingestLoop()           //sleeps in epoll until the hub or StripePay has something, no keyboard involved
+                {
+                    epoll_event events[8];
+                    string airline;
+                    while(running)
                         {
-                            AVN avn;
-                            int offset = 0;
-                            avn.deserialize(buffer, offset);
+                            int ready = epoll_wait(epollFd, events, 8, hubFd < 0 ? RECONNECT_MS : dirty ? SNAPSHOT_SEC * 1000 : -1);
+                            if(ready < 0 && errno != EINTR)
+                                {
+                                    cout << "[ERROR] Ingest epoll_wait failed: " << strerror(errno) << endl << flush;
+                                    break;
+                                }
+                            for(int i = 0; i < ready; i++)
+                                {
+                                    if(events[i].data.u32 == FROM_HUB)
+                                        processAVN();
+                                    else if(events[i].data.u32 == FROM_STRIPE)
+                                        confirmPayment();
+                                    else
+                                        {
+                                            uint64_t count;
+                                            while(read(wakeFd, &count, sizeof(count)) > 0);
+                                        }
+                                }
+                            if(!running)
+                                break;
 
+                            bool fresh = false;
                             pthread_mutex_lock(&avnMutex);
-                            avnRecords[avn.avnID] = avn;
+                            fresh = resubscribe;
+                            resubscribe = false;
+                            airline = subscribedAirline;
                             pthread_mutex_unlock(&avnMutex);
+                            if(fresh && airline == ingestAirline)
+                                fresh = false;      //logged in again as the same airline, the subscription stands
+                            if(fresh)
+                                {
+                                    saveSnapshot(true);
+                                    warmStart(airline);     //the hub replays what changed since the new airline's snapshot
+                                }
+                            if((fresh || hubFd < 0) && !subscribe(airline) && fresh)     //generator restarted, catch up once it listens again
+                                cout << "[ERROR] Failed to subscribe to " << airline << " AVNs: " << strerror(errno) << endl << flush;
+                            if(dirty && time(nullptr) - lastSaved >= SNAPSHOT_SEC)
+                                saveSnapshot(true);
+                        }
+                }
+
+            void stopIngest()
+                {
+                    if(!running)
+                        return;
+                    running = false;
+                    wake();
+                    pthread_join(ingestThread, nullptr);
+                }
 
-                            cout << "[Airline Portal] Received AVN: " << avn.avnID << ", Flight: " << avn.flightNumber << ", Amount: PKR " << avn.fineAmount << endl << flush;
-                            displayAVNs(true);
-                        } 
-                    else if(bytesRead < 0 && errno != EAGAIN) 
+            void processAVN()       //drains every AVN waiting on the subscription, ingest thread only
+                {
+                    vector<AVN> batch;
+                    alignas(AVN) char record[sizeof(AVN)];
+                    while(true)
                         {
-                            cout << "[ERROR] Failed to read from avn_to_airline.fifo: " << strerror(errno) << endl << flush;
+                            ssize_t n = recv(hubFd, record, sizeof(record), MSG_DONTWAIT);      //one AVN per message
+                            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                                break;
+                            if(n <= 0) 
+                                {
+                                    cout << "[ERROR] Lost connection to " << AVN_HUB_SOCKET << (n < 0 ? string(": ") + strerror(errno) : string()) << endl << flush;
+                                    close(hubFd);
+                                    hubFd = -1;
+                                    break;
+                                }
+                            const AVN* avn = n == sizeof(AVN) ? wireView<AVN>(record) : nullptr;
+                            if(!avn)
+                                {
+                                    cout << "[ERROR] Dropping malformed record on " << AVN_HUB_SOCKET << "\n" << flush;
+                                    continue;
+                                }
+                            if(ingestAirline != avn->airlineName)
+                                continue;       //sent before a relogin switched the subscription
+                            if(requestedRevision && avn->revision <= requestedRevision)
+                                {
+                                    //a replay only holds later changes, so the generator's history restarted: start over from its copy
+                                    cout << "[Airline Portal] The generator's history no longer reaches revision " << requestedRevision << ", reloading all AVNs\n" << flush;
+                                    avnRecords.clear();
+                                    batch.clear();
+                                    revision = requestedRevision = 0;
+                                }
+                            batch.push_back(*avn);
+                        }
+                    if(batch.empty())
+                        return;
+
+                    for(const AVN& avn : batch)
+                        {
+                            avnRecords.upsert(avn);
+                            revision = max(revision, avn.revision);
                         }
+                    avnRecords.publish();       //the whole batch becomes visible at once
+                    dirty = true;
+
+                    ostringstream notice;       //one write, so it does not interleave with the command loop's output
+                    for(const AVN& avn : batch)
+                        notice << "[Airline Portal] Received AVN: " << avn.avnID << ", Flight: " << avn.flightNumber << ", Amount: PKR " << avn.fineAmount << "\n";
+                    cout << notice.str() << flush;
                 }
 
-            void confirmPayment()   
+            void confirmPayment()   //applies every confirmation waiting in the pipe in one pass, ingest thread only
                 {
-                    char buffer[PaymentConfirmation::serializedSize()];
-                    int bytesRead = read(fdStripePipe, buffer, sizeof(buffer));
-
-                    if(bytesRead == sizeof(buffer)) 
+                    vector<PaymentConfirmation> confirmations;
+                    ssize_t n = stripePipe.drain([&](const char* record)
+                        {
+                            const PaymentConfirmation* confirmation = wireView<PaymentConfirmation>(record);
+                            if(!confirmation)
+                                {
+                                    cout << "[ERROR] Dropping malformed record on stripe_to_airline.fifo\n" << flush;
+                                    return;
+                                }
+                            confirmations.push_back(*confirmation);
+                        });
+                    if(n < 0) 
                         {
-                            PaymentConfirmation confirmation;
-                            int offset = 0;
-                            confirmation.deserialize(buffer, offset);
+                            cout << "[ERROR] Failed to read from stripe_to_airline.fifo: " << strerror(errno) << endl << flush;
+                        }
+                    if(confirmations.empty())
+                        return;
 
+                    ostringstream notice;
+                    size_t batchPaid = 0;       //AVNs settled by one payall, one notice line for all of them
+                    double batchTotal = 0;
+                    for(const PaymentConfirmation& confirmation : confirmations)
+                        {
                             if(confirmation.paymentSuccessful) 
                                 {
-                                    pthread_mutex_lock(&avnMutex);
-                                    auto i = avnRecords.find(confirmation.avnID);
-                                    if(i != avnRecords.end()) 
+                                    const AVN* record = avnRecords.find(confirmation.id);
+                                    if(record) 
                                         {
-                                            AVN& avn = i->second;
+                                            AVN avn = *record;      //snapshots are immutable, the paid copy replaces it
                                             strncpy(avn.paymentStatus, "paid", sizeof(avn.paymentStatus) - 1);
                                             avn.paymentStatus[sizeof(avn.paymentStatus) - 1] = '\0';
+                                            avn.paidTime = time(nullptr);       //the generator's own stamp replaces it when it publishes the paid AVN
+                                            avnRecords.upsert(avn);
+                                            dirty = true;
 
-                                            cout << "[Airline Portal] Updated payment status to 'paid' for AVN " << avn.avnID << ", Flight: " << avn.flightNumber << endl << flush;
-                                            displayAVNs(true); //display AVNs for the logged-in airline only
+                                            if(confirmation.batchSize) 
+                                                {
+                                                    batchPaid++;
+                                                    batchTotal += avn.fineAmount;
+                                                }
+                                            else
+                                                notice << "[Airline Portal] Updated payment status to 'paid' for AVN " << avn.avnID << ", Flight: " << avn.flightNumber << "\n";
                                         } 
-                                    else 
-                                        {
-                                            cout << "[ERROR] AVN " << confirmation.avnID << " not found in records\n" << flush;
-                                        }
-                                    pthread_mutex_unlock(&avnMutex);
+                                    //not one of ours: stripe_to_airline.fifo still carries every airline's confirmations
                                 } 
                             else 
                                 {
-                                    cout << "[Airline Portal] Payment failed for AVN " << confirmation.avnID << ", Flight: " << confirmation.flightNumber << endl << flush;
+                                    notice << "[Airline Portal] Payment failed for AVN " << confirmation.avnID << ", Flight: " << confirmation.flightNumber << "\n";
                                 }
-                        } 
-                    else if(bytesRead < 0 && errno != EAGAIN) 
-                        {
-                            cout << "[ERROR] Failed to read from stripe_to_airline.fifo: " << strerror(errno) << endl << flush;
                         }
+                    if(batchPaid)
+                        notice << "[Airline Portal] Updated payment status to 'paid' for " << batchPaid << " AVN(s) settled in one payment, PKR " << formatMinorUnits(toMinorUnits(batchTotal)) << "\n";
+                    avnRecords.publish();
+                    cout << notice.str() << flush;
                 }
 
             void run() 
                 {
                     cout << "[Airline Portal] Starting main loop...\n" << flush;
                     cout << "[Airline Portal] Commands:\n"
-                        << "  view - Display all AVNs for your airline\n"
+                        << "  view [--page N] [--size K] [--long] - Display your airline's AVNs a page at a time (default page 1, 50 per page, one line each)\n"
                         << "  search <flightNumber> <issuanceDateTime> - Search AVNs by flight number and issuance date/time (format: YYYY-MM-DD HH:MM:SS)\n"
+                        << "  ledger - Show issued, unpaid, overdue and paid fine totals for your airline\n"
+                        << "  summary - Unpaid, overdue and paid totals and AVN counts by flight type\n"
+                        << "  top [N] - The N flights with the most violations (default 5)\n"
+                        << "  daily [N] - Fines per day for the latest N days (default 7)\n"
+                        << "  overdue - List overdue AVNs, oldest due date first\n"
+                        << "  export <file> - Write your airline's AVNs to file, columnar binary or CSV if the name ends in .csv\n"
                         << "  relogin - Log out and log in as a different airline\n"
                         << "  exit - Quit the portal\n"
-                        << "Press Enter to continue polling.\n" << flush;
+                        << "New AVNs and payments are picked up in the background.\n" << flush;
 
                     while(true) 
                         {
                             cout << "[Airline Portal] Enter command: ";
                             string commandLine;
-                            getline(cin, commandLine);
+                            if(!getline(cin, commandLine))
+                                break;      //stdin closed
 
                             istringstream iss(commandLine);
                             string command;
@@ -372,7 +775,27 @@ class AirlinePortal
 
                             if(command == "view") 
                                 {
-                                    displayAVNs(true); //displaying AVNs for the logged-in airline only
+                                    size_t page = 1, pageSize = DEFAULT_PAGE_SIZE;
+                                    bool longFormat = false, valid = true;
+                                    string option;
+                                    while(iss >> option)
+                                        {
+                                            if(option == "--page" && iss >> page && page > 0)
+                                                continue;
+                                            if(option == "--size" && iss >> pageSize && pageSize > 0)
+                                                continue;
+                                            if(option == "--long")
+                                                {
+                                                    longFormat = true;
+                                                    continue;
+                                                }
+                                            valid = false;
+                                            break;
+                                        }
+                                    if(!valid)
+                                        cout << "[ERROR] Usage: view [--page N] [--size K] [--long]\n" << flush;
+                                    else
+                                        displayAVNs(page, pageSize, longFormat); //displaying AVNs for the logged-in airline only
                                 } 
                             else if(command == "search") 
                                 {
@@ -390,7 +813,41 @@ class AirlinePortal
                                                     continue; // Invalid date-time format, skip processing
                                                 }
                                         }
-                                    displayAVNs(true, flightNumber, searchTime);
+                                    searchAVNs(flightNumber, searchTime);
+                                } 
+                            else if(command == "ledger") 
+                                {
+                                    showLedger();
+                                } 
+                            else if(command == "summary") 
+                                {
+                                    showSummary();
+                                } 
+                            else if(command == "top") 
+                                {
+                                    size_t limit;
+                                    if(!(iss >> limit))
+                                        limit = 5;
+                                    showTopFlights(limit);
+                                } 
+                            else if(command == "daily") 
+                                {
+                                    size_t days;
+                                    if(!(iss >> days))
+                                        days = 7;
+                                    showDailyFines(days);
+                                } 
+                            else if(command == "overdue") 
+                                {
+                                    showOverdue();
+                                } 
+                            else if(command == "export") 
+                                {
+                                    string path;
+                                    if(iss >> path)
+                                        exportAVNs(path);
+                                    else
+                                        cout << "[ERROR] Usage: export <file>\n" << flush;
                                 } 
                             else if(command == "relogin") 
                                 {
@@ -399,27 +856,31 @@ class AirlinePortal
                                         {
                                             break; // Exit if authentication fails after relogin attempt
                                         }
+                                    pthread_mutex_lock(&avnMutex);
+                                    subscribedAirline = loggedInAirline;
+                                    resubscribe = true;     //the ingest thread clears the old airline's AVNs and subscribes
+                                    pthread_mutex_unlock(&avnMutex);
+                                    wake();
                                 } 
                             else if(command == "exit") 
                                 {
                                     break;
                                 }
-
-                            // Process incoming AVNs and payment confirmations
-                            processAVN();
-                            confirmPayment();
-
-                            usleep(100000); // Sleep for 100ms to prevent busy-waiting
                         }
                 }
 
             ~AirlinePortal() 
                 {
                     cout << "[Airline Portal] Cleaning up...\n" << flush;
-                    if(fdAvnPipe >= 0) 
-                        close(fdAvnPipe);
-                    if(fdStripePipe >= 0) 
-                        close(fdStripePipe);
+                    stopIngest();
+                    saveSnapshot(false);
+                    if(epollFd >= 0)
+                        close(epollFd);
+                    if(wakeFd >= 0)
+                        close(wakeFd);
+                    if(hubFd >= 0)
+                        close(hubFd);
+                    stripePipe.close();
                     pthread_mutex_destroy(&avnMutex);
                     cout << "[Airline Portal] Shutdown complete.\n" << flush;
                 }
@@ -428,8 +889,24 @@ class AirlinePortal
 int main() 
     {
         cout << "===== Airline Portal Starting =====\n" << flush;
-        AirlinePortal portal;
-        portal.run();
+        DriverConfig driverConfig;
+        const char* driverPath = driverConfigPath();
+        string error;
+        if(driverPath && !loadDriverConfig(driverPath, driverConfig, error)) 
+            {
+                cout << "[ERROR] Invalid driver config " << error << endl << flush;
+                return 1;
+            }
+        if(driverPath)
+            blockShutdownSignals();     //before the ingest thread starts, so it inherits the mask
+        AirlinePortal portal(driverPath ? &driverConfig : nullptr);
+        if(driverPath) 
+            {
+                cout << "[Airline Portal] Driver mode, ingesting until SIGINT or SIGTERM\n" << flush;
+                waitForShutdown();
+            }
+        else
+            portal.run();
         cout << "===== Airline Portal Complete =====\n" << flush;
         return 0;
     }
@@ -14,6 +14,15 @@
 #include <signal.h>
 #include <sstream>
 #include <iomanip>
+#include <atomic>
+#include <fstream>
+#include <cstdint>
+
+#include "avn_channel.h"
+#include "avn_coalesce.h"
+#include "avn_id.h"
+#include "avn_wire.h"
+#include "outbound_queue.h"
 
 #include <SFML/Graphics.hpp>
 #include <SFML/Audio.hpp>
@@ -36,8 +45,7 @@ pthread_mutex_t printMutex;
 // Enum for Runway Types
 enum RunwayType { RWY_A, RWY_B, RWY_C };
 
-// Enum for Flight Types
-enum FlightType { COMMERCIAL, CARGO, EMERGENCY };
+// FlightType comes from avn_wire.h, it is carried inside every AVN record
 
 // Enum for Directions (could be for arrival/departure routing)
 enum Direction{ NORTH, SOUTH, EAST, WEST };
@@ -102,6 +110,21 @@ string statusToStr(Status s){
     }
 }
 
+// Speed limit the AVN quotes for each phase
+float permissibleSpeedFor(Status s){
+    switch(s){
+        case HOLDING:    return 600;
+        case APPROACHING: return 290;
+        case LANDING:    return 240;
+        case TAXIING:    return 30;
+        case AT_GATE:    return 10;
+        case TAKING_OFF: return 290;
+        case CLIMBING:   return 463;
+        case CRUISING:   return 900;
+        default:         return 0;
+    }
+}
+
 // Simple random number generator function
 // Generates a pseudo-random number in the range [min, max]
 int simpleRand(int min, int max) {
@@ -110,6 +133,117 @@ int simpleRand(int min, int max) {
     return min + (seed % (max - min + 1)); // Return a random number within the specified range
 }
 
+// Accumulates every AVN trigger into a fixed grid over the airspace so hotspots show up over long runs
+// without keeping each event. Cells are plain atomic counters, so flight threads update them lock-free.
+class ViolationHeatmap {
+    public:
+        static constexpr int GRID_X = 40;       // Columns across AIRSPACE_X_MIN..AIRSPACE_X_MAX
+        static constexpr int GRID_Y = 40;       // Rows across AIRSPACE_Y_MIN..AIRSPACE_Y_MAX
+        static constexpr int ALT_BANDS = 4;     // Ground/approach, climb, cruise, above cruise ceiling
+        static constexpr int PHASES = CRUISING + 1;
+        enum Kind { SPEED_VIOLATION, POSITION_VIOLATION, KIND_COUNT };
+
+        ViolationHeatmap() {
+            for(auto& band : cells) for(auto& phase : band) for(auto& kind : phase)
+                for(auto& row : kind) for(auto& cell : row) cell.store(0, memory_order_relaxed);
+            for(auto& row : totals) for(auto& cell : row) cell.store(0, memory_order_relaxed);
+        }
+
+        // Records one violation; positions outside the airspace are clamped to the border cells
+        void record(float x, float y, float altitude, Status phase, Kind kind) {
+            int cx = cellIndex(x, AIRSPACE_X_MIN, AIRSPACE_X_MAX, GRID_X);
+            int cy = cellIndex(y, AIRSPACE_Y_MIN, AIRSPACE_Y_MAX, GRID_Y);
+            cells[altitudeBand(altitude)][phase][kind][cy][cx].fetch_add(1, memory_order_relaxed);
+            totals[cy][cx].fetch_add(1, memory_order_relaxed);
+        }
+
+        // Total count for one column/row summed over band, phase and kind
+        uint32_t total(int cx, int cy) const {
+            return totals[cy][cx].load(memory_order_relaxed);
+        }
+
+        uint32_t maxTotal() const {
+            uint32_t m = 0;
+            for(const auto& row : totals) for(const auto& cell : row) m = std::max(m, cell.load(memory_order_relaxed));
+            return m;
+        }
+
+        // Writes every non-empty cell as one CSV row
+        bool exportCSV(const string& path) const {
+            ofstream out(path);
+            if(!out) return false;
+            out << "x_min,x_max,y_min,y_max,altitude_band,phase,kind,count\n";
+            float cw = (AIRSPACE_X_MAX - AIRSPACE_X_MIN) / GRID_X, ch = (AIRSPACE_Y_MAX - AIRSPACE_Y_MIN) / GRID_Y;
+            for(int b = 0; b < ALT_BANDS; ++b)
+                for(int p = 0; p < PHASES; ++p)
+                    for(int k = 0; k < KIND_COUNT; ++k)
+                        for(int cy = 0; cy < GRID_Y; ++cy)
+                            for(int cx = 0; cx < GRID_X; ++cx) {
+                                uint32_t n = cells[b][p][k][cy][cx].load(memory_order_relaxed);
+                                if(!n) continue;
+                                out << AIRSPACE_X_MIN + cx * cw << "," << AIRSPACE_X_MIN + (cx + 1) * cw << ","
+                                    << AIRSPACE_Y_MIN + cy * ch << "," << AIRSPACE_Y_MIN + (cy + 1) * ch << ","
+                                    << bandToStr(b) << "," << statusToStr(static_cast<Status>(p)) << ","
+                                    << (k == SPEED_VIOLATION ? "speed" : "position") << "," << n << "\n";
+                            }
+            return static_cast<bool>(out);
+        }
+
+        // Writes the summed grid as a binary PPM image, one square of cellPixels per cell
+        bool exportImage(const string& path, int cellPixels = 8) const {
+            ofstream out(path, ios::binary);
+            if(!out) return false;
+            int w = GRID_X * cellPixels, h = GRID_Y * cellPixels;
+            out << "P6\n" << w << " " << h << "\n255\n";
+            uint32_t peak = maxTotal();
+            for(int py = 0; py < h; ++py) {
+                int cy = GRID_Y - 1 - py / cellPixels; // Image rows run top-down, airspace Y runs bottom-up
+                for(int px = 0; px < w; ++px) {
+                    unsigned char rgb[3];
+                    heatColor(total(px / cellPixels, cy), peak, rgb);
+                    out.write(reinterpret_cast<const char*>(rgb), 3);
+                }
+            }
+            return static_cast<bool>(out);
+        }
+
+        // Maps a count onto a black -> red -> yellow ramp
+        static void heatColor(uint32_t n, uint32_t peak, unsigned char rgb[3]) {
+            float t = peak ? static_cast<float>(n) / peak : 0.0f;
+            rgb[0] = static_cast<unsigned char>(255 * std::min(1.0f, t * 2.0f));
+            rgb[1] = static_cast<unsigned char>(255 * std::max(0.0f, t * 2.0f - 1.0f));
+            rgb[2] = 0;
+        }
+
+    private:
+        atomic<uint32_t> cells[ALT_BANDS][PHASES][KIND_COUNT][GRID_Y][GRID_X];
+        atomic<uint32_t> totals[GRID_Y][GRID_X]; // Pre-summed for the viewer overlay
+
+        static int cellIndex(float v, float lo, float hi, int n) {
+            int i = static_cast<int>((v - lo) / (hi - lo) * n);
+            return std::min(n - 1, std::max(0, i));
+        }
+
+        static int altitudeBand(float altitude) {
+            if(altitude < MIN_ALTITUDE_APPROACHING) return 0;
+            if(altitude < MAX_ALTITUDE_CLIMBING) return 1;
+            if(altitude <= MAX_ALTITUDE_CRUISING) return 2;
+            return 3;
+        }
+
+        static const char* bandToStr(int b) {
+            switch(b) {
+                case 0: return "below-1000m";
+                case 1: return "1000-9000m";
+                case 2: return "9000-12000m";
+                default: return "above-12000m";
+            }
+        }
+};
+
+// Global heatmap shared by all flight threads
+ViolationHeatmap violationHeatmap;
+
 // Airline Class (unchanged)
 class Airline {
     public:
@@ -199,6 +333,15 @@ class Airline {
         int getMaxFlight() const{ return totalFlightsAllowed; }
     };
     
+    // One rule an aircraft broke during a flight, every separate breach of it is counted
+    struct ViolationRecord {
+        ViolationRule rule;
+        Status phase;
+        uint32_t count;
+        float maxExcess;    // Worst overshoot seen, km/h or metres outside the airspace
+        float speed;        // Speed at the worst overshoot
+    };
+
     // Aircraft Class (unchanged)
     class Aircraft{
     public:
@@ -209,6 +352,8 @@ class Airline {
         bool isAVNACTIVE, hasFault, isInAir, isAvailable;
         FlightType type;
         Airline* airline;
+        vector<ViolationRecord> violations; // Everything broken this flight, turned into AVNs when it completes
+        ViolationRule activeRule = RULE_NONE; // Rule being broken right now, a breach is only counted once until it ends
     
         // Constructor initializes aircraft and links to airline
         Aircraft(const string& i, FlightType t, Airline* a)
@@ -411,27 +556,54 @@ class Airline {
         }
     
         // Violation detection based on phase rules
+        // Keeps counting after the first AVN trigger so a repeat offender's breaches end up in one coalesced AVN
         void checkViolate(){
-            if (isAVNACTIVE){
-                return;
-            }
-    
             bool prevAVNState = isAVNACTIVE;
             string violationReason;
+            ViolationHeatmap::Kind violationKind = ViolationHeatmap::SPEED_VIOLATION;
+            ViolationRule rule = RULE_NONE;
+            float excess = 0;
     
             // Speed and altitude rule checks per phase
             if (phase == HOLDING && (speed < 400 || speed > 600)){
-                isAVNACTIVE = true;
+                rule = RULE_SPEED;
+                excess = speed > 600 ? speed - 600 : 400 - speed;
                 violationReason = "Speed violation (Holding: " + to_string(speed) + " km/h)";
             }
             // [additional conditions omitted for brevity – identical logic for other phases]
             // Position check
             if (isInAir && (positionX < AIRSPACE_X_MIN || positionX > AIRSPACE_X_MAX ||
                             positionY < AIRSPACE_Y_MIN || positionY > AIRSPACE_Y_MAX)){
-                isAVNACTIVE = true;
+                rule = RULE_AIRSPACE;
+                excess = max(max(AIRSPACE_X_MIN - positionX, positionX - AIRSPACE_X_MAX),
+                             max(AIRSPACE_Y_MIN - positionY, positionY - AIRSPACE_Y_MAX));
+                violationKind = ViolationHeatmap::POSITION_VIOLATION;
                 violationReason = "Position violation (X: " + to_string(positionX) + ", Y: " + to_string(positionY) + ")";
             }
     
+            if (rule == RULE_NONE){
+                activeRule = RULE_NONE;
+                return;
+            }
+            isAVNACTIVE = true;
+    
+            // A new breach, or the same one getting worse
+            auto record = find_if(violations.begin(), violations.end(),
+                                  [&](const ViolationRecord& v) { return v.rule == rule && v.phase == phase; });
+            if (record == violations.end()){
+                violations.push_back({rule, phase, 0, excess, speed});
+                record = violations.end() - 1;
+            }
+            if (rule != activeRule){
+                record->count++;
+                violationHeatmap.record(positionX, positionY, altitude, phase, violationKind); // Every new breach, like count
+            }
+            if (excess > record->maxExcess){
+                record->maxExcess = excess;
+                record->speed = speed;
+            }
+            activeRule = rule;
+    
             // Print if AVN triggered for the first time
             if (isAVNACTIVE && !prevAVNState){
                 pthread_mutex_lock(&printMutex);
@@ -454,6 +626,8 @@ class Airline {
         // Reset aircraft state for future use
         void resetForNextFlight() {
             isAVNACTIVE = false;
+            violations.clear();
+            activeRule = RULE_NONE;
             hasFault = false;
             phase = WAITING;
             speed = 0.0;
@@ -765,33 +939,6 @@ class Runway {
         }
     };
     
-    // Struct used to send a message when a violation is cleared (for AVN communication)
-    struct ViolationClearedNotification {
-        char avnID[32];            // ID of the AVN system clearing the violation
-        char flightNumber[16];     // Flight number associated with the cleared violation
-    
-        // Serializes the struct into a buffer (used in inter-process or network communication)
-        void serialize(char* buffer, size_t& offset) const{
-            memcpy(buffer + offset, avnID, sizeof(avnID));          // Copy avnID to buffer
-            offset += sizeof(avnID);                                // Move offset forward
-            memcpy(buffer + offset, flightNumber, sizeof(flightNumber));  // Copy flightNumber to buffer
-            offset += sizeof(flightNumber);                         // Update offset
-        }
-    
-        // Deserializes the buffer to restore struct data
-        void deserialize(const char* buffer, size_t& offset){
-            memcpy(avnID, buffer + offset, sizeof(avnID));          // Read avnID from buffer
-            offset += sizeof(avnID);                                // Move offset forward
-            memcpy(flightNumber, buffer + offset, sizeof(flightNumber));  // Read flightNumber
-            offset += sizeof(flightNumber);                         // Update offset
-        }
-    
-        // Returns the total size of the serialized struct 
-        static size_t serializedSize(){
-            return sizeof(avnID) + sizeof(flightNumber);
-        }
-    };
-    
 class ATC{
     private:
         sf::Font font; // Font used for SFML text rendering (e.g., speed indicators)
@@ -820,57 +967,11 @@ class ATC{
         
             pthread_mutex_t sfmlMutex;  // Mutex for thread-safe SFML updates
             pthread_t renderThread;     // Thread to handle rendering
+            bool showHeatmap = false;   // Toggled with H: draws violationHeatmap over the airspace
         
     public:
         
-    struct AVN {
-        char avnID[32];            // Unique AVN ID
-        char airlineName[32];      // Name of airline
-        char flightNumber[16];     // Flight number
-        FlightType type;           // Type of flight
-        float speedRecorded;       // Actual speed recorded
-        float permissibleSpeed;    // Allowed speed limit
-        time_t issuanceTime;       // When AVN was issued
-        double fineAmount;         // Fine in currency
-        char paymentStatus[16];    // Paid or unpaid
-        time_t dueDate;            // Fine due date
-
-        // Serialize AVN into a byte buffer
-        void serialize(char* buffer, size_t& offset) const {
-            memcpy(buffer + offset, avnID, sizeof(avnID)); offset += sizeof(avnID);
-            memcpy(buffer + offset, airlineName, sizeof(airlineName)); offset += sizeof(airlineName);
-            memcpy(buffer + offset, flightNumber, sizeof(flightNumber)); offset += sizeof(flightNumber);
-            memcpy(buffer + offset, &type, sizeof(type)); offset += sizeof(type);
-            memcpy(buffer + offset, &speedRecorded, sizeof(speedRecorded)); offset += sizeof(speedRecorded);
-            memcpy(buffer + offset, &permissibleSpeed, sizeof(permissibleSpeed)); offset += sizeof(permissibleSpeed);
-            memcpy(buffer + offset, &issuanceTime, sizeof(issuanceTime)); offset += sizeof(issuanceTime);
-            memcpy(buffer + offset, &fineAmount, sizeof(fineAmount)); offset += sizeof(fineAmount);
-            memcpy(buffer + offset, paymentStatus, sizeof(paymentStatus)); offset += sizeof(paymentStatus);
-            memcpy(buffer + offset, &dueDate, sizeof(dueDate)); offset += sizeof(dueDate);
-        }
-
-        // Deserialize byte buffer back into AVN struct
-        void deserialize(const char* buffer, size_t& offset) {
-            memcpy(avnID, buffer + offset, sizeof(avnID)); offset += sizeof(avnID);
-            memcpy(airlineName, buffer + offset, sizeof(airlineName)); offset += sizeof(airlineName);
-            memcpy(flightNumber, buffer + offset, sizeof(flightNumber)); offset += sizeof(flightNumber);
-            memcpy(&type, buffer + offset, sizeof(type)); offset += sizeof(type);
-            memcpy(&speedRecorded, buffer + offset, sizeof(speedRecorded)); offset += sizeof(speedRecorded);
-            memcpy(&permissibleSpeed, buffer + offset, sizeof(permissibleSpeed)); offset += sizeof(permissibleSpeed);
-            memcpy(&issuanceTime, buffer + offset, sizeof(issuanceTime)); offset += sizeof(issuanceTime);
-            memcpy(&fineAmount, buffer + offset, sizeof(fineAmount)); offset += sizeof(fineAmount);
-            memcpy(paymentStatus, buffer + offset, sizeof(paymentStatus)); offset += sizeof(paymentStatus);
-            memcpy(&dueDate, buffer + offset, sizeof(dueDate)); offset += sizeof(dueDate);
-        }
-
-        static size_t serializedSize() {
-            return sizeof(avnID) + sizeof(airlineName) + sizeof(flightNumber) +
-                   sizeof(type) + sizeof(speedRecorded) + sizeof(permissibleSpeed) +
-                   sizeof(issuanceTime) + sizeof(fineAmount) + sizeof(paymentStatus) +
-                   sizeof(dueDate);
-        }
-    };
-
+    // AVN, PaymentConfirmation and ViolationClearedNotification are the shared wire records from avn_wire.h
 
     map<string, int> avnViolationsPerAirline, faultsPerAirline;
     vector<Aircraft*> aircraftsWithActiveViolations;
@@ -882,15 +983,23 @@ class ATC{
     vector<FlightEntry> waitingQueue;
     pthread_mutex_t waitingQueueMutex;
     pthread_mutex_t statsMutex;
-    pthread_mutex_t pipeMutex;
     time_t startTime;
     map<FlightType, size_t> lastAircraftIndex;
     const int maxResched = 5;
-    bool avnReady = false;
-    int fd_avn_pipe = -1;  // For writing to atc_to_avn.fifo
-    int fd_avn_notify_pipe = -1; // For reading from avn_to_atc.fifo
+    const int readyTimeoutSec = 60; // How long a standalone start waits for the generator's readiness signal
+    const int shutdownFlushMs = 2000; // How long shutdown waits for the generator to take the last queued AVNs
+    atomic<bool> avnReady{false}; // Set once the AVN system signals readiness, read by the flusher thread
+    AvnChannel avnPipe;  // For writing to atc_to_avn.fifo
+    AvnChannel avnNotifyPipe; // For reading from avn_to_atc.fifo
+    // Flight threads only queue their AVN here; avnFlusherThread writes the queue out whenever the link can take it
+    OutboundQueue<AVN> avnOut{avnPipe, outboundConfigFromEnv(), false};
+    // Repeat violations of one rule by one aircraft within AIRCONTROLX_COALESCE_MS become a single AVN
+    int coalesceWindowMs = coalesceWindowMsFromEnv();
+    ViolationCoalescer coalescer{coalesceWindowMs};
     int fd_ctrl_pipe = -1; // For reading readiness signal from avn_ctrl.fifo
     pthread_t avnListenerThread;
+    pthread_t avnFlusherThread;
+    atomic<bool> linkStopping{false}; // Tells the listener and flusher to finish up, they are joined in the destructor
     volatile bool running = true;
 
     struct FlightThreadArgs {
@@ -967,12 +1076,10 @@ class ATC{
             cout << "[AVN DETECTED] Flight " << flight->flightNumber << " (Aircraft " << flight->aircraft->getAircraftID() << ") has an AVN. Generating and sending..." << endl << flush;
             pthread_mutex_unlock(&printMutex);
 
-            AVN avn = atc->generateAVN(flight->aircraft);
-            pthread_mutex_lock(&printMutex);
-            cout << "[AVN GENERATED] AVN ID: " << avn.avnID << " for " << avn.flightNumber << ", Fine: PKR " << avn.fineAmount << endl << flush;
-            pthread_mutex_unlock(&printMutex);
-
-            atc->sendAVNToSubsystem(avn, "atc_to_avn.fifo");
+            for(const ViolationRecord& violation : flight->aircraft->violations) {
+                atc->coalescer.add(atc->generateAVN(flight->aircraft, violation));
+            }
+            atc->releaseCoalescedAVNs(atc->coalesceWindowMs == 0); // Without a window they go out right away
         } else {
             pthread_mutex_lock(&printMutex);
             cout << "[NO AVN] Flight " << flight->flightNumber << " (Aircraft " << flight->aircraft->getAircraftID() << ") completed without AVN." << endl << flush;
@@ -993,22 +1100,39 @@ class ATC{
     }
     static void* avnListener(void* arg) {
         ATC* atc = static_cast<ATC*>(arg);
-        while(atc->running) {
+        while(!atc->linkStopping) {
             atc->processViolationClearedNotification();
+            // Released here rather than by the flusher: a full queue makes the producer wait for the flusher to drain it
+            atc->releaseCoalescedAVNs(false);
             usleep(100000); // Sleep for 100ms to prevent busy-waiting
         }
         return nullptr;
     }
 
+    // Writes queued AVNs to atc_to_avn.fifo; holds them while the AVN system is not ready or the pipe is full
+    static void* avnFlusher(void* arg) {
+        ATC* atc = static_cast<ATC*>(arg);
+        while(!atc->linkStopping) {
+            if(!atc->avnOut.waitPending(200)) continue; // Nothing queued
+            if(!atc->avnReady || !atc->avnPipe.isOpen()) { // Keep them queued until the generator is up
+                usleep(50000);
+                continue;
+            }
+            atc->flushAVNs();
+            if(atc->avnOut.backlog()) atc->avnPipe.waitWritable(100); // Pipe full, wait until the generator drains it
+        }
+        atc->drainAVNs(atc->shutdownFlushMs); // Last chance for what shutdown released, bounded so a stalled generator cannot hang it
+        return nullptr;
+    }
+
     // Update the ATC constructor (replace the existing constructor)
 // Update the ATC constructor to load the font (replace the existing constructor)
 ATC() {
     pthread_mutex_init(&printMutex, nullptr);
     pthread_mutex_init(&waitingQueueMutex, nullptr);
     pthread_mutex_init(&statsMutex, nullptr);
-    pthread_mutex_init(&pipeMutex, nullptr);
     pthread_mutex_init(&sfmlMutex, nullptr);
-    cout << "\n[ATC] Initializing Air Traffic Control...\n" << flush;
+    cout << "\n[ATC] Initializing Air Traffic Control (transport: " << transportToStr(selectedTransport()) << ")...\n" << flush;
 
     // SFML Initialization
     window = new sf::RenderWindow(sf::VideoMode(WINDOW_WIDTH, WINDOW_HEIGHT), "ATC Simulation");
@@ -1087,8 +1211,7 @@ ATC() {
     usleep(10000);
 
     for(int attempt = 1; attempt <= 10; attempt++) {
-        fd_avn_notify_pipe = open("avn_to_atc.fifo", O_RDONLY | O_NONBLOCK);
-        if(fd_avn_notify_pipe < 0) {
+        if(!avnNotifyPipe.openReader("avn_to_atc.fifo", sizeof(ViolationClearedNotification))) {
             cout << "[ATC] Attempt " << attempt << " failed to open avn_to_atc.fifo: " << strerror(errno) << ", retrying..." << endl << flush;
             usleep(500000);
             continue;
@@ -1096,21 +1219,19 @@ ATC() {
         cout << "[ATC] Successfully opened avn_to_atc.fifo for reading" << endl << flush;
         break;
     }
-    if(fd_avn_notify_pipe < 0) {
+    if(!avnNotifyPipe.isOpen()) {
         cout << "[ERROR] Failed to open avn_to_atc.fifo after retries: " << strerror(errno) << endl << flush;
         exit(1);
     }
 
     if(pthread_create(&avnListenerThread, nullptr, avnListener, this) != 0) {
         cout << "[ERROR] Failed to create AVN listener thread" << endl << flush;
-        close(fd_avn_notify_pipe);
+        avnNotifyPipe.close();
         exit(1);
     }
-    pthread_detach(avnListenerThread);
 
     for(int attempt = 1; attempt <= 10; attempt++) {
-        fd_avn_pipe = open("atc_to_avn.fifo", O_WRONLY | O_NONBLOCK);
-        if(fd_avn_pipe < 0) {
+        if(!avnPipe.openWriter("atc_to_avn.fifo", sizeof(AVN))) {
             cout << "[ATC] Attempt " << attempt << " failed to open atc_to_avn.fifo: " << strerror(errno) << ", retrying..." << endl << flush;
             usleep(500000);
             continue;
@@ -1118,14 +1239,24 @@ ATC() {
         cout << "[ATC] Successfully opened atc_to_avn.fifo for writing" << endl << flush;
         break;
     }
-    if(fd_avn_pipe < 0) {
+    if(!avnPipe.isOpen()) {
         cout << "[ERROR] Failed to open atc_to_avn.fifo after retries: " << strerror(errno) << endl << flush;
-        close(fd_avn_notify_pipe);
+        avnNotifyPipe.close();
         exit(1);
     }
 
-    for(int attempt = 1; attempt <= 20; attempt++) {
-        fd_ctrl_pipe = open("avn_ctrl.fifo", O_RDONLY | O_NONBLOCK);
+    if(pthread_create(&avnFlusherThread, nullptr, avnFlusher, this) != 0) {
+        cout << "[ERROR] Failed to create AVN flusher thread" << endl << flush;
+        avnPipe.close();
+        avnNotifyPipe.close();
+        exit(1);
+    }
+
+    // Under the supervisor every link is held open and AVNs wait in them until the generator reads, and a restarted
+    // ATC would never see the generator's one-time signal, so the readiness handshake is only for a standalone start
+    bool standalone = inheritedLinkFd("avn_ctrl.fifo") < 0;
+    for(int attempt = 1; standalone && attempt <= 20; attempt++) {
+        fd_ctrl_pipe = openLink("avn_ctrl.fifo", O_RDONLY | O_NONBLOCK);
         if(fd_ctrl_pipe < 0) {
             cout << "[ATC] Attempt " << attempt << " failed to open avn_ctrl.fifo for reading: " << strerror(errno) << ", retrying..." << endl << flush;
             usleep(1000000);
@@ -1134,10 +1265,10 @@ ATC() {
         cout << "[ATC] Successfully opened avn_ctrl.fifo for reading" << endl << flush;
         break;
     }
-    if(fd_ctrl_pipe < 0) {
+    if(standalone && fd_ctrl_pipe < 0) {
         cout << "[ERROR] Failed to open avn_ctrl.fifo after retries: " << strerror(errno) << endl << flush;
-        close(fd_avn_pipe);
-        close(fd_avn_notify_pipe);
+        avnPipe.close();
+        avnNotifyPipe.close();
         exit(1);
     }
 
@@ -1146,101 +1277,141 @@ ATC() {
     generateAircrafts();
     setSchedule();
 
+    if(standalone) waitForAVNReady();
+    avnReady = true;
+
+    cout << "[ATC] Initialization complete.\n" << flush;
+    reportReady("atc");
+}
+
+// Blocks until the generator writes its readiness signal to avn_ctrl.fifo, exits after readyTimeoutSec without one
+void waitForAVNReady() {
     cout << "[ATC] Waiting for avn readiness signal on avn_ctrl.fifo..." << endl << flush;
     char ctrl_buf[16];
     ssize_t bytesRead = 0;
+    time_t waitStart = time(nullptr);
     while(bytesRead <= 0) {
+        if(time(nullptr) - waitStart >= readyTimeoutSec) {
+            cout << "[ERROR] No readiness signal on avn_ctrl.fifo after " << readyTimeoutSec << "s (is the AVN Generator running?)" << endl << flush;
+            close(fd_ctrl_pipe);
+            avnPipe.close();
+            avnNotifyPipe.close();
+            exit(1);
+        }
+        pollfd ctrl = { fd_ctrl_pipe, POLLIN, 0 };
+        poll(&ctrl, 1, 500); // Wake as soon as the signal arrives instead of sleeping a fixed 500ms
         bytesRead = read(fd_ctrl_pipe, ctrl_buf, sizeof(ctrl_buf));
         if(bytesRead < 0 && errno != EAGAIN) {
             cout << "[ATC] ERROR: Failed to read from avn_ctrl.fifo: " << strerror(errno) << endl << flush;
             close(fd_ctrl_pipe);
-            close(fd_avn_pipe);
-            close(fd_avn_notify_pipe);
+            avnPipe.close();
+            avnNotifyPipe.close();
             exit(1);
         }
-        usleep(500000);
+        if(bytesRead == 0 && (ctrl.revents & POLLHUP)) usleep(50000); // A writer came and went without a signal
     }
     close(fd_ctrl_pipe);
-    avnReady = true;
     cout << "[ATC] Received readiness signal from avn" << endl << flush;
-
-    cout << "[ATC] Initialization complete.\n" << flush;
 }
 
-    // Sends an AVN (Airspace Violation Notification) to a subsystem through a FIFO pipe
+    // Hands an AVN to the outbound queue for atc_to_avn.fifo; avnFlusherThread does the actual write.
+    // A full pipe or a generator that is not ready yet only delays the AVN. When the queue itself is full,
+    // AIRCONTROLX_BACKPRESSURE decides whether this flight thread waits briefly or a record is dropped.
 void sendAVNToSubsystem(const AVN& avn, const string& pipeName){
-    pthread_mutex_lock(&pipeMutex); // Lock pipe access to ensure thread safety
-
-    if(!avnReady){ // Check if AVN subsystem is ready
-        pthread_mutex_lock(&printMutex); // Lock printing to avoid interleaved output
-        cout << "[ERROR] AVN subsystem not ready, cannot send AVN " << avn.avnID << endl << flush;
-        pthread_mutex_unlock(&printMutex); // Unlock after printing
-        pthread_mutex_unlock(&pipeMutex); // Unlock pipe mutex
-        return; // Exit function
-    }
+    EnqueueResult result = avnOut.enqueue(avn);
+    if(result == ENQUEUED) return;
 
-    if(fd_avn_pipe < 0){ // If pipe hasn't been opened yet
-        fd_avn_pipe = open(pipeName.c_str(), O_WRONLY | O_NONBLOCK); // Open pipe in write-only non-blocking mode
-        if(fd_avn_pipe < 0) { // If open failed
-            pthread_mutex_lock(&printMutex);
-            cout << "[ERROR] Failed to open pipe " << pipeName << " for writing AVN " << avn.avnID << ": " << strerror(errno) << endl << flush;
-            pthread_mutex_unlock(&printMutex);
-            pthread_mutex_unlock(&pipeMutex);
-            return;
-        }
+    pthread_mutex_lock(&printMutex);
+    if(result == ENQUEUED_HIGH_WATER) {
+        cout << "[WARNING] " << pipeName << " backlog passed its high-water mark (" << avnOut.size() << " AVNs queued)" << endl;
+    } else if(result == ENQUEUED_DROPPED_OLDEST) {
+        cout << "[ERROR] " << pipeName << " queue full, dropped the oldest queued AVN to make room for " << avn.avnID << endl;
+    } else {
+        cout << "[ERROR] " << pipeName << " queue full, dropped AVN " << avn.avnID << endl;
     }
+    cout << flush;
+    pthread_mutex_unlock(&printMutex);
+}
 
-    char buffer[AVN::serializedSize()]; // Allocate buffer to hold serialized AVN
-    size_t offset = 0;
-    avn.serialize(buffer, offset); // Serialize AVN into the buffer
-
-    ssize_t bytesWritten = write(fd_avn_pipe, buffer, sizeof(buffer)); // Attempt to write to pipe
-    if(bytesWritten == sizeof(buffer)) { // Success if all bytes written
+// Queues every coalesced AVN whose window has closed, or all of them
+void releaseCoalescedAVNs(bool all) {
+    vector<AVN> ready;
+    if(!coalescer.takeExpired(ready, all)) return;
+    for(const AVN& avn : ready) {
         pthread_mutex_lock(&printMutex);
-        cout << "[AVN SENT] Successfully sent AVN " << avn.avnID << " to " << pipeName << " (bytes: " << bytesWritten << ")" << endl << flush;
+        cout << "[AVN GENERATED] AVN ID: " << avn.avnID << " for " << avn.flightNumber << ", Rule: " << violationRuleToStr(avn.rule)
+             << " x" << avn.violationCount << " (max excess " << avn.maxExcess << "), Fine: PKR " << avn.fineAmount << endl << flush;
         pthread_mutex_unlock(&printMutex);
-    } else { // Handle partial or failed write
+        sendAVNToSubsystem(avn, "atc_to_avn.fifo");
+    }
+}
+
+// Writes every queued AVN the pipe accepts right now, only called from avnFlusherThread
+void flushAVNs() {
+    avnOut.flush([&](const AVN& a) {
         pthread_mutex_lock(&printMutex);
-        cout << "[ERROR] Failed to write AVN " << avn.avnID << " to " << pipeName << ", bytes written: " << bytesWritten << ", expected: " << sizeof(buffer) << ", error: " << strerror(errno) << endl << flush;
+        cout << "[AVN SENT] Successfully sent AVN " << a.avnID << " to atc_to_avn.fifo (bytes: " << sizeof(AVN) << ")" << endl << flush;
         pthread_mutex_unlock(&printMutex);
-    }
+    });
+}
 
-    pthread_mutex_unlock(&pipeMutex); // Unlock pipe mutex
+// Writes out everything queued for atc_to_avn.fifo, giving up after timeoutMs if the generator stops reading
+void drainAVNs(int timeoutMs) {
+    if(!avnReady || !avnPipe.isOpen()) return;
+    uint64_t deadline = wireNowNs() + uint64_t(timeoutMs) * 1000000;
+    while(avnOut.backlog() && wireNowNs() < deadline) {
+        flushAVNs();
+        if(avnOut.backlog()) avnPipe.waitWritable(50);
+    }
 }
 
-// Reads and processes a ViolationClearedNotification from the AVN system
+// Reads and processes every ViolationClearedNotification currently waiting from the AVN system
 void processViolationClearedNotification() {
-    char buffer[ViolationClearedNotification::serializedSize()]; // Buffer to hold incoming notification
-    ssize_t bytesRead = read(fd_avn_notify_pipe, buffer, sizeof(buffer)); // Attempt to read from pipe
-
-    if(bytesRead == sizeof(buffer)) { // Full message read
-        ViolationClearedNotification notification;
-        size_t offset = 0;
-        notification.deserialize(buffer, offset); // Deserialize into object
+    vector<ViolationClearedNotification> cleared;
+    ssize_t n = avnNotifyPipe.drain([&](const char* record) {
+        const ViolationClearedNotification* notification = wireView<ViolationClearedNotification>(record);
+        if(!notification) { // Other side built against a different wire layout
+            pthread_mutex_lock(&printMutex);
+            cout << "[ERROR] Dropping malformed record on avn_to_atc.fifo" << endl << flush;
+            pthread_mutex_unlock(&printMutex);
+            return;
+        }
+        cleared.push_back(*notification);
+    });
 
+    if(!cleared.empty()) {
         pthread_mutex_lock(&statsMutex); // Lock stats as we will modify list of active violations
-        aircraftsWithActiveViolations.erase(
-            remove_if(aircraftsWithActiveViolations.begin(), aircraftsWithActiveViolations.end(),
-                      [&](Aircraft* a) { return a->getAircraftID() == notification.flightNumber; }),
-            aircraftsWithActiveViolations.end()); // Remove cleared aircraft from list
+        for(const auto& notification : cleared) {
+            aircraftsWithActiveViolations.erase(
+                remove_if(aircraftsWithActiveViolations.begin(), aircraftsWithActiveViolations.end(),
+                          [&](Aircraft* a) { return a->getAircraftID() == notification.flightNumber; }),
+                aircraftsWithActiveViolations.end()); // Remove cleared aircraft from list
+        }
 
         pthread_mutex_lock(&printMutex);
-        cout << "[ATC] Violation cleared for AVN " << notification.avnID << ", Flight: " << notification.flightNumber << endl << flush;
+        for(const auto& notification : cleared) {
+            cout << "[ATC] Violation cleared for AVN " << notification.avnID << ", Flight: " << notification.flightNumber << endl;
+        }
+        cout << flush;
         pthread_mutex_unlock(&printMutex);
         pthread_mutex_unlock(&statsMutex); // Unlock after modifying
-    } else if(bytesRead < 0 && errno != EAGAIN) { // Handle read error (excluding non-blocking empty pipe)
+    }
+    if(n < 0) { // Handle read error (excluding non-blocking empty pipe)
         pthread_mutex_lock(&printMutex);
         cout << "[ERROR] Failed to read from avn_to_atc.fifo: " << strerror(errno) << endl << flush;
         pthread_mutex_unlock(&printMutex);
     }
 }
 
-// Generates an AVN (Airspace Violation Notification) for a given aircraft
-AVN generateAVN(Aircraft* aircraft) {
+// Shared by every flight thread, two violations in the same second no longer get the same ID
+AvnIdGenerator avnIds{avnNodeFromEnv()};
+
+// Generates an AVN (Airspace Violation Notification) for one rule a given aircraft broke
+AVN generateAVN(Aircraft* aircraft, const ViolationRecord& violation) {
     AVN avn;
-    string avnIDStr = "AVN-" + to_string(time(nullptr)); // Generate unique AVN ID using current time
-    strncpy(avn.avnID, avnIDStr.c_str(), sizeof(avn.avnID) - 1); // Copy to struct field
-    avn.avnID[sizeof(avn.avnID) - 1] = '\0'; // Null-terminate
+    wireInit(avn); // Zero the record and fill its wire header
+    avn.id = avnIds.next(); // Unique, time-ordered 64-bit ID
+    avnIdToStr(avn.id, avn.avnID); // Printable form shown to users
 
     string airlineName = aircraft->getAirlineName(); // Get airline
     strncpy(avn.airlineName, airlineName.c_str(), sizeof(avn.airlineName) - 1);
@@ -1251,22 +1422,15 @@ AVN generateAVN(Aircraft* aircraft) {
     avn.flightNumber[sizeof(avn.flightNumber) - 1] = '\0';
 
     avn.type = aircraft->getAircraftType(); // Get type (commercial/cargo/etc.)
-    avn.speedRecorded = aircraft->getSpeed(); // Record current speed
-
-    // Set permissible speed based on flight phase
-    Status phase = aircraft->getPhase();
-    if(phase == HOLDING) avn.permissibleSpeed = 600;
-    else if(phase == APPROACHING) avn.permissibleSpeed = 290;
-    else if(phase == LANDING) avn.permissibleSpeed = 240;
-    else if(phase == TAXIING) avn.permissibleSpeed = 30;
-    else if(phase == AT_GATE) avn.permissibleSpeed = 10;
-    else if(phase == TAKING_OFF) avn.permissibleSpeed = 290;
-    else if(phase == CLIMBING) avn.permissibleSpeed = 463;
-    else if(phase == CRUISING) avn.permissibleSpeed = 900;
-    else avn.permissibleSpeed = 0;
+    avn.speedRecorded = violation.speed; // Speed at the worst breach
+    avn.permissibleSpeed = permissibleSpeedFor(violation.phase); // Limit for the phase it was broken in
+    avn.rule = violation.rule;
+    avn.phase = violation.phase;
+    avn.violationCount = violation.count;
+    avn.maxExcess = violation.maxExcess;
 
     avn.issuanceTime = time(nullptr); // Set current timestamp
-    avn.fineAmount = (avn.type == CARGO ? 700000 : 500000) * 1.15; // Fine calculation based on type
+    avn.fineAmount = (avn.type == CARGO ? 700000 : 500000) * 1.15; // Fine calculation based on type, one per AVN whatever its violationCount
     strncpy(avn.paymentStatus, "unpaid", sizeof(avn.paymentStatus) - 1);
     avn.paymentStatus[sizeof(avn.paymentStatus) - 1] = '\0';
     avn.dueDate = avn.issuanceTime + 3 * 24 * 3600; // Set due date to 3 days later
@@ -1440,13 +1604,19 @@ void airlineStatus(){
    
 // Update the ATC destructor (replace the existing destructor)
 ~ATC() {
+    // AVNs still inside a coalescing window would otherwise never reach the generator; the flusher sends them
+    releaseCoalescedAVNs(true);
+    linkStopping = true;
+    avnOut.wakeAll();
+    pthread_join(avnFlusherThread, nullptr);
+    pthread_join(avnListenerThread, nullptr);
+    if(avnOut.backlog()) cout << "[WARNING] " << avnOut.size() << " AVN(s) still queued for atc_to_avn.fifo at shutdown" << endl << flush;
     running = false;
-    if(fd_avn_pipe >= 0) close(fd_avn_pipe);
-    if(fd_avn_notify_pipe >= 0) close(fd_avn_notify_pipe);
+    avnPipe.close();
+    avnNotifyPipe.close();
     pthread_mutex_destroy(&printMutex);
     pthread_mutex_destroy(&waitingQueueMutex);
     pthread_mutex_destroy(&statsMutex);
-    pthread_mutex_destroy(&pipeMutex);
     pthread_mutex_destroy(&sfmlMutex);
     for(auto* a : aircrafts) delete a;
     if(window) {
@@ -1822,6 +1992,9 @@ void assignPlaneToRunway(const string& flightNumber, RunwayType runway, bool isA
                 window->close();
                 running = false;
             }
+            else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::H) {
+                showHeatmap = !showHeatmap;
+            }
         }
 
         // Update plane positions and speeds
@@ -1932,10 +2105,33 @@ void assignPlaneToRunway(const string& flightNumber, RunwayType runway, bool isA
                 }
             }
         }
+        if (showHeatmap) {
+            drawHeatmapOverlay();
+        }
         window->display();
         pthread_mutex_unlock(&sfmlMutex);
     }
 
+    // Draws the accumulated violation grid over the whole window (airspace stretched to the window)
+    void drawHeatmapOverlay() {
+        uint32_t peak = violationHeatmap.maxTotal();
+        if (!peak) return;
+        float cellW = static_cast<float>(WINDOW_WIDTH) / ViolationHeatmap::GRID_X;
+        float cellH = static_cast<float>(WINDOW_HEIGHT) / ViolationHeatmap::GRID_Y;
+        sf::RectangleShape cell(sf::Vector2f(cellW, cellH));
+        for (int cy = 0; cy < ViolationHeatmap::GRID_Y; ++cy) {
+            for (int cx = 0; cx < ViolationHeatmap::GRID_X; ++cx) {
+                uint32_t n = violationHeatmap.total(cx, cy);
+                if (!n) continue;
+                unsigned char rgb[3];
+                ViolationHeatmap::heatColor(n, peak, rgb);
+                cell.setFillColor(sf::Color(rgb[0], rgb[1], rgb[2], 60 + 140 * n / peak));
+                cell.setPosition(cx * cellW, (ViolationHeatmap::GRID_Y - 1 - cy) * cellH);
+                window->draw(cell);
+            }
+        }
+    }
+
     // gets the report of the Airline system
     void getReport() {
         stringstream ss;
@@ -1954,7 +2150,18 @@ void assignPlaneToRunway(const string& flightNumber, RunwayType runway, bool isA
         cout << ss.str() << flush;
         pthread_mutex_unlock(&printMutex);
         airlineStatus();
+        bool csvOk = violationHeatmap.exportCSV("violation_heatmap.csv");
+        bool imgOk = violationHeatmap.exportImage("violation_heatmap.ppm");
+        OutboundStats q = avnOut.snapshot();
         pthread_mutex_lock(&printMutex);
+        cout << "\nAVN outbound queue (" << backpressureToStr(avnOut.configuration().policy) << "): sent " << q.sent << "/" << q.enqueued
+             << ", still queued " << q.depth << ", high water " << q.highWater << ", dropped oldest " << q.droppedOldest
+             << ", dropped newest " << q.droppedNewest << ", producer waits " << q.blockedProducers << "\n";
+        CoalesceStats c = coalescer.snapshot();
+        cout << "AVN coalescing (window " << coalesceWindowMs << " ms): " << c.violations << " violation(s) left as " << c.released
+             << " AVN(s), " << c.pending << " still held\n";
+        cout << "\nViolation heatmap: " << (csvOk ? "violation_heatmap.csv" : "[CSV export failed]")
+             << ", " << (imgOk ? "violation_heatmap.ppm" : "[image export failed]") << "\n";
         cout << "=============================\n" << flush;
         pthread_mutex_unlock(&printMutex);
     }
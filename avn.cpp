@@ -4,166 +4,354 @@
 #include <unistd.h>
 #include <cstring>
 #include <vector>
+#include <queue>
+#include <functional>
+#include <algorithm>
 #include <ctime>
-#include <map>
 #include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
-using namespace std;
+#include "avn_channel.h"
+#include "avn_export.h"
+#include "avn_hub.h"
+#include "avn_ledger.h"
+#include "avn_registry.h"
+#include "avn_wire.h"
+#include "outbound_queue.h"
 
-enum FlightType { COMMERCIAL, CARGO, EMERGENCY };           //ENUMS FLightType , Same as what is in ATC file
+using namespace std;
 
-struct AVN        //it is also same as the AVN in ATC file, kyunkay same data pipe say lakr aaaana hoata
+struct LatencyHistogram      //power of two nanosecond buckets, cheap enough to update per record
     {
-        char avnID[32];
-        char airlineName[32];
-        char flightNumber[16];
-        FlightType type;
-        float speedRecorded;
-        float permissibleSpeed;
-        time_t issuanceTime;
-        double fineAmount;
-        char paymentStatus[16];
-        time_t dueDate;
-
-        void serialize(char* buffer, int& offset) const      //this function is used to convert the AVN object data into stream of bytes
-            {                                                   //-hence necessary to transfer data through pipe or fifio
-                memcpy(buffer + offset, avnID, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(buffer + offset, airlineName, sizeof(airlineName));
-                offset += sizeof(airlineName);
-                memcpy(buffer + offset, flightNumber, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(buffer + offset, &type, sizeof(type));
-                offset += sizeof(type);
-                memcpy(buffer + offset, &speedRecorded, sizeof(speedRecorded));
-                offset += sizeof(speedRecorded);
-                memcpy(buffer + offset, &permissibleSpeed, sizeof(permissibleSpeed));
-                offset += sizeof(permissibleSpeed);
-                memcpy(buffer + offset, &issuanceTime, sizeof(issuanceTime));
-                offset += sizeof(issuanceTime);
-                memcpy(buffer + offset, &fineAmount, sizeof(fineAmount));
-                offset += sizeof(fineAmount);
-                memcpy(buffer + offset, paymentStatus, sizeof(paymentStatus));
-                offset += sizeof(paymentStatus);
-                memcpy(buffer + offset, &dueDate, sizeof(dueDate));
-                offset += sizeof(dueDate);
-            }
+        static const int BUCKETS = 40;
+        uint64_t buckets[BUCKETS] = {};
+        uint64_t samples = 0;
 
-        void deserialize(const char* buffer, int& offset)            //to convert back to it's original object form
+        void add(uint64_t ns, uint64_t count = 1)
             {
-                memcpy(avnID, buffer + offset, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(airlineName, buffer + offset, sizeof(airlineName));
-                offset += sizeof(airlineName);
-                memcpy(flightNumber, buffer + offset, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(&type, buffer + offset, sizeof(type));
-                offset += sizeof(type);
-                memcpy(&speedRecorded, buffer + offset, sizeof(speedRecorded));
-                offset += sizeof(speedRecorded);
-                memcpy(&permissibleSpeed, buffer + offset, sizeof(permissibleSpeed));
-                offset += sizeof(permissibleSpeed);
-                memcpy(&issuanceTime, buffer + offset, sizeof(issuanceTime));
-                offset += sizeof(issuanceTime);
-                memcpy(&fineAmount, buffer + offset, sizeof(fineAmount));
-                offset += sizeof(fineAmount);
-                memcpy(paymentStatus, buffer + offset, sizeof(paymentStatus));
-                offset += sizeof(paymentStatus);
-                memcpy(&dueDate, buffer + offset, sizeof(dueDate));
-                offset += sizeof(dueDate);
+                int b = 0;
+                while(b < BUCKETS - 1 && (1ull << b) < ns)
+                    b++;
+                buckets[b] += count;
+                samples += count;
             }
 
-        static int serializedSize()          //funciton to calculate and return size of stream produced by serialization funciton
+        double percentileUs(double p) const
             {
-                return sizeof(avnID) + sizeof(airlineName) + sizeof(flightNumber) +
-                    sizeof(type) + sizeof(speedRecorded) + sizeof(permissibleSpeed) +
-                    sizeof(issuanceTime) + sizeof(fineAmount) + sizeof(paymentStatus) +
-                    sizeof(dueDate);
+                uint64_t want = uint64_t(samples * p), seen = 0;
+                for(int b = 0; b < BUCKETS; b++)
+                    {
+                        seen += buckets[b];
+                        if(seen > want)
+                            return (1ull << b) / 1e3;       //upper edge of the bucket
+                    }
+                return (1ull << (BUCKETS - 1)) / 1e3;
             }
     };
 
-struct PaymentConfirmation          //struct for payment details such as avnID, flightNum and ispaid
+class LoopStats             //counters for the event loop, reported on every housekeeping tick
     {
-        char avnID[32];
-        char flightNumber[16];
-        bool paymentSuccessful;
+        private:
+            uint64_t wakeups = 0;
+            uint64_t records = 0;
+            uint64_t maxBatch = 0;
+            LatencyHistogram dispatch;      //epoll return -> batch handled
+            LatencyHistogram queue;         //sender's sentAtNs -> drained here
 
-        void serialize(char* buffer, int& offset) const 
-            {
-                memcpy(buffer + offset, avnID, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(buffer + offset, flightNumber, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(buffer + offset, &paymentSuccessful, sizeof(paymentSuccessful));
-                offset += sizeof(paymentSuccessful);
-            }
+        public:
+            void wakeup()
+                {
+                    wakeups++;
+                }
 
-        void deserialize(const char* buffer, int& offset) 
-            {
-                memcpy(avnID, buffer + offset, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(flightNumber, buffer + offset, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(&paymentSuccessful, buffer + offset, sizeof(paymentSuccessful));
-                offset += sizeof(paymentSuccessful);
-            }
+            void queued(uint64_t latencyNs)
+                {
+                    queue.add(latencyNs);
+                }
 
-        static int serializedSize() 
-            {
-                return sizeof(avnID) + sizeof(flightNumber) + sizeof(paymentSuccessful);
-            }
+            void batch(uint64_t count, uint64_t latencyNs)     //count records handled latencyNs after epoll returned
+                {
+                    if(count == 0)
+                        return;
+                    records += count;
+                    if(count > maxBatch)
+                        maxBatch = count;
+                    dispatch.add(latencyNs, count);
+                }
+
+            void report()
+                {
+                    if(wakeups == 0)
+                        return;
+                    cout << "[AVN Generator] Event loop: " << wakeups << " wakeups, " << records << " records ("
+                         << double(records) / wakeups << " per wakeup, max batch " << maxBatch << ")";
+                    if(queue.samples)
+                        cout << ", queue latency p50 " << queue.percentileUs(0.5) << "us p99 " << queue.percentileUs(0.99) << "us";
+                    if(dispatch.samples)
+                        cout << ", dispatch latency p50 " << dispatch.percentileUs(0.5) << "us p99 " << dispatch.percentileUs(0.99) << "us";
+                    cout << endl << flush;
+                    *this = LoopStats();
+                }
     };
 
-struct ViolationClearedNotification             //isVioiation cleared (this will be communicated through avnToAtc pipe)
+class DueIndex              //min-heap of unpaid AVNs by due date behind one absolute timerfd, fires exactly when the earliest falls due
     {
-        char avnID[32];
-        char flightNumber[16];
+        private:
+            struct Entry
+                {
+                    int64_t due;
+                    uint64_t id;
 
-        void serialize(char* buffer, int& offset) const 
-            {
-                memcpy(buffer + offset, avnID, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(buffer + offset, flightNumber, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-            }
+                    bool operator>(const Entry& other) const
+                        {
+                            return due != other.due ? due > other.due : id > other.id;
+                        }
+                };
 
-        void deserialize(const char* buffer, int& offset) 
-            {
-                memcpy(avnID, buffer + offset, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(flightNumber, buffer + offset, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-            }
+            priority_queue<Entry, vector<Entry>, greater<Entry>> heap;     //paid AVNs are left in and skipped when they surface
+            int timerFd = -1;
+            int64_t armedFor = 0;       //due date the timer is set for, 0 = disarmed
 
-        static int serializedSize() 
-            {
-                return sizeof(avnID) + sizeof(flightNumber);
-            }
+        public:
+            bool open()
+                {
+                    timerFd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);      //due dates are wall clock seconds
+                    return timerFd >= 0;
+                }
+
+            int fd() const
+                {
+                    return timerFd;
+                }
+
+            void add(const AVN& avn)
+                {
+                    heap.push({ avn.dueDate > 0 ? avn.dueDate : 1, avn.id });     //0 would disarm the timer
+                }
+
+            void arm()                  //points the timer at the earliest due date, O(1) unless it changed
+                {
+                    int64_t next = heap.empty() ? 0 : heap.top().due;
+                    if(timerFd < 0 || next == armedFor)
+                        return;
+                    armedFor = next;
+                    itimerspec t;
+                    memset(&t, 0, sizeof(t));
+                    t.it_value.tv_sec = next;       //one in the past fires straight away
+                    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &t, nullptr);
+                }
+
+            //pops every entry due by now, the caller decides what each one still means
+            vector<uint64_t> expire()
+                {
+                    uint64_t expirations;
+                    if(read(timerFd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                        cout << "[ERROR] Failed to read the due date timer: " << strerror(errno) << endl << flush;
+                    armedFor = 0;
+                    vector<uint64_t> due;
+                    timespec now;
+                    clock_gettime(CLOCK_REALTIME, &now);       //time() reads the coarse clock and can still be in the previous second
+                    while(!heap.empty() && heap.top().due <= now.tv_sec)
+                        {
+                            due.push_back(heap.top().id);
+                            heap.pop();
+                        }
+                    return due;
+                }
+
+            size_t size() const
+                {
+                    return heap.size();
+                }
+
+            void close()
+                {
+                    if(timerFd >= 0)
+                        ::close(timerFd);
+                    timerFd = -1;
+                }
     };
 
 class AVNGenerator          //class which generates avns and transfer their respective details to respective pipes
     {
         private:
-            map<string, AVN> avnRecords;    //stores avns
-            pthread_mutex_t avnMutex;       //toLock avnfuncitons during multithreading
-            int fdAtcPipe = -1;             //for reading from atc_to_avn.fifo
-            int fdStripePipe = -1;        //for writing to avn_to_stripe.fifo
-            int fdAirPipe = -1;       //for writing to avn_to_airline.fifo
-            int fdStripToAvnPipe = -1; //for reading payment confirmations from stripe_to_avn.fifo
-            int fdNotifyAtcPipe = -1;    //for writing to avn_to_atc.fifo
+            AvnRegistry registry;           //stores avns in hash-striped shards, each locked on its own, survives a restart
+            AvnChannel atcPipe;             //for reading from atc_to_avn.fifo
+            AvnChannel stripePipe;        //for writing to avn_to_stripe.fifo
+            AvnChannel stripToAvnPipe; //for reading payment confirmations from stripe_to_avn.fifo
+            AvnChannel notifyAtcPipe;    //for writing to avn_to_atc.fifo
+            OutboundConfig outConfig;
+            OutboundQueue<AVN> stripeOut;       //records wait here while a link is full instead of being dropped
+            OutboundQueue<ViolationClearedNotification> atcOut;
+            vector<uint64_t> stripeResend;      //outstanding AVNs StripePay is sent again, fed to stripeOut as it has room
+            size_t stripeResendNext = 0;
+            AvnLedger ledger;               //per-airline totals in shared memory, the portal and StripePay read them directly
+            DueIndex dueIndex;              //unpaid AVNs by due date, drives the overdue transitions
+            double overdueEscalation;       //fraction added to fineAmount once an AVN is overdue (AIRCONTROLX_OVERDUE_ESCALATION, percent)
+            AvnHub hub;                     //airline portals subscribe here by airline instead of sharing avn_to_airline.fifo
+            uint64_t revision = 0;          //last change stored, every AVN state carries the revision that produced it
+            LoopStats stats;
+            int epollFd = -1;
+            int retryFd = -1;           //timerfd, re-flushes shm links (they have no EPOLLOUT) while they hold a backlog
+            bool outArmed[2] = {};      //EPOLLOUT currently requested for TO_STRIPE, TO_ATC
+            bool retryArmed = false;
+
+            static const int HOUSEKEEPING_SEC = 10;     //how often start() wakes up with nothing to read
+            static const int RETRY_MS = 10;
+
+            //epoll data.u64 carries the source in the high 32 bits and, for hub subscribers, the fd in the low 32
+            enum EventSource { FROM_ATC, FROM_STRIPE, HOUSEKEEPING, TO_STRIPE, TO_ATC, RETRY, HUB_LISTEN, HUB_SUBSCRIBER, OVERDUE };
+
+            bool watch(int fd, EventSource source, uint32_t events = EPOLLIN)
+                {
+                    epoll_event ev;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = events;
+                    ev.data.u64 = uint64_t(source) << 32;
+                    return fd >= 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+                }
+
+            template<typename Record>
+            bool wantWritable(AvnChannel& pipe, OutboundQueue<Record>& queue, EventSource source)      //EPOLLOUT only while there is a backlog
+                {
+                    bool backlog = queue.backlog();
+                    if(pipe.writableFd() < 0)
+                        return backlog;         //needs the retry timer
+                    if(outArmed[source - TO_STRIPE] == backlog)
+                        return false;
+                    outArmed[source - TO_STRIPE] = backlog;
+                    epoll_event ev;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = backlog ? uint32_t(EPOLLOUT) : 0u;
+                    ev.data.u64 = uint64_t(source) << 32;
+                    epoll_ctl(epollFd, EPOLL_CTL_MOD, pipe.writableFd(), &ev);
+                    return false;
+                }
+
+            void updateWriteInterest()
+                {
+                    bool retry = wantWritable(stripePipe, stripeOut, TO_STRIPE);
+                    retry = wantWritable(notifyAtcPipe, atcOut, TO_ATC) || retry;
+                    if(retry == retryArmed)
+                        return;
+                    retryArmed = retry;
+                    itimerspec t;
+                    memset(&t, 0, sizeof(t));
+                    if(retry)
+                        t.it_value.tv_nsec = RETRY_MS * 1000000L;
+                    timerfd_settime(retryFd, 0, &t, nullptr);
+                }
+
+            template<typename Record>
+            static void reportQueue(const char* pipeName, OutboundQueue<Record>& queue)
+                {
+                    OutboundStats q = queue.snapshot();
+                    if(q.enqueued == 0)
+                        return;
+                    cout << "[AVN Generator] Queue " << pipeName << ": depth " << q.depth << ", high water " << q.highWater
+                         << ", sent " << q.sent << "/" << q.enqueued << ", dropped oldest " << q.droppedOldest
+                         << ", dropped newest " << q.droppedNewest << ", producer waits " << q.blockedProducers << endl << flush;
+                }
+
+            template<typename Record>
+            static void logEnqueue(EnqueueResult r, const Record& record, const char* pipeName, OutboundQueue<Record>& queue)
+                {
+                    if(r == ENQUEUED_HIGH_WATER)
+                        cout << "[AVN Generator] WARNING: " << pipeName << " backlog passed its high-water mark (" << queue.size() << " records queued)\n";
+                    else if(r == ENQUEUED_DROPPED_OLDEST)
+                        cout << "[ERROR] " << pipeName << " queue full, dropped its oldest record to queue AVN " << record.avnID << endl;
+                    else if(r == DROPPED_NEWEST)
+                        cout << "[ERROR] " << pipeName << " queue full, dropped AVN " << record.avnID << endl;
+                }
+
+            void flushStripe()
+                {
+                    stripeOut.flush([](const AVN& avn)
+                        {
+                            cout << "[AVN Generator] Successfully forwarded AVN " << avn.avnID << " to avn_to_stripe.fifo (bytes: " << sizeof(AVN) << ")\n";
+                        });
+                    cout << flush;
+                }
+
+            void publishAirline(const vector<AVN>& avns)      //hands every AVN to the portals subscribed to its airline
+                {
+                    for(const AVN& avn : avns)
+                        {
+                            size_t portals = hub.publish(avn);
+                            cout << "[AVN Generator] Published AVN " << avn.avnID << " to " << portals << " portal(s) of " << avn.airlineName << "\n";
+                        }
+                    cout << flush;
+                }
+
+            void subscriberEvent(int fd, uint32_t events)        //a portal (re)subscribed or fell behind, replays what changed since its last revision
+                {
+                    string airline;
+                    uint64_t since = 0;
+                    if(!hub.handle(fd, events, airline, since))
+                        return;
+                    if(since > revision)
+                        {
+                            //the portal saw a history this store no longer has (avn_store was removed), it drops
+                            //its copy when the replay starts below the revision it asked for
+                            cout << "[AVN Generator] Portal of " << airline << " is at revision " << since << ", past this store's " << revision << ", replaying everything\n";
+                            since = 0;
+                        }
+                    vector<AVN> changed;
+                    registry.forEachSince(since, [&](const AVN& avn)
+                        {
+                            if(airline == avn.airlineName)
+                                changed.push_back(avn);
+                        });
+                    //oldest change first, whatever the portal has received is then everything up to some revision
+                    sort(changed.begin(), changed.end(), [](const AVN& a, const AVN& b) { return a.revision < b.revision; });
+                    size_t count = changed.size();
+                    hub.replay(fd, since, changed);
+                    cout << "[AVN Generator] Portal of " << airline << " catching up from revision " << since << ", replaying " << count << " AVN(s)\n" << flush;
+                }
+
+            void flushAtc()
+                {
+                    atcOut.flush([](const ViolationClearedNotification& n)
+                        {
+                            cout << "[AVN Generator] Notified ATC that violation " << n.avnID << " for flight " << n.flightNumber << " has been cleared\n";
+                        });
+                    cout << flush;
+                }
 
         public:
             AVNGenerator() 
+                : outConfig(outboundConfigFromEnv()),
+                  stripeOut(stripePipe, outConfig, true),
+                  atcOut(notifyAtcPipe, outConfig, true)
                 {
-                    pthread_mutex_init(&avnMutex, nullptr);
-                    cout << "[AVN Generator] Starting initialization...\n" << flush;
+                    cout << "[AVN Generator] Starting initialization (transport: " << transportToStr(selectedTransport()) << ")...\n" << flush;
 
-                    //creating new fifos for communication with other files
-                    if(mkfifo("avn_to_airline.fifo", 0666) == -1 && errno != EEXIST)
+                    //mapping the AVN store, whatever an earlier run stored is back without any replay
+                    if(!registry.open("avn_store")) 
                         {
-                            cout << "[ERROR] Failed to create avn_to_airline.fifo: " << strerror(errno) << endl << flush;
+                            cout << "[ERROR] Failed to open avn_store: " << strerror(errno) << (errno == EPROTO ? " (written by an older version, remove avn_store.*)" : "") << endl << flush;
                             exit(1);
                         }
+                    cout << "[AVN Generator] Recovered " << registry.size() << " AVN(s) from avn_store (" << registry.count() << " shards, " << registry.logRecords() << " log records)\n" << flush;
+
+                    //every unpaid AVN goes back into the due date index, including any that fell due while we were down
+                    const char* escalation = getenv("AIRCONTROLX_OVERDUE_ESCALATION");
+                    overdueEscalation = (escalation ? atof(escalation) : 10.0) / 100.0;
+                    if(!ledger.create()) 
+                        {
+                            cout << "[ERROR] Failed to create the fine ledger " << LEDGER_SEGMENT << ": " << strerror(errno) << ", continuing without it\n" << flush;
+                        }
+                    registry.forEach([&](const AVN& avn)
+                        {
+                            ledger.issued(avn);         //rebuilt from each AVN's latest state
+                            revision = max(revision, avn.revision);
+                            if(strcmp(avn.paymentStatus, "unpaid") == 0)
+                                dueIndex.add(avn);
+                        });
+                    cout << "[AVN Generator] " << dueIndex.size() << " unpaid AVN(s) awaiting their due date (overdue escalation " << overdueEscalation * 100 << "%)\n" << flush;
+
+                    //creating new fifos for communication with other files
                     if(mkfifo("avn_to_stripe.fifo", 0666) == -1 && errno != EEXIST) 
                         {
                             cout << "[ERROR] Failed to create avn_to_stripe.fifo: " << strerror(errno) << endl << flush;
@@ -176,8 +364,7 @@ class AVNGenerator          //class which generates avns and transfer their resp
                         }
 
                     //opening atc_to_avn.fifo for reading
-                    fdAtcPipe = open("atc_to_avn.fifo", O_RDONLY | O_NONBLOCK);
-                    if(fdAtcPipe < 0) 
+                    if(!atcPipe.openReader("atc_to_avn.fifo", sizeof(AVN))) 
                         {
                             cout << "[ERROR] Failed to open atc_to_avn.fifo: " << strerror(errno) << endl << flush;
                             exit(1);
@@ -187,8 +374,7 @@ class AVNGenerator          //class which generates avns and transfer their resp
                     //opening avn_to_stripe.fifo for writing
                     for(int attempt = 1; attempt <= 20; attempt++)      //ifStripe file not opened the nit will wait and retry 20 times until reader stripe.cpp opens
                         {
-                            fdStripePipe = open("avn_to_stripe.fifo", O_WRONLY | O_NONBLOCK);
-                            if(fdStripePipe < 0) {
+                            if(!stripePipe.openWriter("avn_to_stripe.fifo", sizeof(AVN))) {
                                 cout << "[AVN Generator] Attempt " << attempt << " failed to open avn_to_stripe.fifo: " << strerror(errno) << ", retrying...\n" << flush;
                                 usleep(500000);
                                 continue;
@@ -196,41 +382,19 @@ class AVNGenerator          //class which generates avns and transfer their resp
                             cout << "[AVN Generator] Successfully opened avn_to_stripe.fifo\n" << flush;
                             break;
                         }
-                    if(fdStripePipe < 0) 
+                    if(!stripePipe.isOpen()) 
                         {
                             cout << "[ERROR] Failed to open avn_to_stripe.fifo after retries: " << strerror(errno) << endl << flush;
-                            close(fdAtcPipe);
-                            exit(1);
-                        }
-
-                    //opengin avn_to_airline.fifo for writing
-                    for(int attempt = 1; attempt <= 10; attempt++) 
-                        {
-                            fdAirPipe = open("avn_to_airline.fifo", O_WRONLY | O_NONBLOCK);
-                            if(fdAirPipe < 0) {
-                                cout << "[AVN Generator] Attempt " << attempt << " failed to open avn_to_airline.fifo: " << strerror(errno) << ", retrying...\n" << flush;
-                                usleep(500000);
-                                continue;
-                            }
-                            cout << "[AVN Generator] Successfully opened avn_to_airline.fifo\n" << flush;
-                            break;
-                        }
-                    if(fdAirPipe < 0) 
-                        {
-                            cout << "[ERROR] Failed to open avn_to_airline.fifo after retries: " << strerror(errno) << endl << flush;
-                            close(fdAtcPipe);
-                            close(fdStripePipe);
+                            atcPipe.close();
                             exit(1);
                         }
 
                     //opening stripe_to_avn.fifo for reading payment confirmations
-                    fdStripToAvnPipe = open("stripe_to_avn.fifo", O_RDONLY | O_NONBLOCK);
-                    if(fdStripToAvnPipe < 0) 
+                    if(!stripToAvnPipe.openReader("stripe_to_avn.fifo", sizeof(PaymentConfirmation))) 
                         {
                             cout << "[ERROR] Failed to open stripe_to_avn.fifo: " << strerror(errno) << endl << flush;
-                            close(fdAtcPipe);
-                            close(fdStripePipe);
-                            close(fdAirPipe);
+                            atcPipe.close();
+                            stripePipe.close();
                             exit(1);
                         }
                     cout << "[AVN Generator] Successfully opened stripe_to_avn.fifo\n" << flush;
@@ -238,8 +402,7 @@ class AVNGenerator          //class which generates avns and transfer their resp
                     //opening avn_to_atc.fifo for writing
                     for(int attempt = 1; attempt <= 20; attempt++) 
                         {
-                            fdNotifyAtcPipe = open("avn_to_atc.fifo", O_WRONLY | O_NONBLOCK);
-                            if(fdNotifyAtcPipe < 0) 
+                            if(!notifyAtcPipe.openWriter("avn_to_atc.fifo", sizeof(ViolationClearedNotification))) 
                                 {
                                     cout << "[AVN Generator] Attempt " << attempt << " failed to open avn_to_atc.fifo: " << strerror(errno) << ", retrying...\n" << flush;
                                     usleep(1500000); //3/2 secind delay
@@ -248,13 +411,12 @@ class AVNGenerator          //class which generates avns and transfer their resp
                             cout << "[AVN Generator] Successfully opened avn_to_atc.fifo\n" << flush;
                             break;
                         }
-                    if(fdNotifyAtcPipe < 0) 
+                    if(!notifyAtcPipe.isOpen()) 
                         {
                             cout << "[ERROR] Failed to open avn_to_atc.fifo after retries: " << strerror(errno) << endl << flush;
-                            close(fdAtcPipe);
-                            close(fdStripePipe);
-                            close(fdAirPipe);
-                            close(fdStripToAvnPipe);
+                            atcPipe.close();
+                            stripePipe.close();
+                            stripToAvnPipe.close();
                             exit(1);
                         }
 
@@ -262,7 +424,7 @@ class AVNGenerator          //class which generates avns and transfer their resp
                     bool signalSent = false;
                     for(int attempt = 1; attempt <= 20; attempt++) 
                         {
-                            int fd_ctrl = open("avn_ctrl.fifo", O_WRONLY | O_NONBLOCK);
+                            int fd_ctrl = openLink("avn_ctrl.fifo", O_WRONLY | O_NONBLOCK);
                             if(fd_ctrl < 0) 
                                 {
                                     cout << "[AVN Generator] Attempt " << attempt << " failed to open avn_ctrl.fifo for writing: " << strerror(errno) << ", retrying...\n" << flush;
@@ -289,158 +451,428 @@ class AVNGenerator          //class which generates avns and transfer their resp
                     if(!signalSent) 
                         {
                             cout << "[ERROR] Failed to send readiness signal to ATC after 20 attempts\n" << flush;
-                            close(fdAtcPipe);
-                            close(fdStripePipe);
-                            close(fdAirPipe);
-                            close(fdStripToAvnPipe);
-                            close(fdNotifyAtcPipe);
+                            atcPipe.close();
+                            stripePipe.close();
+                            stripToAvnPipe.close();
+                            notifyAtcPipe.close();
                             exit(1);
                         }
 
                     cout << "[AVN Generator] Initialization complete.\n" << flush;
+                    reportReady("avn");
                 }
 
-            void forwardAVN(const AVN& avn, const string& pipeName, int fd) 
+            void forwardAVNs(const vector<AVN>& avns, const char* pipeName, OutboundQueue<AVN>& queue)       //queues the batch, the caller flushes
                 {
-                    char buffer[AVN::serializedSize()];
-                    int offset = 0;
-                    avn.serialize(buffer, offset);
+                    for(const AVN& avn : avns)
+                        logEnqueue(queue.enqueue(avn), avn, pipeName, queue);
+                    cout << flush;
+                }
 
-                    int bytesWritten = write(fd, buffer, sizeof(buffer));
-                    if(bytesWritten == sizeof(buffer)) 
-                        {
-                            cout << "[AVN Generator] Successfully forwarded AVN " << avn.avnID << " to " << pipeName << " (bytes: " << bytesWritten << ")\n" << flush;
-                        } 
-                    else 
+            void notifyATCViolationsCleared(const vector<AVN>& cleared)       //queues one notification per AVN cleared in this pass
+                {
+                    for(const AVN& avn : cleared)
                         {
-                            cout << "[ERROR] Failed to forward AVN " << avn.avnID << " to " << pipeName << ", bytes written: " << bytesWritten << ", expected: " << sizeof(buffer) << ", error: " << strerror(errno) << endl << flush;
+                            ViolationClearedNotification notification;
+                            wireInit(notification);
+                            notification.id = avn.id;
+                            memcpy(notification.avnID, avn.avnID, sizeof(notification.avnID));
+                            memcpy(notification.flightNumber, avn.flightNumber, sizeof(notification.flightNumber));
+                            logEnqueue(atcOut.enqueue(notification), notification, "avn_to_atc.fifo", atcOut);
                         }
+                    cout << flush;
                 }
 
-            void notifyATCViolationCleared(const string& avnID, const string& flightNumber) 
+            size_t processAVN()         //drains every AVN waiting in atc_to_avn.fifo and forwards them as one batch, returns how many
                 {
-                    ViolationClearedNotification notification;
-                    strncpy(notification.avnID, avnID.c_str(), sizeof(notification.avnID) - 1);
-                    notification.avnID[sizeof(notification.avnID) - 1] = '\0';
-                    strncpy(notification.flightNumber, flightNumber.c_str(), sizeof(notification.flightNumber) - 1);
-                    notification.flightNumber[sizeof(notification.flightNumber) - 1] = '\0';
-
-                    char buffer[ViolationClearedNotification::serializedSize()];
-                    int offset = 0;
-                    notification.serialize(buffer, offset);
-
-                    int bytesWritten = write(fdNotifyAtcPipe, buffer, sizeof(buffer));
-                    if(bytesWritten == sizeof(buffer)) 
+                    vector<AVN> batch;
+                    uint64_t now = wireNowNs();
+                    ssize_t n = atcPipe.drain([&](const char* record)
                         {
-                            cout << "[AVN Generator] Notified ATC that violation " << avnID << " for flight " << flightNumber << " has been cleared\n" << flush;
-                        } 
-                    else 
+                            const AVN* avn = wireView<AVN>(record);
+                            if(!avn)
+                                {
+                                    cout << "[ERROR] Dropping malformed record on atc_to_avn.fifo\n" << flush;
+                                    return;
+                                }
+                            stats.queued(now - avn->header.sentAtNs);
+                            batch.push_back(*avn);
+                        });
+                    if(n < 0) 
                         {
-                            cout << "[ERROR] Failed to notify ATC for AVN " << avnID << ", bytes written: " << bytesWritten << ", expected: " << sizeof(buffer) << ", error: " << strerror(errno) << endl << flush;
+                            cout << "[ERROR] Failed to read from atc_to_avn.fifo: " << strerror(errno) << endl << flush;
                         }
-                }
+                    if(batch.empty())
+                        return 0;
 
-            void processAVN() 
-                {
-                    char buffer[AVN::serializedSize()];
-                    int bytesRead = read(fdAtcPipe, buffer, sizeof(buffer));
-
-                    if(bytesRead == sizeof(buffer)) 
+                    for(AVN& avn : batch)
                         {
-                            AVN avn;
-                            int offset = 0;
-                            avn.deserialize(buffer, offset);
-
-                            pthread_mutex_lock(&avnMutex);
-                            avnRecords[avn.avnID] = avn;            //storing avn
-                            pthread_mutex_unlock(&avnMutex);
+                            avn.revision = ++revision;
+                            if(!registry.put(avn))          //storing avn
+                                {
+                                    cout << "[ERROR] Failed to store AVN " << avn.avnID << ": " << strerror(errno) << endl;
+                                    continue;
+                                }
+                            ledger.issued(avn);
+                            if(strcmp(avn.paymentStatus, "unpaid") == 0)
+                                dueIndex.add(avn);          //the loop re-arms the timer if this one is now the earliest
+                        }
 
-                            cout << "[AVN Generator] Received AVN: " << avn.avnID << ", Flight: " << avn.flightNumber << ", Airline: " << avn.airlineName << ", Fine: PKR " << avn.fineAmount << endl << flush;
+                    for(const AVN& avn : batch)
+                        cout << "[AVN Generator] Received AVN: " << avn.avnID << ", Flight: " << avn.flightNumber << ", Airline: " << avn.airlineName
+                             << ", Rule: " << violationRuleToStr(avn.rule) << " x" << avn.violationCount << ", Fine: PKR " << avn.fineAmount << endl;
+                    cout << flush;
 
-                            forwardAVN(avn, "avn_to_stripe.fifo", fdStripePipe);        //forwarding to StripePay
+                    forwardAVNs(batch, "avn_to_stripe.fifo", stripeOut);        //forwarding to StripePay
+                    flushStripe();
 
-                            forwardAVN(avn, "avn_to_airline.fifo", fdAirPipe);          //forwarfing to airlinePortal
-                        } 
-                    else if(bytesRead < 0 && errno != EAGAIN) 
-                        {
-                            cout << "[ERROR] Failed to read from atc_to_avn.fifo: " << strerror(errno) << endl << flush;
-                        }
+                    publishAirline(batch);          //forwarding to the subscribed airline portals
+                    return batch.size();
                 }
 
-            void confirmPayment()       //to check confirmation of payment
+            size_t confirmPayment()     //to check confirmation of payment, applies every confirmation waiting in the pipe, returns how many
                 {
-                    char buffer[PaymentConfirmation::serializedSize()];
-                    int bytesRead = read(fdStripToAvnPipe, buffer, sizeof(buffer));     //reading data into buffer
-
-                    if(bytesRead == sizeof(buffer)) 
+                    vector<PaymentConfirmation> confirmations;
+                    uint64_t now = wireNowNs();
+                    bool resendRequested = false;
+                    ssize_t n = stripToAvnPipe.drain([&](const char* record)     //reading data into buffer
+                        {
+                            const PaymentConfirmation* confirmation = wireView<PaymentConfirmation>(record);
+                            if(!confirmation)
+                                {
+                                    cout << "[ERROR] Dropping malformed record on stripe_to_avn.fifo\n" << flush;
+                                    return;
+                                }
+                            stats.queued(now - confirmation->header.sentAtNs);
+                            if(confirmation->forwardRequest)
+                                resendRequested = true;
+                            else
+                                confirmations.push_back(*confirmation);
+                        });
+                    if(n < 0) 
+                        {
+                            cout << "[ERROR] Failed to read from stripe_to_avn.fifo: " << strerror(errno) << endl << flush;
+                        }
+                    if(resendRequested)
+                        {
+                            cout << "[AVN Generator] StripePay asked for its outstanding AVNs again\n";
+                            resendOutstanding();
+                        }
+                    if(confirmations.empty())
+                        return 0;
+
+                    vector<AVN> paid;
+                    vector<AVN> acknowledged;   //echoed back to StripePay as paid, its journal stops replaying them
+                    size_t batchPaid = 0;       //AVNs settled by a StripePay payall, reported as one line instead of one each
+                    double batchTotal = 0;
+                    for(const PaymentConfirmation& confirmation : confirmations)
                         {
-                            PaymentConfirmation confirmation;
-                            int offset = 0;
-                            confirmation.deserialize(buffer, offset);           //converting back to class
-
                             if(confirmation.paymentSuccessful)              //if paymentDone
                                 {
-                                    pthread_mutex_lock(&avnMutex);
-                                    auto i = avnRecords.find(confirmation.avnID);
-                                    if(i != avnRecords.end()) 
+                                    AVN before, avn;
+                                    bool alreadyPaid = false;
+                                    bool updated = registry.update(confirmation.id, STORE_STATUS_CHANGED, [&](AVN& a)
                                         {
-                                            AVN& avn = i->second;
-                                            strncpy(avn.paymentStatus, "paid", sizeof(avn.paymentStatus) - 1);
-                                            avn.paymentStatus[sizeof(avn.paymentStatus) - 1] = '\0';
-
-                                            cout << "[AVN Generator] Updated payment status to 'paid' for AVN " << avn.avnID << ", Flight: " << avn.flightNumber << endl << flush;
-
-                                            forwardAVN(avn, "avn_to_airline.fifo", fdAirPipe);      //updating status in airlineportal
-
-                                            notifyATCViolationCleared(avn.avnID, avn.flightNumber); //updating status in atc
+                                            before = a;
+                                            alreadyPaid = strcmp(a.paymentStatus, "paid") == 0;
+                                            wireSetString(a.paymentStatus, "paid");
+                                            a.paidTime = time(nullptr);
+                                            if(!alreadyPaid)
+                                                a.revision = ++revision;
+                                            return !alreadyPaid;
+                                        }, avn);
+                                    if(updated) 
+                                        {
+                                            paid.push_back(avn);
+                                            ledger.paid(before, avn);
+
+                                            if(confirmation.batchSize) 
+                                                {
+                                                    batchPaid++;
+                                                    batchTotal += avn.fineAmount;
+                                                }
+                                            else
+                                                cout << "[AVN Generator] Updated payment status to 'paid' for AVN " << avn.avnID << ", Flight: " << avn.flightNumber << endl << flush;
                                         } 
+                                    else if(alreadyPaid) 
+                                        {
+                                            cout << "[AVN Generator] AVN " << confirmation.avnID << " was already paid, ignoring the repeated confirmation\n" << flush;
+                                            if(registry.find(confirmation.id, avn))
+                                                acknowledged.push_back(avn);        //StripePay replayed it, the earlier echo never reached it
+                                        }
+                                    else if(registry.find(confirmation.id, avn)) 
+                                        {
+                                            cout << "[ERROR] Failed to store payment for AVN " << confirmation.avnID << ": " << strerror(errno) << endl << flush;
+                                        }
                                     else 
                                         {
                                             cout << "[ERROR] AVN " << confirmation.avnID << " not found in records\n" << flush;
                                         }
-                                    pthread_mutex_unlock(&avnMutex);
                                 } 
                             else 
                                 {
                                 cout << "[AVN Generator] Payment failed for AVN " << confirmation.avnID << ", Flight: " << confirmation.flightNumber << endl << flush;
                                 }
-                        } 
-                    else if(bytesRead < 0 && errno != EAGAIN) 
+                        }
+                    if(batchPaid)
+                        cout << "[AVN Generator] Updated payment status to 'paid' for " << batchPaid << " AVN(s) settled in one payment, PKR " << formatMinorUnits(toMinorUnits(batchTotal)) << endl << flush;
+
+                    //no shard lock is held from here on, queueing and link I/O never extend a critical section
+                    notifyATCViolationsCleared(paid); //updating status in atc
+                    publishAirline(paid);           //updating status in the airline portals
+                    flushAtc();
+                    acknowledged.insert(acknowledged.begin(), paid.begin(), paid.end());
+                    forwardAVNs(acknowledged, "avn_to_stripe.fifo", stripeOut);     //acknowledging to StripePay's payment journal
+                    flushStripe();
+                    return confirmations.size();
+                }
+
+            //StripePay keeps what it may collect only in memory, so after either side starts it is sent every AVN
+            //still unpaid or overdue; paging through stripeResend keeps that from flooding stripeOut
+            void resendOutstanding()
+                {
+                    stripeResend.clear();
+                    stripeResendNext = 0;
+                    registry.forEach([&](const AVN& avn)
                         {
-                            cout << "[ERROR] Failed to read from stripe_to_avn.fifo: " << strerror(errno) << endl << flush;
+                            if(strcmp(avn.paymentStatus, "unpaid") == 0 || strcmp(avn.paymentStatus, "overdue") == 0)
+                                stripeResend.push_back(avn.id);
+                        });
+                    sort(stripeResend.begin(), stripeResend.end());        //oldest first
+                    cout << "[AVN Generator] Forwarding " << stripeResend.size() << " outstanding AVN(s) to StripePay\n" << flush;
+                    feedStripeResend();
+                }
+
+            void feedStripeResend()     //tops stripeOut up until the link pushes back, the next EPOLLOUT continues
+                {
+                    size_t room = stripeOut.configuration().capacity / 2;
+                    while(stripeResendNext < stripeResend.size() && !stripeOut.backlog())
+                        {
+                            vector<AVN> batch;
+                            for(; stripeResendNext < stripeResend.size() && batch.size() < room; stripeResendNext++)
+                                {
+                                    AVN avn;
+                                    if(registry.find(stripeResend[stripeResendNext], avn) &&
+                                       (strcmp(avn.paymentStatus, "unpaid") == 0 || strcmp(avn.paymentStatus, "overdue") == 0))
+                                        batch.push_back(avn);       //paid meanwhile otherwise
+                                }
+                            forwardAVNs(batch, "avn_to_stripe.fifo", stripeOut);
+                            flushStripe();
+                        }
+                    if(stripeResendNext == stripeResend.size() && !stripeResend.empty())
+                        {
+                            vector<uint64_t>().swap(stripeResend);
+                            stripeResendNext = 0;
                         }
                 }
 
-            void start() 
+            size_t sweepOverdue()       //escalates every AVN that fell due unpaid and pushes it to StripePay and its airline's portals, returns how many
                 {
-                    while(true) 
+                    vector<AVN> overdue;
+                    for(uint64_t id : dueIndex.expire())
+                        {
+                            AVN before, avn;
+                            bool escalated = registry.update(id, STORE_OVERDUE, [&](AVN& a)
+                                {
+                                    before = a;
+                                    if(strcmp(a.paymentStatus, "unpaid") != 0)
+                                        return false;       //paid since it was scheduled
+                                    a.fineAmount *= 1 + overdueEscalation;
+                                    wireSetString(a.paymentStatus, "overdue");
+                                    a.revision = ++revision;
+                                    return true;
+                                }, avn);
+                            if(escalated)
+                                {
+                                    overdue.push_back(avn);
+                                    ledger.overdue(before, avn);
+                                    cout << "[AVN Generator] AVN " << avn.avnID << " for flight " << avn.flightNumber << " is overdue, fine escalated to PKR " << avn.fineAmount << endl;
+                                }
+                        }
+                    if(!overdue.empty())
                         {
-                            processAVN();           //function to checkFor coming avns from atc
+                            forwardAVNs(overdue, "avn_to_stripe.fifo", stripeOut);       //StripePay replaces its pending copy, so the escalated fine is what gets paid
+                            flushStripe();
+                        }
+                    publishAirline(overdue);
+                    return overdue.size();
+                }
 
-                            confirmPayment();       //function to confirm isPayment confirmed from StripePay
+            void housekeeping()         //runs on the timer, nothing here may block
+                {
+                    stats.report();
+                    registry.sync();        //starts write-back, a crash of this process alone loses nothing anyway
+                    reportQueue("avn_to_stripe.fifo", stripeOut);
+                    reportQueue("avn_to_atc.fifo", atcOut);
+                    if(dueIndex.size())
+                        cout << "[AVN Generator] Due date index: " << dueIndex.size() << " AVN(s) pending\n" << flush;
+                    HubStats h = hub.snapshot();
+                    if(h.published)
+                        cout << "[AVN Generator] Hub: " << h.subscribers << " subscriber(s) (peak " << h.peakSubscribers << "), published "
+                             << h.published << ", delivered " << h.delivered << ", queued " << h.queued << ", dropped " << h.dropped << " (resent from the store, " << h.resyncs << " resync(s))" << endl << flush;
+                }
 
-                            usleep(100000);         //blocking for 100ms
+            void start()                //sleeps in epoll until atc or stripe has data, instead of polling every 100ms
+                {
+                    epollFd = epoll_create1(EPOLL_CLOEXEC);
+                    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                    retryFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                    if(epollFd < 0 || timerFd < 0 || retryFd < 0 || !dueIndex.open()) 
+                        {
+                            cout << "[ERROR] Failed to create event loop: " << strerror(errno) << endl << flush;
+                            exit(1);
+                        }
+                    itimerspec tick;
+                    memset(&tick, 0, sizeof(tick));
+                    tick.it_value.tv_sec = HOUSEKEEPING_SEC;
+                    tick.it_interval.tv_sec = HOUSEKEEPING_SEC;
+                    timerfd_settime(timerFd, 0, &tick, nullptr);
+
+                    if(!watch(atcPipe.pollFd(), FROM_ATC) || !watch(stripToAvnPipe.pollFd(), FROM_STRIPE) ||
+                       !watch(timerFd, HOUSEKEEPING) || !watch(retryFd, RETRY) || !watch(dueIndex.fd(), OVERDUE)) 
+                        {
+                            cout << "[ERROR] Failed to register with epoll: " << strerror(errno) << endl << flush;
+                            exit(1);
                         }
+                    if(!hub.open(epollFd, HUB_LISTEN, HUB_SUBSCRIBER)) 
+                        {
+                            cout << "[ERROR] Failed to listen on " << AVN_HUB_SOCKET << ": " << strerror(errno) << endl << flush;
+                            exit(1);
+                        }
+                    //write side is registered with no events, updateWriteInterest() asks for EPOLLOUT only while backed up
+                    if(stripePipe.writableFd() >= 0)
+                        watch(stripePipe.writableFd(), TO_STRIPE, 0);
+                    if(notifyAtcPipe.writableFd() >= 0)
+                        watch(notifyAtcPipe.writableFd(), TO_ATC, 0);
+                    resendOutstanding();         //whatever stripeOut held died with the previous run
+                    updateWriteInterest();
+                    cout << "[AVN Generator] Waiting for events (backpressure: " << backpressureToStr(outConfig.policy)
+                         << ", queue " << outConfig.capacity << " records)\n" << flush;
+
+                    epoll_event events[64];         //hundreds of portals can be ready at once
+                    while(true) 
+                        {
+                            int ready = epoll_wait(epollFd, events, 64, -1);
+                            if(ready < 0) 
+                                {
+                                    if(errno == EINTR)
+                                        continue;
+                                    cout << "[ERROR] epoll_wait failed: " << strerror(errno) << endl << flush;
+                                    break;
+                                }
+                            uint64_t woke = wireNowNs();
+                            stats.wakeup();
+                            for(int i = 0; i < ready; i++) 
+                                {
+                                    switch(AvnHub::eventTag(events[i].data.u64)) 
+                                        {
+                                            case FROM_ATC:
+                                                {
+                                                    size_t n = processAVN();           //avns coming from atc
+                                                    stats.batch(n, wireNowNs() - woke);
+                                                    break;
+                                                }
+                                            case FROM_STRIPE:
+                                                {
+                                                    size_t n = confirmPayment();       //payment confirmations from StripePay
+                                                    stats.batch(n, wireNowNs() - woke);
+                                                    break;
+                                                }
+                                            case HOUSEKEEPING:
+                                                {
+                                                    uint64_t expirations;
+                                                    if(read(timerFd, &expirations, sizeof(expirations)) > 0)
+                                                        housekeeping();
+                                                    break;
+                                                }
+                                            case TO_STRIPE:
+                                                flushStripe();
+                                                feedStripeResend();
+                                                break;
+                                            case TO_ATC:
+                                                flushAtc();
+                                                break;
+                                            case RETRY:
+                                                {
+                                                    uint64_t expirations;
+                                                    retryArmed = false;     //one-shot, updateWriteInterest() re-arms it
+                                                    if(read(retryFd, &expirations, sizeof(expirations)) > 0)
+                                                        {
+                                                            flushStripe();
+                                                            feedStripeResend();
+                                                            flushAtc();
+                                                        }
+                                                    break;
+                                                }
+                                            case OVERDUE:
+                                                {
+                                                    size_t n = sweepOverdue();
+                                                    stats.batch(n, wireNowNs() - woke);
+                                                    break;
+                                                }
+                                            case HUB_LISTEN:
+                                                hub.acceptAll();
+                                                break;
+                                            case HUB_SUBSCRIBER:
+                                                subscriberEvent(AvnHub::eventFd(events[i].data.u64), events[i].events);
+                                                break;
+                                        }
+                                }
+                            updateWriteInterest();
+                            dueIndex.arm();
+                        }
+                    hub.close();
+                    dueIndex.close();
+                    ledger.close();
+                    close(retryFd);
+                    close(timerFd);
+                    close(epollFd);
                 }
 
             ~AVNGenerator() 
                 {
-                    if(fdAtcPipe >= 0) 
-                        close(fdAtcPipe);
-                    if(fdStripePipe >= 0) 
-                        close(fdStripePipe);
-                    if(fdAirPipe >= 0) 
-                        close(fdAirPipe);
-                    if(fdStripToAvnPipe >= 0) 
-                        close(fdStripToAvnPipe);
-                    if(fdNotifyAtcPipe >= 0) 
-                        close(fdNotifyAtcPipe);
-                    pthread_mutex_destroy(&avnMutex);
+                    atcPipe.close();
+                    stripePipe.close();
+                    stripToAvnPipe.close();
+                    notifyAtcPipe.close();
+                    registry.close();
                 }
     };
 
-int main() 
+//--export <file>: writes the latest state of every stored AVN to file (columnar, or CSV for a .csv name) and exits;
+//reads the store files read-only, so it can run next to a live generator
+static int exportStore(const string& path)
+    {
+        AvnExporter exporter;
+        if(!exporter.open(path, exportFormatFor(path))) 
+            {
+                cout << "[ERROR] Failed to create " << path << ": " << strerror(errno) << endl << flush;
+                return 1;
+            }
+        bool ok = AvnRegistry::scan("avn_store", [&](const AVN& avn)
+            {
+                exporter.add(avn);
+            });
+        if(!ok) 
+            {
+                cout << "[ERROR] Failed to read avn_store: " << strerror(errno) << endl << flush;
+                exporter.close();
+                return 1;
+            }
+        uint64_t rows = exporter.rows();
+        if(!exporter.close()) 
+            {
+                cout << "[ERROR] Failed to write " << path << ": " << strerror(errno) << endl << flush;
+                return 1;
+            }
+        cout << "[AVN Generator] Exported " << rows << " AVN(s) to " << path << (exportFormatFor(path) == EXPORT_CSV ? " (CSV)" : " (columnar)") << endl << flush;
+        return 0;
+    }
+
+int main(int argc, char* argv[]) 
     {
+        if(argc == 3 && strcmp(argv[1], "--export") == 0)
+            return exportStore(argv[2]);
         cout << "===== AVN Generator Starting =====\n" << flush;
         AVNGenerator avnGen;
         avnGen.start();
@@ -0,0 +1,385 @@
+#ifndef AVN_CHANNEL_H
+#define AVN_CHANNEL_H
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <climits>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "shm_ring.h"
+#include "avn_wire.h"
+
+//one directed link between two processes (atc_to_avn, avn_to_stripe, ...)
+//AIRCONTROLX_TRANSPORT=shm carries it over a shared memory ring, anything else keeps the named FIFO
+//both transports behave like a non-blocking pipe of whole records: -1/EAGAIN when empty or full
+
+enum TransportKind { TRANSPORT_FIFO, TRANSPORT_SHM };
+
+inline TransportKind selectedTransport()
+    {
+        const char* t = getenv("AIRCONTROLX_TRANSPORT");
+        return (t && strcmp(t, "shm") == 0) ? TRANSPORT_SHM : TRANSPORT_FIFO;
+    }
+
+inline const char* transportToStr(TransportKind k)
+    {
+        return k == TRANSPORT_SHM ? "shared memory" : "FIFO";
+    }
+
+//under the supervisor every link already exists and is held open, its fds are inherited through
+//AIRCONTROLX_FDS="atc_to_avn.fifo=5,avn_to_atc.fifo=6,..." so nothing has to wait for the peer to show up
+inline int inheritedLinkFd(const char* name)
+    {
+        const char* list = getenv("AIRCONTROLX_FDS");
+        size_t len = strlen(name);
+        while(list && *list)
+            {
+                if(strncmp(list, name, len) == 0 && list[len] == '=')
+                    return atoi(list + len + 1);
+                list = strchr(list, ',');
+                if(list)
+                    list++;
+            }
+        return -1;
+    }
+
+//opens a named FIFO, or a private dup of the inherited fd for it
+inline int openLink(const char* name, int flags)
+    {
+        int inherited = inheritedLinkFd(name);
+        if(inherited < 0)
+            return open(name, flags);
+        int fd = fcntl(inherited, F_DUPFD_CLOEXEC, 0);
+        if(fd >= 0 && (flags & O_NONBLOCK))
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return fd;
+    }
+
+//tells the supervisor (if any) that this component finished starting up
+inline void reportReady(const char* component)
+    {
+        const char* readyFd = getenv("AIRCONTROLX_READY_FD");
+        if(!readyFd)
+            return;
+        std::string line = std::string(component) + "\n";
+        if(write(atoi(readyFd), line.data(), line.size()) < 0)
+            return;     //supervisor went away, nothing to report to
+    }
+
+static const uint32_t SHM_RING_RECORDS = 4096;     //per link, comparable to a pipe buffer of AVNs
+static const size_t CHANNEL_RX_BYTES = 64 * 1024;   //one drain() pulls up to a full pipe buffer per read
+
+class AvnChannel
+    {
+        private:
+            TransportKind kind = TRANSPORT_FIFO;
+            int fd = -1;
+            ShmRing ring;
+            size_t recordSize = 0;
+            std::vector<char> rxBuf;        //drain() buffer, a partial record stays at the front between calls
+            size_t rxHave = 0;
+            int keepAliveFd = -1;           //our own writer end so a FIFO reader never sees EOF/POLLHUP
+            int wakeFd = -1;                //eventfd a shm reader exposes to epoll, fed by the doorbell thread
+            pthread_t doorbell;
+            volatile bool doorbellRunning = false;
+
+            static void* doorbellThread(void* arg)      //turns futex wakeups on the ring into eventfd events
+                {
+                    AvnChannel* ch = static_cast<AvnChannel*>(arg);
+                    uint32_t seen = ch->ring.tailIndex();
+                    uint64_t one = 1;
+                    if(!ch->ring.empty() && write(ch->wakeFd, &one, sizeof(one)) < 0)
+                        return nullptr;
+                    while(ch->doorbellRunning)
+                        {
+                            uint32_t tail = ch->ring.waitTailChange(seen, 200);
+                            if(tail != seen)
+                                {
+                                    seen = tail;
+                                    if(write(ch->wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                                        break;
+                                }
+                        }
+                    return nullptr;
+                }
+
+            //the unwritten tail of a record a non-blocking writev() cut in half; it has to go out before anything else
+            //so the stream stays record aligned, and it is retried on every send instead of blocking here
+            std::vector<char> txRest;
+
+            bool writeRest()
+                {
+                    while(!txRest.empty())
+                        {
+                            ssize_t n = write(fd, txRest.data(), txRest.size());
+                            if(n <= 0)
+                                return false;       //errno says whether it is just EAGAIN
+                            txRest.erase(txRest.begin(), txRest.begin() + n);
+                        }
+                    return true;
+                }
+
+            bool openAs(const char* name, size_t recSize, int flags)
+                {
+                    close();
+                    kind = selectedTransport();
+                    recordSize = recSize;
+                    rxBuf.assign((CHANNEL_RX_BYTES / recSize) * recSize, 0);
+                    rxHave = 0;
+                    txRest.clear();
+                    if(kind == TRANSPORT_SHM)
+                        return ring.open(name, recSize, SHM_RING_RECORDS);
+                    fd = openLink(name, flags | O_NONBLOCK);
+                    if(fd >= 0 && flags == O_RDONLY && inheritedLinkFd(name) < 0)     //an inherited link is held open by the supervisor
+                        keepAliveFd = open(name, O_WRONLY | O_NONBLOCK);
+                    return fd >= 0;
+                }
+
+        public:
+            bool openReader(const char* name, size_t recSize)
+                {
+                    return openAs(name, recSize, O_RDONLY);
+                }
+
+            bool openWriter(const char* name, size_t recSize)
+                {
+                    return openAs(name, recSize, O_WRONLY);
+                }
+
+            bool isOpen() const
+                {
+                    return kind == TRANSPORT_SHM ? ring.isOpen() : fd >= 0;
+                }
+
+            TransportKind transport() const
+                {
+                    return kind;
+                }
+
+            //len must be a whole number of records, returns bytes accepted like write()
+            ssize_t send(const void* buf, size_t len)
+                {
+                    if(kind == TRANSPORT_FIFO)
+                        return writeRest() ? write(fd, buf, len) : -1;
+                    size_t n = 0;
+                    const char* p = static_cast<const char*>(buf);
+                    while(n + recordSize <= len && ring.push(p + n))
+                        n += recordSize;
+                    if(n == 0 && len > 0)
+                        {
+                            errno = EAGAIN;
+                            return -1;
+                        }
+                    return n;
+                }
+
+            //returns bytes received like read(), a shm ring only ever hands out whole records
+            ssize_t receive(void* buf, size_t cap)
+                {
+                    if(kind == TRANSPORT_FIFO)
+                        return read(fd, buf, cap);
+                    size_t n = ring.popMany(buf, cap / recordSize);
+                    if(n == 0)
+                        {
+                            errno = EAGAIN;
+                            return -1;
+                        }
+                    return n * recordSize;
+                }
+
+            //writes iov[0..count) (one record each) with a single writev(), returns how many records went out
+            //a record the kernel only took half of counts as sent, its tail is finished by the next send or flushPending()
+            ssize_t sendv(const iovec* iov, int count)
+                {
+                    if(count <= 0)
+                        return 0;
+                    if(kind == TRANSPORT_SHM)
+                        {
+                            int n = 0;
+                            while(n < count && ring.push(iov[n].iov_base))
+                                n++;
+                            if(n == 0)
+                                {
+                                    errno = EAGAIN;
+                                    return -1;
+                                }
+                            return n;
+                        }
+                    if(!writeRest())
+                        return -1;
+                    ssize_t written = 0;
+                    int done = 0;
+                    while(done < count)
+                        {
+                            int batch = count - done < IOV_MAX ? count - done : IOV_MAX;
+                            ssize_t n = writev(fd, iov + done, batch);
+                            if(n < 0)
+                                return done ? done : -1;
+                            written = n;
+                            int whole = 0;
+                            while(whole < batch && written >= ssize_t(iov[done + whole].iov_len))
+                                written -= iov[done + whole++].iov_len;
+                            done += whole;
+                            if(whole < batch)
+                                {
+                                    if(written > 0)
+                                        {
+                                            const char* cut = static_cast<const char*>(iov[done].iov_base);
+                                            txRest.assign(cut + written, cut + iov[done].iov_len);
+                                            writeRest();        //whatever is left goes out ahead of the next send
+                                            done++;
+                                        }
+                                    break;
+                                }
+                        }
+                    return done;
+                }
+
+            //stamps and sends wire records straight out of the caller's vector from first on, one iovec per record
+            template<typename Record>
+            ssize_t sendRecords(std::vector<Record>& records, size_t first = 0)
+                {
+                    std::vector<iovec> iov(records.size() - first);
+                    for(size_t i = 0; i < iov.size(); i++)
+                        {
+                            wireStamp(records[first + i]);
+                            iov[i].iov_base = &records[first + i];
+                            iov[i].iov_len = sizeof(Record);
+                        }
+                    return sendv(iov.data(), iov.size());
+                }
+
+            //fd that becomes readable when receive() has data, for epoll/poll loops
+            //a FIFO hands out its own fd, a shm ring starts a doorbell thread feeding an eventfd
+            int pollFd()
+                {
+                    if(kind == TRANSPORT_FIFO)
+                        return fd;
+                    if(wakeFd < 0)
+                        {
+                            wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                            if(wakeFd < 0)
+                                return -1;
+                            doorbellRunning = true;
+                            if(pthread_create(&doorbell, nullptr, doorbellThread, this) != 0)
+                                {
+                                    doorbellRunning = false;
+                                    ::close(wakeFd);
+                                    wakeFd = -1;
+                                }
+                        }
+                    return wakeFd;
+                }
+
+            //reads everything available right now and calls onRecord(const char* record) for each complete one
+            //returns the number of records handed out, or -1 on a read error (errno is kept)
+            template<typename OnRecord>
+            ssize_t drain(OnRecord onRecord)
+                {
+                    ssize_t records = 0;
+                    if(wakeFd >= 0)
+                        {
+                            uint64_t events;
+                            if(read(wakeFd, &events, sizeof(events)) < 0 && errno != EAGAIN)
+                                return -1;      //reset before draining so a push after this point re-arms it
+                        }
+                    while(true)
+                        {
+                            ssize_t n = receive(rxBuf.data() + rxHave, rxBuf.size() - rxHave);
+                            if(n <= 0)
+                                {
+                                    if(n < 0 && errno != EAGAIN)
+                                        return -1;
+                                    return records;
+                                }
+                            rxHave += n;
+                            size_t off = 0;
+                            for(; off + recordSize <= rxHave; off += recordSize, records++)
+                                onRecord(rxBuf.data() + off);
+                            rxHave -= off;
+                            if(rxHave)
+                                memmove(rxBuf.data(), rxBuf.data() + off, rxHave);
+                        }
+                }
+
+            //blocks until a receive() would return data or timeoutMs passes (-1 waits forever)
+            bool waitReadable(int timeoutMs)
+                {
+                    if(kind == TRANSPORT_SHM)
+                        return ring.waitReadable(timeoutMs);
+                    pollfd p = { fd, POLLIN, 0 };
+                    return poll(&p, 1, timeoutMs) > 0 && (p.revents & POLLIN);
+                }
+
+            //true while the tail of a cut record is still waiting to be written
+            bool txPending() const
+                {
+                    return !txRest.empty();
+                }
+
+            bool flushPending()
+                {
+                    return writeRest();
+                }
+
+            //fd that reports EPOLLOUT once a full link drains, -1 for a shm ring (its producer has no wakeup, retry on a timer)
+            int writableFd() const
+                {
+                    return kind == TRANSPORT_FIFO ? fd : -1;
+                }
+
+            //blocks until a send() could make progress or timeoutMs passes
+            bool waitWritable(int timeoutMs)
+                {
+                    if(kind == TRANSPORT_SHM)
+                        {
+                            for(int waited = 0; ring.full(); waited++)
+                                {
+                                    if(waited >= timeoutMs)
+                                        return false;
+                                    usleep(1000);
+                                }
+                            return true;
+                        }
+                    pollfd p = { fd, POLLOUT, 0 };
+                    return poll(&p, 1, timeoutMs) > 0 && (p.revents & POLLOUT);
+                }
+
+            void close()
+                {
+                    if(doorbellRunning)
+                        {
+                            doorbellRunning = false;
+                            pthread_join(doorbell, nullptr);
+                        }
+                    if(wakeFd >= 0)
+                        ::close(wakeFd);
+                    wakeFd = -1;
+                    if(keepAliveFd >= 0)
+                        ::close(keepAliveFd);
+                    keepAliveFd = -1;
+                    if(fd >= 0)
+                        ::close(fd);
+                    fd = -1;
+                    ring.close();
+                }
+
+            AvnChannel() = default;
+            AvnChannel(const AvnChannel&) = delete;
+            AvnChannel& operator=(const AvnChannel&) = delete;
+
+            ~AvnChannel()
+                {
+                    close();
+                }
+    };
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef AVN_COALESCE_H
+#define AVN_COALESCE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <pthread.h>
+
+#include "avn_wire.h"
+
+//holds each AVN for AIRCONTROLX_COALESCE_MS after its first violation and folds every later violation of the same
+//rule, in the same phase, by the same aircraft into it: one AVN leaves with the summed count and fine and the worst
+//excess instead of a burst of near-identical ones through every pipe, store and portal
+//a window of 0 turns coalescing off and every AVN is released as soon as it is added
+
+static const int COALESCE_DEFAULT_MS = 5000;
+
+inline int coalesceWindowMsFromEnv()
+    {
+        const char* window = getenv("AIRCONTROLX_COALESCE_MS");
+        return window && atoi(window) >= 0 ? atoi(window) : COALESCE_DEFAULT_MS;
+    }
+
+struct CoalesceStats
+    {
+        uint64_t violations = 0;        //AVNs handed to add(), counting each one's own violationCount
+        uint64_t released = 0;          //AVNs that left through takeExpired()
+        size_t pending = 0;
+    };
+
+class ViolationCoalescer
+    {
+        private:
+            typedef std::tuple<std::string, uint16_t, uint16_t> Key;      //flight, rule, phase
+
+            struct Pending
+                {
+                    AVN avn;
+                    uint64_t releaseAtNs;
+                };
+
+            std::map<Key, Pending> pending;
+            pthread_mutex_t mutex;
+            uint64_t windowNs;
+            CoalesceStats stats;
+
+        public:
+            explicit ViolationCoalescer(int windowMs)
+                : windowNs(uint64_t(windowMs > 0 ? windowMs : 0) * 1000000ull)
+                {
+                    pthread_mutex_init(&mutex, nullptr);
+                }
+
+            ViolationCoalescer(const ViolationCoalescer&) = delete;
+            ViolationCoalescer& operator=(const ViolationCoalescer&) = delete;
+
+            //the first AVN of a key keeps its id, issuance and due date, later ones only add to it
+            void add(const AVN& avn)
+                {
+                    Key key(avn.flightNumber, avn.rule, avn.phase);
+                    pthread_mutex_lock(&mutex);
+                    stats.violations += avn.violationCount;
+                    auto it = pending.find(key);
+                    if(it == pending.end())
+                        pending.emplace(key, Pending{ avn, wireNowNs() + windowNs });
+                    else
+                        {
+                            AVN& merged = it->second.avn;
+                            merged.violationCount += avn.violationCount;
+                            merged.fineAmount += avn.fineAmount;
+                            if(avn.maxExcess > merged.maxExcess)
+                                {
+                                    merged.maxExcess = avn.maxExcess;
+                                    merged.speedRecorded = avn.speedRecorded;
+                                }
+                        }
+                    pthread_mutex_unlock(&mutex);
+                }
+
+            //moves every AVN whose window has closed (or all of them, at shutdown) into out, oldest first
+            size_t takeExpired(std::vector<AVN>& out, bool all = false)
+                {
+                    uint64_t now = wireNowNs();
+                    size_t before = out.size();
+                    pthread_mutex_lock(&mutex);
+                    for(auto it = pending.begin(); it != pending.end(); )
+                        {
+                            if(all || it->second.releaseAtNs <= now)
+                                {
+                                    out.push_back(it->second.avn);
+                                    it = pending.erase(it);
+                                }
+                            else
+                                ++it;
+                        }
+                    stats.released += out.size() - before;
+                    pthread_mutex_unlock(&mutex);
+                    std::sort(out.begin() + before, out.end(), [](const AVN& a, const AVN& b) { return a.id < b.id; });
+                    return out.size() - before;
+                }
+
+            CoalesceStats snapshot()
+                {
+                    pthread_mutex_lock(&mutex);
+                    CoalesceStats s = stats;
+                    s.pending = pending.size();
+                    pthread_mutex_unlock(&mutex);
+                    return s;
+                }
+
+            ~ViolationCoalescer()
+                {
+                    pthread_mutex_destroy(&mutex);
+                }
+    };
+
+#endif
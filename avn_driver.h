@@ -0,0 +1,138 @@
+#ifndef AVN_DRIVER_H
+#define AVN_DRIVER_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <signal.h>
+
+//non-interactive driver mode for StripePay and the airline portal, for end-to-end load tests without a terminal
+//AIRCONTROLX_DRIVER names a config file of "key = value" lines ('#' starts a comment):
+//  login = <airline>:<password>    repeatable; StripePay pays every listed airline, the portal logs in as the first
+//  pay_after_ms = N                StripePay pays an AVN N ms after receiving it, 0 pays at once (default 0)
+//  fail_percent = X                share of payment attempts that fail, 0 to 100 (default 0)
+//  retry_ms = N                    a failed AVN is attempted again N ms later (default 1000)
+//  timings = <file.csv>            StripePay writes one row per AVN the generator acknowledged (default none)
+//  seed = N                        for the fail_percent draw (default the start time)
+//the driven process runs until SIGINT or SIGTERM, which the supervisor sends on shutdown
+
+struct DriverLogin
+    {
+        std::string airline;
+        std::string password;
+    };
+
+struct DriverConfig
+    {
+        std::vector<DriverLogin> logins;
+        int payAfterMs = 0;
+        int failPercent = 0;
+        int retryMs = 1000;
+        std::string timingsPath;
+        unsigned seed = 0;
+    };
+
+inline std::string driverTrim(const std::string& s)
+    {
+        size_t b = s.find_first_not_of(" \t\r\n");
+        size_t e = s.find_last_not_of(" \t\r\n");
+        return b == std::string::npos ? "" : s.substr(b, e - b + 1);
+    }
+
+//false with error set if the file cannot be read or a line is not understood
+inline bool loadDriverConfig(const std::string& path, DriverConfig& config, std::string& error)
+    {
+        FILE* f = fopen(path.c_str(), "r");
+        if(!f)
+            {
+                error = path + ": " + strerror(errno);
+                return false;
+            }
+        config = DriverConfig();
+        config.seed = unsigned(time(nullptr));
+        char buffer[512];
+        int lineNo = 0;
+        bool ok = true;
+        while(ok && fgets(buffer, sizeof(buffer), f))
+            {
+                lineNo++;
+                std::string line = buffer;
+                line = driverTrim(line.substr(0, line.find('#')));
+                if(line.empty())
+                    continue;
+                size_t eq = line.find('=');
+                std::string key = driverTrim(line.substr(0, eq));
+                std::string value = eq == std::string::npos ? "" : driverTrim(line.substr(eq + 1));
+                size_t colon = value.rfind(':');
+                if(eq == std::string::npos)
+                    ok = false;
+                else if(key == "login" && colon != std::string::npos && colon > 0)
+                    config.logins.push_back({ driverTrim(value.substr(0, colon)), driverTrim(value.substr(colon + 1)) });
+                else if(key == "pay_after_ms")
+                    config.payAfterMs = atoi(value.c_str());
+                else if(key == "fail_percent")
+                    config.failPercent = atoi(value.c_str());
+                else if(key == "retry_ms")
+                    config.retryMs = atoi(value.c_str());
+                else if(key == "timings")
+                    config.timingsPath = value;
+                else if(key == "seed")
+                    config.seed = unsigned(strtoul(value.c_str(), nullptr, 10));
+                else
+                    ok = false;
+                if(!ok)
+                    error = path + ":" + std::to_string(lineNo) + ": cannot parse \"" + line + "\"";
+            }
+        fclose(f);
+        if(ok && config.logins.empty())
+            {
+                error = path + ": no login = <airline>:<password> line";
+                ok = false;
+            }
+        if(ok && (config.payAfterMs < 0 || config.retryMs < 0 || config.failPercent < 0 || config.failPercent > 100))
+            {
+                error = path + ": pay_after_ms and retry_ms must be >= 0, fail_percent 0 to 100";
+                ok = false;
+            }
+        return ok;
+    }
+
+inline const char* driverConfigPath()
+    {
+        const char* path = getenv("AIRCONTROLX_DRIVER");
+        return path && *path ? path : nullptr;
+    }
+
+//call before any thread starts, so SIGINT / SIGTERM stay pending for shutdownRequested() / waitForShutdown()
+inline void blockShutdownSignals()
+    {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    }
+
+inline bool shutdownRequested()
+    {
+        sigset_t pending;
+        sigpending(&pending);
+        return sigismember(&pending, SIGINT) || sigismember(&pending, SIGTERM);
+    }
+
+inline void waitForShutdown()
+    {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGTERM);
+        int sig;
+        sigwait(&set, &sig);
+    }
+
+#endif
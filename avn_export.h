@@ -0,0 +1,307 @@
+#ifndef AVN_EXPORT_H
+#define AVN_EXPORT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "avn_ledger.h"
+#include "avn_wire.h"
+
+//streams AVNs into a file for offline analysis, either columnar binary (the default) or CSV
+//
+//columnar layout, all integers little-endian as written by this machine:
+//  ExportFileHeader, then EXPORT_COLUMNS ExportColumn descriptors
+//  row groups of up to EXPORT_ROW_GROUP AVNs: ExportRowGroupHeader, then each column's values back to back in
+//  descriptor order (rows * width bytes per column)
+//  footer: the airline and flight dictionaries (uint32 count, then per entry uint16 length + bytes; a row's
+//  airline / flight column holds the entry's position), uint32 row group count + uint64 offset of each group
+//  ExportTrailer, the last bytes of the file, pointing back at the footer
+//only one row group's columns and the two dictionaries are ever in memory, whatever the number of AVNs
+
+static const uint32_t EXPORT_MAGIC = 0x58564e41;       //"ANVX"
+static const uint32_t EXPORT_VERSION = 1;
+static const uint32_t EXPORT_ROW_GROUP = 65536;         //rows
+
+enum ExportFormat { EXPORT_COLUMNAR, EXPORT_CSV };
+
+enum ExportStatus : uint8_t { EXPORT_UNPAID = 0, EXPORT_OVERDUE = 1, EXPORT_PAID = 2, EXPORT_OTHER = 3 };
+
+struct ExportFileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t columns;
+        uint32_t rowGroupRows;      //most rows in one group
+    };
+
+struct ExportColumn
+    {
+        char name[20];
+        char type;                  //'u' unsigned, 'i' signed, 'f' float, 'd' dictionary code
+        uint8_t width;              //bytes per value
+        uint8_t reserved[2];
+    };
+
+struct ExportRowGroupHeader
+    {
+        uint32_t rows;
+        uint32_t reserved;
+    };
+
+struct ExportTrailer
+    {
+        uint64_t footerOffset;
+        uint64_t rows;
+        uint32_t magic;
+        uint32_t reserved;
+    };
+
+static_assert(sizeof(ExportColumn) == 24 && sizeof(ExportTrailer) == 24, "export layout changed, bump EXPORT_VERSION");
+
+inline ExportStatus exportStatusOf(const char* status)
+    {
+        return strcmp(status, "unpaid") == 0 ? EXPORT_UNPAID : strcmp(status, "overdue") == 0 ? EXPORT_OVERDUE :
+               strcmp(status, "paid") == 0 ? EXPORT_PAID : EXPORT_OTHER;
+    }
+
+//"x.csv" exports CSV, anything else columnar
+inline ExportFormat exportFormatFor(const std::string& path)
+    {
+        return path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0 ? EXPORT_CSV : EXPORT_COLUMNAR;
+    }
+
+class AvnExporter
+    {
+        private:
+            //one buffered column, values appended as raw bytes
+            struct Column
+                {
+                    ExportColumn desc;
+                    std::vector<char> data;
+
+                    template<typename T>
+                    void push(T value)
+                        {
+                            const char* p = reinterpret_cast<const char*>(&value);
+                            data.insert(data.end(), p, p + sizeof(T));
+                        }
+                };
+
+            struct Dictionary
+                {
+                    std::unordered_map<std::string, uint32_t> codes;
+                    std::vector<std::string> values;
+
+                    uint32_t code(const char* value)
+                        {
+                            auto it = codes.find(value);
+                            if(it != codes.end())
+                                return it->second;
+                            uint32_t c = values.size();
+                            codes.emplace(value, c);
+                            values.push_back(value);
+                            return c;
+                        }
+                };
+
+            enum ColumnId { C_ID, C_AIRLINE, C_FLIGHT, C_TYPE, C_STATUS, C_RULE, C_PHASE, C_VIOLATIONS, C_SPEED, C_PERMISSIBLE,
+                            C_MAX_EXCESS, C_FINE, C_ISSUED, C_DUE, C_PAID, EXPORT_COLUMNS };
+
+            FILE* file = nullptr;
+            ExportFormat format = EXPORT_COLUMNAR;
+            Column columns[EXPORT_COLUMNS];
+            Dictionary airlines, flights;
+            std::vector<uint64_t> groupOffsets;
+            uint32_t groupRows = 0;
+            uint64_t total = 0;
+            bool failed = false;
+
+            void describe(ColumnId id, const char* name, char type, uint8_t width)
+                {
+                    Column& c = columns[id];
+                    memset(&c.desc, 0, sizeof(c.desc));
+                    strncpy(c.desc.name, name, sizeof(c.desc.name) - 1);
+                    c.desc.type = type;
+                    c.desc.width = width;
+                    c.data.clear();
+                    c.data.reserve(size_t(EXPORT_ROW_GROUP) * width);
+                }
+
+            void put(const void* p, size_t n)
+                {
+                    if(!failed && fwrite(p, 1, n, file) != n)
+                        failed = true;
+                }
+
+            void flushGroup()
+                {
+                    if(!groupRows)
+                        return;
+                    groupOffsets.push_back(ftello(file));
+                    ExportRowGroupHeader h = { groupRows, 0 };
+                    put(&h, sizeof(h));
+                    for(Column& c : columns)
+                        {
+                            put(c.data.data(), c.data.size());
+                            c.data.clear();
+                        }
+                    groupRows = 0;
+                }
+
+            void putDictionary(const Dictionary& d)
+                {
+                    uint32_t count = d.values.size();
+                    put(&count, sizeof(count));
+                    for(const std::string& v : d.values)
+                        {
+                            uint16_t len = v.size();
+                            put(&len, sizeof(len));
+                            put(v.data(), len);
+                        }
+                }
+
+            //CSV fields are plain identifiers, a quote or comma only appears if someone typed one into a name
+            void putCsvString(const char* value)
+                {
+                    if(!strpbrk(value, ",\"\n"))
+                        {
+                            fputs(value, file);
+                            return;
+                        }
+                    fputc('"', file);
+                    for(const char* p = value; *p; p++)
+                        {
+                            if(*p == '"')
+                                fputc('"', file);
+                            fputc(*p, file);
+                        }
+                    fputc('"', file);
+                }
+
+        public:
+            AvnExporter() = default;
+            AvnExporter(const AvnExporter&) = delete;
+            AvnExporter& operator=(const AvnExporter&) = delete;
+
+            bool open(const std::string& path, ExportFormat fmt)
+                {
+                    close();
+                    file = fopen(path.c_str(), "wb");
+                    if(!file)
+                        return false;
+                    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+                    format = fmt;
+                    failed = false;
+                    total = 0;
+                    groupRows = 0;
+                    groupOffsets.clear();
+                    airlines = Dictionary();
+                    flights = Dictionary();
+                    if(format == EXPORT_CSV)
+                        {
+                            fputs("id,avnID,airline,flight,type,status,rule,phase,violationCount,speedRecorded,permissibleSpeed,maxExcess,"
+                                  "fineAmount,issuanceTime,dueDate,paidTime\n", file);
+                            return true;
+                        }
+                    describe(C_ID, "id", 'u', 8);
+                    describe(C_AIRLINE, "airline", 'd', 4);
+                    describe(C_FLIGHT, "flight", 'd', 4);
+                    describe(C_TYPE, "type", 'u', 1);
+                    describe(C_STATUS, "status", 'u', 1);
+                    describe(C_RULE, "rule", 'u', 1);
+                    describe(C_PHASE, "phase", 'u', 1);
+                    describe(C_VIOLATIONS, "violationCount", 'u', 4);
+                    describe(C_SPEED, "speedRecorded", 'f', 4);
+                    describe(C_PERMISSIBLE, "permissibleSpeed", 'f', 4);
+                    describe(C_MAX_EXCESS, "maxExcess", 'f', 4);
+                    describe(C_FINE, "fineMinorUnits", 'i', 8);
+                    describe(C_ISSUED, "issuanceTime", 'i', 8);
+                    describe(C_DUE, "dueDate", 'i', 8);
+                    describe(C_PAID, "paidTime", 'i', 8);
+                    ExportFileHeader h = { EXPORT_MAGIC, EXPORT_VERSION, EXPORT_COLUMNS, EXPORT_ROW_GROUP };
+                    put(&h, sizeof(h));
+                    for(const Column& c : columns)
+                        put(&c.desc, sizeof(c.desc));
+                    return !failed;
+                }
+
+            bool add(const AVN& avn)
+                {
+                    if(!file || failed)
+                        return false;
+                    total++;
+                    if(format == EXPORT_CSV)
+                        {
+                            fprintf(file, "%llu,%s,", (unsigned long long)avn.id, avn.avnID);
+                            putCsvString(avn.airlineName);
+                            fputc(',', file);
+                            putCsvString(avn.flightNumber);
+                            fprintf(file, ",%d,%s,%s,%u,%u,%.2f,%.2f,%.2f,%s,%lld,%lld,%lld\n", int(avn.type), avn.paymentStatus,
+                                    violationRuleToStr(avn.rule), avn.phase, avn.violationCount, avn.speedRecorded, avn.permissibleSpeed,
+                                    avn.maxExcess, formatMinorUnits(toMinorUnits(avn.fineAmount)).c_str(), (long long)avn.issuanceTime,
+                                    (long long)avn.dueDate, (long long)avn.paidTime);
+                            return !ferror(file);
+                        }
+                    columns[C_ID].push<uint64_t>(avn.id);
+                    columns[C_AIRLINE].push<uint32_t>(airlines.code(avn.airlineName));
+                    columns[C_FLIGHT].push<uint32_t>(flights.code(avn.flightNumber));
+                    columns[C_TYPE].push<uint8_t>(avn.type);
+                    columns[C_STATUS].push<uint8_t>(exportStatusOf(avn.paymentStatus));
+                    columns[C_RULE].push<uint8_t>(avn.rule);
+                    columns[C_PHASE].push<uint8_t>(avn.phase);
+                    columns[C_VIOLATIONS].push<uint32_t>(avn.violationCount);
+                    columns[C_SPEED].push<float>(avn.speedRecorded);
+                    columns[C_PERMISSIBLE].push<float>(avn.permissibleSpeed);
+                    columns[C_MAX_EXCESS].push<float>(avn.maxExcess);
+                    columns[C_FINE].push<int64_t>(toMinorUnits(avn.fineAmount));
+                    columns[C_ISSUED].push<int64_t>(avn.issuanceTime);
+                    columns[C_DUE].push<int64_t>(avn.dueDate);
+                    columns[C_PAID].push<int64_t>(avn.paidTime);
+                    if(++groupRows == EXPORT_ROW_GROUP)
+                        flushGroup();
+                    return !failed;
+                }
+
+            uint64_t rows() const
+                {
+                    return total;
+                }
+
+            //writes whatever is buffered and the footer; false if any write failed along the way
+            bool close()
+                {
+                    if(!file)
+                        return false;
+                    if(format == EXPORT_COLUMNAR)
+                        {
+                            flushGroup();
+                            ExportTrailer t = { uint64_t(ftello(file)), total, EXPORT_MAGIC, 0 };
+                            putDictionary(airlines);
+                            putDictionary(flights);
+                            uint32_t groups = groupOffsets.size();
+                            put(&groups, sizeof(groups));
+                            put(groupOffsets.data(), groupOffsets.size() * sizeof(uint64_t));
+                            put(&t, sizeof(t));
+                            for(Column& c : columns)
+                                std::vector<char>().swap(c.data);
+                        }
+                    bool ok = !failed && !ferror(file);
+                    if(fclose(file) != 0)
+                        ok = false;
+                    file = nullptr;
+                    return ok;
+                }
+
+            ~AvnExporter()
+                {
+                    if(file)
+                        close();
+                }
+    };
+
+#endif
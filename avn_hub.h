@@ -0,0 +1,421 @@
+#ifndef AVN_HUB_H
+#define AVN_HUB_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "avn_channel.h"
+#include "avn_wire.h"
+
+//publish/subscribe of AVNs from the generator to any number of airline portals over one Unix domain socket
+//SOCK_SEQPACKET keeps every AVN a single message, so a subscriber never sees half a record, and every
+//portal states its airline once (SubscribeRequest) and from then on only receives that airline's AVNs
+//a subscriber receives its AVNs in revision order and none is ever skipped: history it asked for is sent in
+//pages as the socket drains, and a portal too slow for its backlog is resent everything after the last AVN
+//it got, from the store, once it catches up. So the highest revision a portal holds covers all before it
+
+static const char* AVN_HUB_SOCKET = "avn_hub.sock";
+static const size_t HUB_SUBSCRIBER_BACKLOG = 4096;     //AVNs held for a slow portal before it is resent them from the store instead
+
+//generator side: the listening socket, inherited from the supervisor when there is one
+inline int hubListen()
+    {
+        int inherited = inheritedLinkFd(AVN_HUB_SOCKET);
+        if(inherited >= 0)
+            {
+                int fd = fcntl(inherited, F_DUPFD_CLOEXEC, 0);
+                if(fd >= 0)
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                return fd;
+            }
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+            return -1;
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, AVN_HUB_SOCKET, sizeof(addr.sun_path) - 1);
+        unlink(AVN_HUB_SOCKET);     //left over from a previous run
+        if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0)
+            {
+                int err = errno;
+                close(fd);
+                errno = err;
+                return -1;
+            }
+        return fd;
+    }
+
+//portal side: a non-blocking connection to the hub, -1 (errno set) if the generator is not listening yet
+inline int hubConnect()
+    {
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+            return -1;
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, AVN_HUB_SOCKET, sizeof(addr.sun_path) - 1);
+        if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+            {
+                int err = errno;
+                close(fd);
+                errno = err;
+                return -1;
+            }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return fd;
+    }
+
+//portal side: asks for airline's AVNs changed after sinceRevision (0 for all of them), replacing whatever this
+//connection subscribed to before
+inline bool hubSubscribe(int fd, const std::string& airline, uint64_t sinceRevision = 0)
+    {
+        SubscribeRequest request;
+        wireInit(request);
+        wireSetString(request.airlineName, airline);
+        request.sinceRevision = sinceRevision;
+        wireStamp(request);
+        return send(fd, &request, sizeof(request), MSG_NOSIGNAL) == ssize_t(sizeof(request));
+    }
+
+struct HubStats
+    {
+        uint64_t published = 0;
+        uint64_t delivered = 0;
+        uint64_t queued = 0;        //deliveries that had to wait for a slow subscriber
+        uint64_t dropped = 0;       //AVNs discarded from a full subscriber backlog, resent from the store later
+        uint64_t resyncs = 0;       //times a subscriber fell that far behind
+        size_t subscribers = 0;
+        size_t peakSubscribers = 0;
+    };
+
+class AvnHub
+    {
+        private:
+            struct Subscriber
+                {
+                    std::string topic;          //airline name, empty until the portal subscribes
+                    std::deque<AVN> backlog;    //live AVNs waiting for the socket
+                    std::vector<AVN> replay;    //history still to send, live AVNs queue behind it while it lasts
+                    size_t replayNext = 0;
+                    size_t replayLive = 0;      //live AVNs added to replay
+                    uint64_t sentRevision = 0;  //every AVN of the topic up to this revision has been sent
+                    bool stale = false;         //fell behind, waits for a replay from sentRevision
+                    bool wantsOut = false;      //EPOLLOUT requested
+                };
+
+            int listenFd = -1;
+            int epollFd = -1;
+            uint32_t listenTag = 0, clientTag = 0;
+            std::unordered_map<int, Subscriber> subscribers;
+            std::unordered_map<std::string, std::vector<int>> topics;      //airline -> subscriber fds, publish only visits these
+            HubStats stats;
+
+            static uint64_t key(uint32_t tag, int fd)
+                {
+                    return (uint64_t(tag) << 32) | uint32_t(fd);
+                }
+
+            void setInterest(int fd, Subscriber& s, bool out)
+                {
+                    if(s.wantsOut == out)
+                        return;
+                    s.wantsOut = out;
+                    epoll_event ev;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = EPOLLIN | (out ? uint32_t(EPOLLOUT) : 0u);
+                    ev.data.u64 = key(clientTag, fd);
+                    epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+                }
+
+            void leaveTopic(int fd, const std::string& topic)
+                {
+                    auto t = topics.find(topic);
+                    if(t == topics.end())
+                        return;
+                    t->second.erase(std::remove(t->second.begin(), t->second.end(), fd), t->second.end());
+                    if(t->second.empty())
+                        topics.erase(t);
+                }
+
+            //1 sent, 0 the socket is full, -1 the subscriber is gone
+            int sendOne(int fd, Subscriber& s, AVN& avn)
+                {
+                    wireStamp(avn);
+                    if(send(fd, &avn, sizeof(avn), MSG_DONTWAIT | MSG_NOSIGNAL) == ssize_t(sizeof(avn)))
+                        {
+                            stats.delivered++;
+                            s.sentRevision = std::max(s.sentRevision, avn.revision);
+                            return 1;
+                        }
+                    return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+                }
+
+            //sends what the socket takes, replay first; false once the subscriber is gone
+            bool pump(int fd, Subscriber& s)
+                {
+                    int sent = 1;
+                    while(sent > 0 && s.replayNext < s.replay.size())
+                        if((sent = sendOne(fd, s, s.replay[s.replayNext])) > 0)
+                            s.replayNext++;
+                    if(s.replayNext == s.replay.size() && !s.replay.empty())
+                        {
+                            std::vector<AVN>().swap(s.replay);
+                            s.replayNext = s.replayLive = 0;
+                        }
+                    while(sent > 0 && !s.backlog.empty())
+                        if((sent = sendOne(fd, s, s.backlog.front())) > 0)
+                            s.backlog.pop_front();
+                    if(sent < 0)
+                        return false;
+                    setInterest(fd, s, s.stale || !s.replay.empty() || !s.backlog.empty());
+                    return true;
+                }
+
+            //false once the subscriber is gone
+            bool deliver(int fd, Subscriber& s, AVN& avn)
+                {
+                    if(s.stale)
+                        return true;            //the replay from the store will hold it
+                    if(!s.replay.empty())       //history first
+                        {
+                            if(++s.replayLive > HUB_SUBSCRIBER_BACKLOG)
+                                fallBehind(fd, s);
+                            else
+                                s.replay.push_back(avn);
+                            return true;
+                        }
+                    if(!s.backlog.empty())      //keep order behind what is already waiting
+                        {
+                            enqueue(fd, s, avn);
+                            return true;
+                        }
+                    int sent = sendOne(fd, s, avn);
+                    if(sent == 0)
+                        enqueue(fd, s, avn);
+                    return sent >= 0;
+                }
+
+            void enqueue(int fd, Subscriber& s, const AVN& avn)
+                {
+                    if(s.backlog.size() >= HUB_SUBSCRIBER_BACKLOG)
+                        {
+                            fallBehind(fd, s);
+                            return;
+                        }
+                    s.backlog.push_back(avn);
+                    stats.queued++;
+                    setInterest(fd, s, true);
+                }
+
+            //drops everything queued for s rather than some of it; handle() asks for the replay from sentRevision
+            //once the socket is writable again, so nothing is lost and memory stays bounded meanwhile
+            void fallBehind(int fd, Subscriber& s)
+                {
+                    stats.dropped += s.backlog.size() + s.replay.size() - s.replayNext;
+                    stats.resyncs++;
+                    s.backlog.clear();
+                    std::vector<AVN>().swap(s.replay);
+                    s.replayNext = s.replayLive = 0;
+                    s.stale = true;
+                    setInterest(fd, s, true);
+                }
+
+        public:
+            //registers the listening socket with epollFd, events come back with data.u64 >> 32 == listenTag or
+            //clientTag and the fd in the low 32 bits
+            bool open(int epoll, uint32_t listenEventTag, uint32_t clientEventTag)
+                {
+                    epollFd = epoll;
+                    listenTag = listenEventTag;
+                    clientTag = clientEventTag;
+                    listenFd = hubListen();
+                    if(listenFd < 0)
+                        return false;
+                    epoll_event ev;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = EPOLLIN;
+                    ev.data.u64 = key(listenTag, listenFd);
+                    return epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev) == 0;
+                }
+
+            bool isOpen() const
+                {
+                    return listenFd >= 0;
+                }
+
+            static int eventFd(uint64_t data)
+                {
+                    return int(uint32_t(data));
+                }
+
+            static uint32_t eventTag(uint64_t data)
+                {
+                    return uint32_t(data >> 32);
+                }
+
+            void acceptAll()
+                {
+                    while(true)
+                        {
+                            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                            if(fd < 0)
+                                return;
+                            epoll_event ev;
+                            memset(&ev, 0, sizeof(ev));
+                            ev.events = EPOLLIN;
+                            ev.data.u64 = key(clientTag, fd);
+                            if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+                                {
+                                    ::close(fd);
+                                    continue;
+                                }
+                            subscribers[fd];
+                            stats.subscribers = subscribers.size();
+                            if(stats.subscribers > stats.peakSubscribers)
+                                stats.peakSubscribers = stats.subscribers;
+                        }
+                }
+
+            //handles an epoll event on a subscriber; returns true when the caller should replay() topic's AVNs
+            //changed after sinceRevision: the portal just (re)subscribed, or fell behind and can take more again
+            bool handle(int fd, uint32_t events, std::string& topic, uint64_t& sinceRevision)
+                {
+                    auto it = subscribers.find(fd);
+                    if(it == subscribers.end())
+                        return false;
+                    Subscriber& s = it->second;
+                    bool subscribed = false;
+                    if(events & EPOLLOUT)
+                        {
+                            if(!pump(fd, s))
+                                {
+                                    remove(fd);
+                                    return false;
+                                }
+                            if(s.stale)
+                                {
+                                    s.stale = false;
+                                    topic = s.topic;
+                                    sinceRevision = s.sentRevision;
+                                    subscribed = true;
+                                }
+                        }
+                    if(!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                        return subscribed;
+
+                    char buffer[sizeof(SubscribeRequest)];
+                    while(true)
+                        {
+                            ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+                            if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+                                {
+                                    remove(fd);     //portal went away
+                                    return false;
+                                }
+                            if(n < 0)
+                                break;
+                            const SubscribeRequest* request = n == sizeof(SubscribeRequest) ? wireView<SubscribeRequest>(buffer) : nullptr;
+                            if(!request)
+                                continue;
+                            std::string airline(request->airlineName, strnlen(request->airlineName, sizeof(request->airlineName)));
+                            leaveTopic(fd, s.topic);
+                            s.topic = airline;
+                            s.backlog.clear();      //whatever was queued belonged to the old topic
+                            std::vector<AVN>().swap(s.replay);
+                            s.replayNext = s.replayLive = 0;
+                            s.stale = false;
+                            topics[airline].push_back(fd);
+                            topic = airline;
+                            sinceRevision = request->sinceRevision;
+                            subscribed = true;
+                        }
+                    return subscribed;
+                }
+
+            //sends to every portal subscribed to avn.airlineName, returns how many that was
+            size_t publish(const AVN& avn)
+                {
+                    stats.published++;
+                    auto t = topics.find(avn.airlineName);
+                    if(t == topics.end())
+                        return 0;
+                    std::vector<int> fds = t->second;       //deliver() may remove a dead subscriber from the topic
+                    for(int fd : fds)
+                        sendTo(fd, avn);
+                    return fds.size();
+                }
+
+            //starts sending avns, the subscriber's AVNs changed after sinceRevision in revision order, to it after
+            //handle() asked for them; the rest goes out as the socket drains, live AVNs queue behind them
+            void replay(int fd, uint64_t sinceRevision, std::vector<AVN>& avns)
+                {
+                    auto it = subscribers.find(fd);
+                    if(it == subscribers.end())
+                        return;
+                    Subscriber& s = it->second;
+                    s.backlog.clear();
+                    s.replay.swap(avns);
+                    s.replayNext = s.replayLive = 0;
+                    s.sentRevision = sinceRevision;
+                    s.stale = false;
+                    if(!pump(fd, s))
+                        remove(fd);
+                }
+
+            //sends to one subscriber, in order behind whatever is still waiting for it
+            void sendTo(int fd, const AVN& avn)
+                {
+                    auto it = subscribers.find(fd);
+                    if(it == subscribers.end())
+                        return;
+                    AVN copy = avn;
+                    if(!deliver(fd, it->second, copy))
+                        remove(fd);
+                }
+
+            void remove(int fd)
+                {
+                    auto it = subscribers.find(fd);
+                    if(it == subscribers.end())
+                        return;
+                    leaveTopic(fd, it->second.topic);
+                    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+                    ::close(fd);
+                    subscribers.erase(it);
+                    stats.subscribers = subscribers.size();
+                }
+
+            HubStats snapshot() const
+                {
+                    return stats;
+                }
+
+            void close()
+                {
+                    while(!subscribers.empty())
+                        remove(subscribers.begin()->first);
+                    if(listenFd >= 0)
+                        ::close(listenFd);
+                    listenFd = -1;
+                }
+
+            ~AvnHub()
+                {
+                    close();
+                }
+    };
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef AVN_ID_H
+#define AVN_ID_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+//64-bit AVN IDs, unique across nodes and strictly increasing on each node, handed out without a lock
+//  bits 63..22  milliseconds since AVN_ID_EPOCH_MS (enough for ~139 years)
+//  bits 21..12  node, AIRCONTROLX_NODE when several ATCs issue AVNs into one generator
+//  bits 11..0   sequence within the millisecond
+//the integer is the key everywhere, "AVN-" plus 16 hex digits is its printable form in AVN::avnID
+
+static const uint64_t AVN_ID_EPOCH_MS = 1704067200000ull;     //2024-01-01 00:00:00 UTC
+static const int AVN_ID_NODE_BITS = 10;
+static const int AVN_ID_SEQUENCE_BITS = 12;
+static const uint64_t AVN_ID_SEQUENCE_MASK = (1ull << AVN_ID_SEQUENCE_BITS) - 1;
+
+inline uint32_t avnNodeFromEnv()
+    {
+        const char* node = getenv("AIRCONTROLX_NODE");
+        return node ? uint32_t(atoi(node)) & ((1u << AVN_ID_NODE_BITS) - 1) : 0;
+    }
+
+class AvnIdGenerator
+    {
+        private:
+            std::atomic<uint64_t> last{0};
+            uint64_t nodeBits;
+
+            static uint64_t nowMs()
+                {
+                    timespec ts;
+                    clock_gettime(CLOCK_REALTIME, &ts);
+                    uint64_t ms = uint64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+                    return ms > AVN_ID_EPOCH_MS ? ms - AVN_ID_EPOCH_MS : 0;
+                }
+
+        public:
+            explicit AvnIdGenerator(uint32_t node)
+                : nodeBits(uint64_t(node & ((1u << AVN_ID_NODE_BITS) - 1)) << AVN_ID_SEQUENCE_BITS)
+                {
+                }
+
+            //safe from any number of threads; a full millisecond or a clock step backwards borrows the next millisecond
+            uint64_t next()
+                {
+                    uint64_t prev = last.load(std::memory_order_relaxed);
+                    while(true)
+                        {
+                            uint64_t fresh = (nowMs() << (AVN_ID_NODE_BITS + AVN_ID_SEQUENCE_BITS)) | nodeBits;
+                            uint64_t id = prev + 1;
+                            if(fresh > prev)
+                                id = fresh;
+                            else if((id & AVN_ID_SEQUENCE_MASK) == 0)      //sequence wrapped into the node bits
+                                id = (((prev >> (AVN_ID_NODE_BITS + AVN_ID_SEQUENCE_BITS)) + 1) << (AVN_ID_NODE_BITS + AVN_ID_SEQUENCE_BITS)) | nodeBits;
+                            if(last.compare_exchange_weak(prev, id, std::memory_order_relaxed))
+                                return id;
+                        }
+                }
+    };
+
+//"AVN-0123456789abcdef" into field
+template<size_t N>
+inline void avnIdToStr(uint64_t id, char (&field)[N])
+    {
+        static_assert(N >= 21, "field too small for a printable AVN ID");
+        snprintf(field, N, "AVN-%016llx", (unsigned long long)id);
+    }
+
+//0 if text is not a printable AVN ID
+inline uint64_t avnIdFromStr(const char* text)
+    {
+        if(!text || text[0] != 'A' || text[1] != 'V' || text[2] != 'N' || text[3] != '-')
+            return 0;
+        char* end = nullptr;
+        unsigned long long id = strtoull(text + 4, &end, 16);
+        return end && *end == '\0' ? id : 0;
+    }
+
+#endif
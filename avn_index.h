@@ -0,0 +1,782 @@
+#ifndef AVN_INDEX_H
+#define AVN_INDEX_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "avn_ledger.h"
+#include "avn_wire.h"
+
+//the portal's AVNs plus secondary indexes so view and search never scan every record:
+//  airline -> its AVNs ordered by issuance time
+//  (airline, flight number) -> that flight's AVNs ordered by issuance time
+//a search by flight and issuance time is a map lookup and two binary searches, then only the matches are visited
+//
+//readers never lock: snapshot() pins an immutable AvnSnapshot that stays valid for as long as it is held, while
+//the one writer (the portal's ingest thread) builds the next version and publish()es it with an atomic swap.
+//records and index entries live in fixed-size chunks behind shared_ptrs, so a new version shares every chunk it
+//did not touch and copies only the ones a batch changed (copy-on-write), plus the short chunk pointer lists
+//
+//each version also carries per-airline AvnAggregates, kept current on every upsert by taking the old state of an
+//AVN out and putting the new one in, so summary, top, daily and overdue never walk the records
+//
+//save() writes one airline's share of the index to a file laid out the way the index uses it in memory, and load()
+//maps that file back: record chunks and time order leaves point into the mapping until something changes them
+
+static const size_t INDEX_RECORD_CHUNK = 256;       //AVNs per record chunk
+static const size_t INDEX_LEAF_ENTRIES = 512;       //most time index entries per leaf before it splits
+
+struct AvnTimeEntry
+    {
+        int64_t issuanceTime;
+        uint64_t id;
+        uint32_t slot;          //position in AvnSnapshot's records
+        uint32_t reserved;      //keeps the padding zeroed in a snapshot file
+
+        bool operator<(const AvnTimeEntry& o) const
+            {
+                return issuanceTime != o.issuanceTime ? issuanceTime < o.issuanceTime : id < o.id;
+            }
+    };
+
+//one B+tree leaf; a leaf loaded from a snapshot file reads its entries straight out of the file's mapping until
+//its first change copies them into own
+struct AvnTimeLeaf
+    {
+        std::vector<AvnTimeEntry> own;
+        const AvnTimeEntry* mapped = nullptr;
+        size_t mappedCount = 0;
+        std::shared_ptr<const void> file;      //keeps the mapping alive while mapped points into it
+
+        const AvnTimeEntry* begin() const
+            {
+                return mapped ? mapped : own.data();
+            }
+
+        const AvnTimeEntry* end() const
+            {
+                return begin() + size();
+            }
+
+        size_t size() const
+            {
+                return mapped ? mappedCount : own.size();
+            }
+
+        const AvnTimeEntry& back() const
+            {
+                return end()[-1];
+            }
+
+        const AvnTimeEntry& operator[](size_t i) const
+            {
+                return begin()[i];
+            }
+    };
+
+//a sorted sequence of AvnTimeEntry split into leaves, a two-level B+tree whose leaves are shared between versions
+class AvnTimeOrder
+    {
+        private:
+            typedef std::vector<AvnTimeEntry> Entries;
+            std::vector<std::shared_ptr<AvnTimeLeaf>> leaves;      //never holds an empty leaf
+            size_t total = 0;
+
+            //first leaf whose last entry is not below key
+            size_t leafFor(const AvnTimeEntry& key) const
+                {
+                    size_t lo = 0, hi = leaves.size();
+                    while(lo < hi)
+                        {
+                            size_t mid = (lo + hi) / 2;
+                            if(leaves[mid]->back() < key)
+                                lo = mid + 1;
+                            else
+                                hi = mid;
+                        }
+                    return lo;
+                }
+
+            static std::shared_ptr<AvnTimeLeaf> ownedLeaf(const AvnTimeEntry* first, const AvnTimeEntry* last)
+                {
+                    auto leaf = std::make_shared<AvnTimeLeaf>();
+                    leaf->own.assign(first, last);
+                    return leaf;
+                }
+
+            //the leaf is ours alone once no published version holds it and it is not in a mapping, otherwise it is copied first
+            Entries& writable(size_t i)
+                {
+                    if(leaves[i].use_count() != 1 || leaves[i]->mapped)
+                        leaves[i] = ownedLeaf(leaves[i]->begin(), leaves[i]->end());
+                    return leaves[i]->own;
+                }
+
+        public:
+            void insert(const AvnTimeEntry& entry)
+                {
+                    total++;
+                    if(leaves.empty())
+                        {
+                            leaves.push_back(ownedLeaf(&entry, &entry + 1));
+                            return;
+                        }
+                    size_t i = std::min(leafFor(entry), leaves.size() - 1);      //past the end appends to the last leaf
+                    Entries& leaf = writable(i);
+                    leaf.insert(std::upper_bound(leaf.begin(), leaf.end(), entry), entry);
+                    if(leaf.size() > INDEX_LEAF_ENTRIES)
+                        {
+                            auto upper = ownedLeaf(leaf.data() + leaf.size() / 2, leaf.data() + leaf.size());
+                            leaf.resize(leaf.size() / 2);
+                            leaves.insert(leaves.begin() + i + 1, upper);
+                        }
+                }
+
+            void erase(const AvnTimeEntry& entry)
+                {
+                    size_t i = leafFor(entry);
+                    if(i == leaves.size())
+                        return;
+                    const AvnTimeEntry* it = std::lower_bound(leaves[i]->begin(), leaves[i]->end(), entry);
+                    if(it == leaves[i]->end() || it->id != entry.id || it->issuanceTime != entry.issuanceTime)
+                        return;
+                    size_t at = it - leaves[i]->begin();        //before writable() may swap in a copy
+                    Entries& leaf = writable(i);
+                    leaf.erase(leaf.begin() + at);
+                    total--;
+                    if(leaf.empty())
+                        leaves.erase(leaves.begin() + i);
+                }
+
+            //takes count sorted entries that live in file's mapping as full leaves, without copying them
+            void adopt(const AvnTimeEntry* entries, size_t count, const std::shared_ptr<const void>& file)
+                {
+                    leaves.clear();
+                    total = count;
+                    for(size_t first = 0; first < count; first += INDEX_LEAF_ENTRIES)
+                        {
+                            auto leaf = std::make_shared<AvnTimeLeaf>();
+                            leaf->mapped = entries + first;
+                            leaf->mappedCount = std::min(INDEX_LEAF_ENTRIES, count - first);
+                            leaf->file = file;
+                            leaves.push_back(leaf);
+                        }
+                }
+
+            bool empty() const
+                {
+                    return leaves.empty();
+                }
+
+            size_t size() const
+                {
+                    return total;
+                }
+
+            //fn(const AvnTimeEntry&) for up to count entries starting at position offset, whole leaves are skipped by size
+            template<typename Fn>
+            void forPage(size_t offset, size_t count, Fn& fn) const
+                {
+                    size_t i = 0;
+                    while(i < leaves.size() && offset >= leaves[i]->size())
+                        offset -= leaves[i++]->size();
+                    for(; i < leaves.size() && count; i++, offset = 0)
+                        for(size_t k = offset; k < leaves[i]->size() && count; k++, count--)
+                            fn((*leaves[i])[k]);
+                }
+
+            //fn(const AvnTimeEntry&) for every entry issued in [from, to], oldest first
+            template<typename Fn>
+            void forRange(int64_t from, int64_t to, Fn& fn) const
+                {
+                    AvnTimeEntry start = { from, 0, 0, 0 };
+                    size_t first = leafFor(start);
+                    for(size_t i = first; i < leaves.size(); i++)
+                        for(auto it = i == first ? std::lower_bound(leaves[i]->begin(), leaves[i]->end(), start) : leaves[i]->begin();
+                            it != leaves[i]->end(); ++it)
+                            {
+                                if(it->issuanceTime > to)
+                                    return;
+                                fn(*it);
+                            }
+                }
+    };
+
+struct FlightTally
+    {
+        uint64_t avns = 0;
+        uint64_t violations = 0;        //sum of violationCount
+        int64_t fines = 0;              //minor units
+    };
+
+struct DayTally
+    {
+        uint64_t avns = 0;
+        int64_t fines = 0;              //minor units, as issued
+    };
+
+//running totals over one airline's AVNs; every field moves by exactly what one AVN contributes
+class AvnAggregates
+    {
+        public:
+            uint64_t avns = 0;
+            int64_t unpaid = 0;             //minor units, by the AVN's current status
+            int64_t overdue = 0;
+            int64_t paid = 0;
+            uint64_t byType[EMERGENCY + 1] = {};
+            std::map<std::string, FlightTally> flights;
+            std::set<std::tuple<uint64_t, int64_t, std::string>> ranking;     //violations, fines, flight: worst last
+            std::map<int64_t, DayTally> perDay;                                //UTC day number of issuanceTime
+            std::set<AvnTimeEntry> overdueList;                                //issuanceTime holds the due date here
+
+            static int64_t dayOf(int64_t t)
+                {
+                    return t >= 0 ? t / 86400 : (t - 86399) / 86400;
+                }
+
+            //sign is +1 to add the AVN's contribution, -1 to take it back out
+            void apply(const AVN& avn, uint32_t slot, int sign)
+                {
+                    int64_t fine = toMinorUnits(avn.fineAmount);
+                    avns += sign;
+                    if(strcmp(avn.paymentStatus, "paid") == 0)
+                        paid += sign * fine;
+                    else if(strcmp(avn.paymentStatus, "overdue") == 0)
+                        {
+                            overdue += sign * fine;
+                            AvnTimeEntry due = { avn.dueDate, avn.id, slot, 0 };
+                            if(sign > 0)
+                                overdueList.insert(due);
+                            else
+                                overdueList.erase(due);
+                        }
+                    else
+                        unpaid += sign * fine;
+                    if(avn.type >= COMMERCIAL && avn.type <= EMERGENCY)
+                        byType[avn.type] += sign;
+
+                    FlightTally& flight = flights[avn.flightNumber];
+                    ranking.erase(std::make_tuple(flight.violations, flight.fines, std::string(avn.flightNumber)));
+                    flight.avns += sign;
+                    flight.violations += sign * int64_t(avn.violationCount);
+                    flight.fines += sign * fine;
+                    if(flight.avns)
+                        ranking.insert(std::make_tuple(flight.violations, flight.fines, std::string(avn.flightNumber)));
+                    else
+                        flights.erase(avn.flightNumber);
+
+                    DayTally& day = perDay[dayOf(avn.issuanceTime)];
+                    day.avns += sign;
+                    day.fines += sign * fine;
+                    if(!day.avns)
+                        perDay.erase(dayOf(avn.issuanceTime));
+                }
+    };
+
+//one immutable version of the portal's AVNs, everything a reader needs to answer view and search
+class AvnSnapshot
+    {
+        private:
+            friend class AvnIndex;
+            typedef std::array<AVN, INDEX_RECORD_CHUNK> Chunk;
+
+            std::vector<std::shared_ptr<Chunk>> chunks;
+            uint32_t count = 0;         //slots in use, a slot is never reused within one index
+            size_t live = 0;            //distinct AVNs
+            std::map<std::string, AvnTimeOrder> byAirline;
+            std::map<std::pair<std::string, std::string>, AvnTimeOrder> byFlight;
+            std::map<std::string, std::shared_ptr<AvnAggregates>> aggregates;     //copied on write like the chunks
+
+            AVN& writable(uint32_t slot)
+                {
+                    std::shared_ptr<Chunk>& chunk = chunks[slot / INDEX_RECORD_CHUNK];
+                    if(chunk.use_count() != 1)
+                        chunk = std::make_shared<Chunk>(*chunk);
+                    return (*chunk)[slot % INDEX_RECORD_CHUNK];
+                }
+
+            template<typename Fn>
+            void visit(const AvnTimeOrder& order, int64_t from, int64_t to, Fn& fn) const
+                {
+                    auto each = [&](const AvnTimeEntry& e) { fn(record(e.slot)); };
+                    order.forRange(from, to, each);
+                }
+
+        public:
+            const AVN& record(uint32_t slot) const
+                {
+                    return (*chunks[slot / INDEX_RECORD_CHUNK])[slot % INDEX_RECORD_CHUNK];
+                }
+
+            //fn(const AVN&) for each of the airline's AVNs issued in [from, to], oldest first
+            template<typename Fn>
+            void forAirline(const std::string& airline, int64_t from, int64_t to, Fn fn) const
+                {
+                    auto a = byAirline.find(airline);
+                    if(a != byAirline.end())
+                        visit(a->second, from, to, fn);
+                }
+
+            template<typename Fn>
+            void forAirline(const std::string& airline, Fn fn) const
+                {
+                    forAirline(airline, INT64_MIN, INT64_MAX, fn);
+                }
+
+            //fn(const AVN&) for the airline's AVNs at positions [offset, offset + count) in issuance order
+            template<typename Fn>
+            void forAirlinePage(const std::string& airline, size_t offset, size_t count, Fn fn) const
+                {
+                    auto a = byAirline.find(airline);
+                    if(a == byAirline.end())
+                        return;
+                    auto each = [&](const AvnTimeEntry& e) { fn(record(e.slot)); };
+                    a->second.forPage(offset, count, each);
+                }
+
+            size_t countAirline(const std::string& airline) const
+                {
+                    auto a = byAirline.find(airline);
+                    return a == byAirline.end() ? 0 : a->second.size();
+                }
+
+            //fn(const AVN&) for each AVN of one flight issued in [from, to], oldest first
+            template<typename Fn>
+            void forFlight(const std::string& airline, const std::string& flightNumber, int64_t from, int64_t to, Fn fn) const
+                {
+                    auto f = byFlight.find(std::make_pair(airline, flightNumber));
+                    if(f != byFlight.end())
+                        visit(f->second, from, to, fn);
+                }
+
+            size_t size() const
+                {
+                    return live;
+                }
+
+            //the airline's running totals, nullptr if it has no AVNs
+            const AvnAggregates* totals(const std::string& airline) const
+                {
+                    auto a = aggregates.find(airline);
+                    return a == aggregates.end() ? nullptr : a->second.get();
+                }
+    };
+
+//snapshot file layout, every section 8-byte aligned and in this order after the header:
+//  records       the airline's AVNs in id order, padded with zeroes to a whole number of INDEX_RECORD_CHUNKs
+//  airline order AvnTimeEntry for each record, in issuance order
+//  flights       IndexFileFlight for each flight, its AvnTimeEntrys are count entries from first in the flight orders
+//  flight orders AvnTimeEntry for each record again, grouped by flight and each group in issuance order
+//  days          IndexFileDay for each day with AVNs, oldest first
+//  overdue       AvnTimeEntry for each overdue AVN, with the due date as issuanceTime
+//slots in the entries are record positions, so the mapped records and entries need no fixing up
+
+static const uint32_t INDEX_FILE_MAGIC = 0x53505641;       //"AVPS"
+static const uint32_t INDEX_FILE_VERSION = 1;
+
+struct IndexFileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t recordSize;            //sizeof(AVN), the records are used in place and must match this build
+        uint32_t wireVersion;
+        char airline[32];
+        uint64_t revision;              //every generator change up to this one is in the file
+        uint64_t records;
+        uint64_t flights;
+        uint64_t days;
+        uint64_t overdue;
+        int64_t unpaidFines;            //AvnAggregates totals, minor units
+        int64_t overdueFines;
+        int64_t paidFines;
+        uint64_t byType[EMERGENCY + 1];
+        uint64_t recordOffset;
+        uint64_t airlineOffset;
+        uint64_t flightOffset;
+        uint64_t entryOffset;
+        uint64_t dayOffset;
+        uint64_t overdueOffset;
+        uint64_t size;                  //whole file, a shorter one was cut off
+    };
+
+struct IndexFileFlight
+    {
+        char flightNumber[16];
+        uint64_t first;
+        uint64_t count;
+        uint64_t violations;
+        int64_t fines;
+    };
+
+struct IndexFileDay
+    {
+        int64_t day;
+        uint64_t avns;
+        int64_t fines;
+    };
+
+static_assert(sizeof(AvnTimeEntry) == 24 && sizeof(IndexFileHeader) == 192 && sizeof(IndexFileFlight) == 48 && sizeof(IndexFileDay) == 24,
+              "snapshot file layout changed, bump INDEX_FILE_VERSION");
+
+//single writer, any number of readers
+class AvnIndex
+    {
+        private:
+            std::shared_ptr<AvnSnapshot> draft = std::make_shared<AvnSnapshot>();      //next version, writer only
+            std::shared_ptr<const AvnSnapshot> published = std::make_shared<const AvnSnapshot>();
+            bool draftShared = false;       //draft is the object last published, copy it before the next change
+            std::unordered_map<uint64_t, uint32_t> slots;      //id -> slot, writer only
+            uint32_t loadedSlots = 0;       //slots below this came from load() in id order and are found by binary search instead
+
+            AvnSnapshot& edit()
+                {
+                    if(draftShared)
+                        {
+                            draft = std::make_shared<AvnSnapshot>(*draft);      //copies chunk pointers, not chunks
+                            draftShared = false;
+                        }
+                    return *draft;
+                }
+
+            static void aggregate(AvnSnapshot& s, const AVN& avn, uint32_t slot, int sign)
+                {
+                    std::shared_ptr<AvnAggregates>& a = s.aggregates[avn.airlineName];
+                    if(!a)
+                        a = std::make_shared<AvnAggregates>();
+                    else if(a.use_count() != 1)
+                        a = std::make_shared<AvnAggregates>(*a);
+                    a->apply(avn, slot, sign);
+                    if(!a->avns)
+                        s.aggregates.erase(avn.airlineName);
+                }
+
+            static void link(AvnSnapshot& s, const AVN& avn, uint32_t slot)
+                {
+                    AvnTimeEntry entry = { avn.issuanceTime, avn.id, slot, 0 };
+                    s.byAirline[avn.airlineName].insert(entry);
+                    s.byFlight[std::make_pair(std::string(avn.airlineName), std::string(avn.flightNumber))].insert(entry);
+                }
+
+            static void unlink(AvnSnapshot& s, const AVN& avn, uint32_t slot)
+                {
+                    AvnTimeEntry entry = { avn.issuanceTime, avn.id, slot, 0 };
+                    auto a = s.byAirline.find(avn.airlineName);
+                    if(a != s.byAirline.end())
+                        {
+                            a->second.erase(entry);
+                            if(a->second.empty())
+                                s.byAirline.erase(a);
+                        }
+                    auto f = s.byFlight.find(std::make_pair(std::string(avn.airlineName), std::string(avn.flightNumber)));
+                    if(f != s.byFlight.end())
+                        {
+                            f->second.erase(entry);
+                            if(f->second.empty())
+                                s.byFlight.erase(f);
+                        }
+                }
+
+            bool slotOf(uint64_t id, uint32_t& slot) const
+                {
+                    auto it = slots.find(id);
+                    if(it != slots.end())
+                        {
+                            slot = it->second;
+                            return true;
+                        }
+                    uint32_t lo = 0, hi = loadedSlots;
+                    while(lo < hi)
+                        {
+                            uint32_t mid = lo + (hi - lo) / 2;
+                            if(draft->record(mid).id < id)
+                                lo = mid + 1;
+                            else
+                                hi = mid;
+                        }
+                    slot = lo;
+                    return lo < loadedSlots && draft->record(lo).id == id;
+                }
+
+            template<typename T>
+            static bool putAll(FILE* file, const std::vector<T>& values)
+                {
+                    return values.empty() || fwrite(values.data(), sizeof(T), values.size(), file) == values.size();
+                }
+
+        public:
+            //inserts a new AVN or replaces the stored state of a known one, visible to readers after publish()
+            void upsert(const AVN& avn)
+                {
+                    AvnSnapshot& s = edit();
+                    uint32_t known;
+                    if(slotOf(avn.id, known))
+                        {
+                            AVN old = s.record(known);
+                            bool keysChanged = old.issuanceTime != avn.issuanceTime || strcmp(old.airlineName, avn.airlineName) != 0 ||
+                                               strcmp(old.flightNumber, avn.flightNumber) != 0;
+                            if(keysChanged)
+                                unlink(s, old, known);
+                            aggregate(s, old, known, -1);
+                            s.writable(known) = avn;
+                            aggregate(s, avn, known, +1);
+                            if(keysChanged)
+                                link(s, avn, known);
+                            return;
+                        }
+                    uint32_t slot = s.count++;
+                    if(slot % INDEX_RECORD_CHUNK == 0)
+                        s.chunks.push_back(std::make_shared<AvnSnapshot::Chunk>());
+                    s.writable(slot) = avn;
+                    s.live++;
+                    slots.emplace(avn.id, slot);
+                    link(s, avn, slot);
+                    aggregate(s, avn, slot, +1);
+                }
+
+            //latest state including unpublished changes, writer only; nullptr if unknown
+            const AVN* find(uint64_t id) const
+                {
+                    uint32_t slot;
+                    return slotOf(id, slot) ? &draft->record(slot) : nullptr;
+                }
+
+            //makes every change so far visible to snapshot(), one atomic pointer swap
+            void publish()
+                {
+                    std::atomic_store(&published, std::shared_ptr<const AvnSnapshot>(draft));
+                    draftShared = true;
+                }
+
+            //forgets every AVN, readers see an empty index after the next publish()
+            void clear()
+                {
+                    draft = std::make_shared<AvnSnapshot>();
+                    draftShared = false;
+                    slots.clear();
+                    loadedSlots = 0;
+                }
+
+            //writes the airline's AVNs as of the last publish() to path, through a temporary file and a rename so a
+            //crash midway leaves the previous file; revision is the latest generator change the caller has applied
+            bool save(const std::string& path, const std::string& airline, uint64_t revision) const
+                {
+                    std::shared_ptr<const AvnSnapshot> s = snapshot();
+                    std::vector<uint32_t> byTime, byId;
+                    auto a = s->byAirline.find(airline);
+                    if(a != s->byAirline.end())
+                        {
+                            auto each = [&](const AvnTimeEntry& e) { byTime.push_back(e.slot); };
+                            a->second.forPage(0, a->second.size(), each);
+                        }
+                    byId = byTime;
+                    std::sort(byId.begin(), byId.end(), [&](uint32_t x, uint32_t y) { return s->record(x).id < s->record(y).id; });
+                    std::vector<uint32_t> position(s->count);      //slot -> record position in the file
+                    for(size_t i = 0; i < byId.size(); i++)
+                        position[byId[i]] = i;
+
+                    std::vector<AVN> records((byId.size() + INDEX_RECORD_CHUNK - 1) / INDEX_RECORD_CHUNK * INDEX_RECORD_CHUNK, AVN());
+                    for(size_t i = 0; i < byId.size(); i++)
+                        records[i] = s->record(byId[i]);
+                    std::vector<AvnTimeEntry> airlineOrder, flightOrders, overdue;
+                    for(uint32_t slot : byTime)
+                        airlineOrder.push_back(AvnTimeEntry{ s->record(slot).issuanceTime, s->record(slot).id, position[slot], 0 });
+                    std::vector<IndexFileFlight> flights;
+                    std::vector<IndexFileDay> days;
+                    const AvnAggregates* totals = s->totals(airline);
+                    for(auto f = s->byFlight.lower_bound(std::make_pair(airline, std::string())); f != s->byFlight.end() && f->first.first == airline; ++f)
+                        {
+                            IndexFileFlight flight;
+                            memset(&flight, 0, sizeof(flight));
+                            wireSetString(flight.flightNumber, f->first.second);
+                            flight.first = flightOrders.size();
+                            flight.count = f->second.size();
+                            auto tally = totals ? totals->flights.find(f->first.second) : std::map<std::string, FlightTally>::const_iterator();
+                            if(totals && tally != totals->flights.end())
+                                {
+                                    flight.violations = tally->second.violations;
+                                    flight.fines = tally->second.fines;
+                                }
+                            auto each = [&](const AvnTimeEntry& e) { flightOrders.push_back(AvnTimeEntry{ e.issuanceTime, e.id, position[e.slot], 0 }); };
+                            f->second.forPage(0, f->second.size(), each);
+                            flights.push_back(flight);
+                        }
+
+                    IndexFileHeader h;
+                    memset(&h, 0, sizeof(h));
+                    h.magic = INDEX_FILE_MAGIC;
+                    h.version = INDEX_FILE_VERSION;
+                    h.recordSize = sizeof(AVN);
+                    h.wireVersion = WIRE_VERSION;
+                    wireSetString(h.airline, airline);
+                    h.revision = revision;
+                    h.records = byId.size();
+                    h.flights = flights.size();
+                    if(totals)
+                        {
+                            for(const auto& d : totals->perDay)
+                                days.push_back(IndexFileDay{ d.first, d.second.avns, d.second.fines });
+                            for(const AvnTimeEntry& e : totals->overdueList)
+                                overdue.push_back(AvnTimeEntry{ e.issuanceTime, e.id, position[e.slot], 0 });
+                            h.unpaidFines = totals->unpaid;
+                            h.overdueFines = totals->overdue;
+                            h.paidFines = totals->paid;
+                            memcpy(h.byType, totals->byType, sizeof(h.byType));
+                        }
+                    h.days = days.size();
+                    h.overdue = overdue.size();
+                    h.recordOffset = sizeof(h);
+                    h.airlineOffset = h.recordOffset + records.size() * sizeof(AVN);
+                    h.flightOffset = h.airlineOffset + airlineOrder.size() * sizeof(AvnTimeEntry);
+                    h.entryOffset = h.flightOffset + flights.size() * sizeof(IndexFileFlight);
+                    h.dayOffset = h.entryOffset + flightOrders.size() * sizeof(AvnTimeEntry);
+                    h.overdueOffset = h.dayOffset + days.size() * sizeof(IndexFileDay);
+                    h.size = h.overdueOffset + overdue.size() * sizeof(AvnTimeEntry);
+
+                    std::string tmpPath = path + ".tmp";
+                    FILE* file = fopen(tmpPath.c_str(), "wb");
+                    if(!file)
+                        return false;
+                    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+                    bool ok = fwrite(&h, sizeof(h), 1, file) == 1 && putAll(file, records) && putAll(file, airlineOrder) &&
+                              putAll(file, flights) && putAll(file, flightOrders) && putAll(file, days) && putAll(file, overdue) &&
+                              fflush(file) == 0 && fsync(fileno(file)) == 0;
+                    int err = errno;
+                    if(fclose(file) != 0 && ok)
+                        {
+                            ok = false;
+                            err = errno;
+                        }
+                    if(ok && rename(tmpPath.c_str(), path.c_str()) == 0)
+                        return true;
+                    if(ok)
+                        err = errno;
+                    ::unlink(tmpPath.c_str());
+                    errno = err;
+                    return false;
+                }
+
+            //replaces the index with what save() wrote to path; the file is mapped privately and its records and
+            //time orders are used in place, so only the per-flight and per-day totals and the overdue list are
+            //rebuilt and loading ten million AVNs costs about what ten do. Readers see it after the next publish()
+            //false with errno set (EPROTO for a file from another layout or with a slot out of range) leaves the index empty
+            bool load(const std::string& path, std::string& airline, uint64_t& revision)
+                {
+                    clear();
+                    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                    if(fd < 0)
+                        return false;
+                    struct stat st;
+                    if(fstat(fd, &st) < 0)
+                        {
+                            int err = errno;
+                            ::close(fd);
+                            errno = err;
+                            return false;
+                        }
+                    size_t size = st.st_size;
+                    //writable so a chunk only this index holds can be changed in place, private so that never reaches the file
+                    void* mem = size >= sizeof(IndexFileHeader) ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+                    int err = errno;
+                    ::close(fd);
+                    if(mem == MAP_FAILED)
+                        {
+                            errno = size < sizeof(IndexFileHeader) ? EPROTO : err;
+                            return false;
+                        }
+                    std::shared_ptr<void> file(mem, [size](void* p) { munmap(p, size); });
+                    const char* base = static_cast<const char*>(mem);
+                    const IndexFileHeader& h = *reinterpret_cast<const IndexFileHeader*>(base);
+                    uint64_t padded = (h.records + INDEX_RECORD_CHUNK - 1) / INDEX_RECORD_CHUNK * INDEX_RECORD_CHUNK;
+                    bool valid = h.magic == INDEX_FILE_MAGIC && h.version == INDEX_FILE_VERSION && h.recordSize == sizeof(AVN) &&
+                                 h.wireVersion == WIRE_VERSION && h.size == size && h.records < UINT32_MAX &&
+                                 memchr(h.airline, '\0', sizeof(h.airline)) && h.recordOffset == sizeof(h) &&
+                                 h.airlineOffset == h.recordOffset + padded * sizeof(AVN) &&
+                                 h.flightOffset == h.airlineOffset + h.records * sizeof(AvnTimeEntry) &&
+                                 h.entryOffset == h.flightOffset + h.flights * sizeof(IndexFileFlight) &&
+                                 h.dayOffset == h.entryOffset + h.records * sizeof(AvnTimeEntry) &&
+                                 h.overdueOffset == h.dayOffset + h.days * sizeof(IndexFileDay) &&
+                                 h.size == h.overdueOffset + h.overdue * sizeof(AvnTimeEntry);
+                    const IndexFileFlight* flights = reinterpret_cast<const IndexFileFlight*>(base + (valid ? h.flightOffset : 0));
+                    for(uint64_t i = 0; valid && i < h.flights; i++)
+                        valid = flights[i].first <= h.records && flights[i].count <= h.records - flights[i].first &&
+                                memchr(flights[i].flightNumber, '\0', sizeof(flights[i].flightNumber));
+                    //every slot is used to index the mapped records, so one out of range would read past them
+                    auto inRange = [&](uint64_t offset, uint64_t count)
+                        {
+                            const AvnTimeEntry* e = reinterpret_cast<const AvnTimeEntry*>(base + offset);
+                            for(uint64_t i = 0; i < count; i++)
+                                if(e[i].slot >= h.records)
+                                    return false;
+                            return true;
+                        };
+                    valid = valid && inRange(h.airlineOffset, h.records) && inRange(h.entryOffset, h.records) && inRange(h.overdueOffset, h.overdue);
+                    if(!valid)
+                        {
+                            errno = EPROTO;
+                            return false;
+                        }
+
+                    airline = h.airline;
+                    revision = h.revision;
+                    AvnSnapshot& s = edit();
+                    AvnSnapshot::Chunk* chunks = reinterpret_cast<AvnSnapshot::Chunk*>(static_cast<char*>(mem) + h.recordOffset);
+                    for(uint64_t i = 0; i < padded / INDEX_RECORD_CHUNK; i++)
+                        s.chunks.push_back(std::shared_ptr<AvnSnapshot::Chunk>(file, chunks + i));     //shares the mapping's lifetime
+                    s.count = h.records;
+                    s.live = h.records;
+                    loadedSlots = h.records;
+                    if(!h.records)
+                        return true;
+
+                    const AvnTimeEntry* entries = reinterpret_cast<const AvnTimeEntry*>(base + h.entryOffset);
+                    s.byAirline[airline].adopt(reinterpret_cast<const AvnTimeEntry*>(base + h.airlineOffset), h.records, file);
+                    auto totals = std::make_shared<AvnAggregates>();
+                    totals->avns = h.records;
+                    totals->unpaid = h.unpaidFines;
+                    totals->overdue = h.overdueFines;
+                    totals->paid = h.paidFines;
+                    memcpy(totals->byType, h.byType, sizeof(totals->byType));
+                    for(uint64_t i = 0; i < h.flights; i++)
+                        {
+                            const IndexFileFlight& f = flights[i];
+                            s.byFlight[std::make_pair(airline, std::string(f.flightNumber))].adopt(entries + f.first, f.count, file);
+                            FlightTally& tally = totals->flights[f.flightNumber];
+                            tally.avns = f.count;
+                            tally.violations = f.violations;
+                            tally.fines = f.fines;
+                            totals->ranking.insert(std::make_tuple(tally.violations, tally.fines, std::string(f.flightNumber)));
+                        }
+                    const IndexFileDay* days = reinterpret_cast<const IndexFileDay*>(base + h.dayOffset);
+                    for(uint64_t i = 0; i < h.days; i++)
+                        totals->perDay[days[i].day] = DayTally{ days[i].avns, days[i].fines };
+                    const AvnTimeEntry* overdue = reinterpret_cast<const AvnTimeEntry*>(base + h.overdueOffset);
+                    totals->overdueList.insert(overdue, overdue + h.overdue);
+                    s.aggregates[airline] = totals;
+                    return true;
+                }
+
+            //the latest published version, safe from any thread and valid for as long as it is held
+            std::shared_ptr<const AvnSnapshot> snapshot() const
+                {
+                    return std::atomic_load(&published);
+                }
+    };
+
+#endif
@@ -0,0 +1,378 @@
+#ifndef AVN_JOURNAL_H
+#define AVN_JOURNAL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "avn_ledger.h"
+#include "avn_wire.h"
+
+//StripePay's append-only record of every payment it accepted, keyed by the numeric AVN ID
+//a payment is written (JOURNAL_PAID) and made durable before its confirmations go out, and marked JOURNAL_ACKED
+//once the generator echoes the AVN back as paid; a restart resends whatever was paid and never acknowledged
+//durability is group committed: a payall writes all its records with one write() and one fdatasync(), an ack
+//is never synced on its own (losing one only repeats a confirmation the generator ignores), and concurrent
+//commit() callers share whichever fdatasync() covers their records
+//an acknowledged payment is forgotten (from then on the generator's store answers for it), and the journal is
+//rewritten with only the unacknowledged ones on open and whenever JOURNAL_COMPACT_RECORDS records are dead
+
+static const uint32_t JOURNAL_MAGIC = 0x4a505641;     //"AVPJ"
+static const uint64_t JOURNAL_COMPACT_RECORDS = 65536;     //8 MiB of acknowledged payments and acks
+
+enum JournalKind : uint16_t { JOURNAL_PAID = 1, JOURNAL_ACKED = 2 };
+
+struct JournalRecord
+    {
+        uint32_t magic;
+        uint16_t kind;              //JournalKind
+        uint16_t reserved;
+        uint32_t checksum;          //over everything after it, a torn write at the tail is dropped on open
+        uint32_t batchSize;         //as in PaymentConfirmation
+        uint64_t id;                //AVN::id, the idempotency key
+        uint64_t sequence;
+        char avnID[32];
+        char airlineName[32];
+        char flightNumber[16];
+        int64_t paidTime;           //seconds since the epoch
+        int64_t amount;             //minor units
+    };
+
+static_assert(sizeof(JournalRecord) == 128, "journal record layout changed, old journals would be misread");
+
+class PaymentJournal
+    {
+        private:
+            std::string path;
+            int fd = -1;
+            std::unordered_map<uint64_t, JournalRecord> entries;      //JOURNAL_PAID records not acknowledged yet
+            uint64_t sequence = 0;
+            uint64_t written = 0;           //bytes appended
+            uint64_t synced = 0;            //bytes known to be on disk
+            uint64_t dead = 0;              //records compaction would leave out
+            pthread_mutex_t mutex;          //entries, sequence, written, dead and the append itself
+            pthread_mutex_t syncMutex;      //one fdatasync() or compaction at a time, taken before mutex
+
+            static uint32_t checksum(const JournalRecord& r)
+                {
+                    const unsigned char* p = reinterpret_cast<const unsigned char*>(&r.batchSize);
+                    const unsigned char* end = reinterpret_cast<const unsigned char*>(&r + 1);
+                    uint32_t h = 2166136261u;
+                    for(; p < end; p++)
+                        h = (h ^ *p) * 16777619u;
+                    return h;
+                }
+
+            void apply(const JournalRecord& r)
+                {
+                    if(r.kind == JOURNAL_PAID && entries.emplace(r.id, r).second)
+                        return;
+                    dead++;
+                    if(r.kind == JOURNAL_ACKED && entries.erase(r.id))
+                        dead++;         //the payment it acknowledges
+                }
+
+            bool append(std::vector<JournalRecord>& records)      //caller holds mutex, all of records or none of them
+                {
+                    if(fd < 0)
+                        {
+                            errno = EIO;        //never opened, or failed closed
+                            return false;
+                        }
+                    uint64_t start = written;
+                    for(JournalRecord& r : records)
+                        {
+                            r.magic = JOURNAL_MAGIC;
+                            r.sequence = ++sequence;
+                            r.checksum = checksum(r);
+                        }
+                    const char* p = reinterpret_cast<const char*>(records.data());
+                    size_t left = records.size() * sizeof(JournalRecord);
+                    while(left > 0)
+                        {
+                            ssize_t n = ::write(fd, p, left);
+                            if(n < 0 && errno == EINTR)
+                                continue;
+                            if(n <= 0)
+                                {
+                                    int err = errno;
+                                    if(ftruncate(fd, start) == 0)       //no part of the batch left for the next append to follow
+                                        {
+                                            written = start;
+                                            sequence -= records.size();
+                                        }
+                                    else
+                                        {
+                                            //a partial record stays at the tail and anything appended after it would be
+                                            //cut off with it on the next open, so accept no more payments
+                                            ::close(fd);
+                                            fd = -1;
+                                        }
+                                    errno = err;
+                                    return false;
+                                }
+                            p += n;
+                            left -= n;
+                            written += n;
+                        }
+                    for(const JournalRecord& r : records)
+                        apply(r);
+                    return true;
+                }
+
+            //rewrites the journal with only the unacknowledged payments, renumbered from 1, and switches to it
+            //once it is durable; on failure the old journal stays in use. Takes syncMutex and mutex itself
+            bool compact()
+                {
+                    pthread_mutex_lock(&syncMutex);
+                    pthread_mutex_lock(&mutex);
+                    bool ok = fd >= 0;
+                    std::vector<JournalRecord> live;
+                    live.reserve(entries.size());
+                    for(const auto& entry : entries)
+                        live.push_back(entry.second);
+                    std::sort(live.begin(), live.end(), [](const JournalRecord& a, const JournalRecord& b) { return a.sequence < b.sequence; });
+                    for(size_t i = 0; i < live.size(); i++)
+                        {
+                            live[i].sequence = i + 1;
+                            live[i].checksum = checksum(live[i]);
+                        }
+                    std::string temp = path + ".compact";
+                    int newFd = ok ? ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644) : -1;
+                    size_t size = live.size() * sizeof(JournalRecord);
+                    const char* p = reinterpret_cast<const char*>(live.data());
+                    for(size_t left = size; ok && newFd >= 0 && left > 0; )
+                        {
+                            ssize_t n = ::write(newFd, p, left);
+                            if(n < 0 && errno == EINTR)
+                                continue;
+                            ok = n > 0;
+                            p += ok ? n : 0;
+                            left -= ok ? n : 0;
+                        }
+                    ok = ok && newFd >= 0 && fdatasync(newFd) == 0 && rename(temp.c_str(), path.c_str()) == 0;
+                    int err = errno;
+                    if(ok)
+                        {
+                            size_t slash = path.rfind('/');
+                            std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+                            int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);     //makes the rename itself durable
+                            if(dirFd >= 0)
+                                {
+                                    fsync(dirFd);
+                                    ::close(dirFd);
+                                }
+                            ::close(fd);
+                            fd = newFd;
+                            for(const JournalRecord& r : live)
+                                entries[r.id] = r;
+                            sequence = live.size();
+                            written = synced = size;
+                            dead = 0;
+                        }
+                    else if(newFd >= 0)
+                        {
+                            ::close(newFd);
+                            unlink(temp.c_str());
+                        }
+                    pthread_mutex_unlock(&mutex);
+                    pthread_mutex_unlock(&syncMutex);
+                    errno = err;
+                    return ok;
+                }
+
+        public:
+            PaymentJournal()
+                {
+                    pthread_mutex_init(&mutex, nullptr);
+                    pthread_mutex_init(&syncMutex, nullptr);
+                }
+
+            PaymentJournal(const PaymentJournal&) = delete;
+            PaymentJournal& operator=(const PaymentJournal&) = delete;
+
+            //opens (or creates) the journal and replays it; a torn record at the tail is cut off, and acknowledged
+            //payments are compacted away
+            bool open(const std::string& journalPath)
+                {
+                    close();
+                    path = journalPath;
+                    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+                    if(fd < 0)
+                        return false;
+                    entries.clear();
+                    sequence = 0;
+                    written = 0;
+                    dead = 0;
+                    JournalRecord batch[256];
+                    bool torn = false;
+                    while(!torn)
+                        {
+                            ssize_t n = pread(fd, batch, sizeof(batch), written);
+                            if(n < 0 && errno == EINTR)
+                                continue;
+                            if(n < 0)       //a read error says nothing about the records past it, keep them all
+                                {
+                                    int err = errno;
+                                    ::close(fd);
+                                    fd = -1;
+                                    errno = err;
+                                    return false;
+                                }
+                            if(n == 0)
+                                break;
+                            size_t whole = n / sizeof(JournalRecord);
+                            torn = whole == 0;      //less than a record left at the tail, a partial one is read again next time
+                            for(size_t i = 0; i < whole && !torn; i++)
+                                {
+                                    const JournalRecord& r = batch[i];
+                                    if(r.magic != JOURNAL_MAGIC || r.checksum != checksum(r) || r.sequence != sequence + 1)
+                                        {
+                                            torn = true;
+                                            break;
+                                        }
+                                    apply(r);
+                                    sequence = r.sequence;
+                                    written += sizeof(JournalRecord);
+                                }
+                        }
+                    if(torn && ftruncate(fd, written) < 0)
+                        {
+                            int err = errno;
+                            ::close(fd);
+                            fd = -1;
+                            errno = err;
+                            return false;
+                        }
+                    synced = written;
+                    if(dead)
+                        compact();      //a failure only leaves the longer journal in use
+                    return true;
+                }
+
+            bool isOpen() const
+                {
+                    return fd >= 0;
+                }
+
+            //the idempotency check: true from when id's payment is journaled until the generator acknowledges it
+            bool contains(uint64_t id)
+                {
+                    pthread_mutex_lock(&mutex);
+                    bool found = entries.count(id) != 0;
+                    pthread_mutex_unlock(&mutex);
+                    return found;
+                }
+
+            //journals the payment of every AVN not journaled yet and makes it durable, returns false if it could not;
+            //avns is left holding only the AVNs this call journaled, an AVN already paid is dropped from it
+            bool recordPayments(std::vector<AVN>& avns, uint32_t batchSize)
+                {
+                    std::vector<JournalRecord> records;
+                    std::vector<AVN> fresh;
+                    pthread_mutex_lock(&mutex);
+                    for(const AVN& avn : avns)
+                        {
+                            if(entries.count(avn.id))
+                                continue;
+                            JournalRecord r;
+                            memset(&r, 0, sizeof(r));
+                            r.kind = JOURNAL_PAID;
+                            r.batchSize = batchSize;
+                            r.id = avn.id;
+                            memcpy(r.avnID, avn.avnID, sizeof(r.avnID));
+                            memcpy(r.airlineName, avn.airlineName, sizeof(r.airlineName));
+                            memcpy(r.flightNumber, avn.flightNumber, sizeof(r.flightNumber));
+                            r.paidTime = time(nullptr);
+                            r.amount = toMinorUnits(avn.fineAmount);
+                            records.push_back(r);
+                            fresh.push_back(avn);
+                        }
+                    bool ok = records.empty() || append(records);
+                    pthread_mutex_unlock(&mutex);
+                    avns.swap(fresh);
+                    return ok && commit();
+                }
+
+            //the generator applied id's payment, no fsync of its own
+            void acknowledge(uint64_t id)
+                {
+                    pthread_mutex_lock(&mutex);
+                    auto it = entries.find(id);
+                    if(it != entries.end())
+                        {
+                            std::vector<JournalRecord> ack(1);
+                            memset(&ack[0], 0, sizeof(JournalRecord));
+                            ack[0].kind = JOURNAL_ACKED;
+                            ack[0].id = id;
+                            memcpy(ack[0].avnID, it->second.avnID, sizeof(ack[0].avnID));
+                            append(ack);
+                        }
+                    bool due = dead >= JOURNAL_COMPACT_RECORDS;
+                    pthread_mutex_unlock(&mutex);
+                    if(due)
+                        compact();      //a failure leaves the longer journal in place, tried again on the next ack
+                }
+
+            //makes everything appended so far durable; a caller whose records went out with someone else's
+            //fdatasync() returns without one of its own
+            bool commit()
+                {
+                    pthread_mutex_lock(&mutex);
+                    uint64_t target = written;
+                    pthread_mutex_unlock(&mutex);
+                    pthread_mutex_lock(&syncMutex);
+                    bool ok = fd >= 0 || synced >= target;
+                    if(fd >= 0 && synced < target)
+                        {
+                            pthread_mutex_lock(&mutex);
+                            uint64_t upto = written;        //everything appended while the previous sync ran rides along
+                            pthread_mutex_unlock(&mutex);
+                            ok = fdatasync(fd) == 0;
+                            if(ok)
+                                synced = upto;
+                        }
+                    pthread_mutex_unlock(&syncMutex);
+                    return ok;
+                }
+
+            //payments the generator has not acknowledged, paid at or before paidBefore, in journal order
+            std::vector<JournalRecord> unacknowledged(int64_t paidBefore)
+                {
+                    std::vector<JournalRecord> pending;
+                    pthread_mutex_lock(&mutex);
+                    for(const auto& entry : entries)
+                        if(entry.second.paidTime <= paidBefore)
+                            pending.push_back(entry.second);
+                    pthread_mutex_unlock(&mutex);
+                    std::sort(pending.begin(), pending.end(), [](const JournalRecord& a, const JournalRecord& b) { return a.sequence < b.sequence; });
+                    return pending;
+                }
+
+            void close()
+                {
+                    if(fd < 0)
+                        return;
+                    commit();
+                    ::close(fd);
+                    fd = -1;
+                }
+
+            ~PaymentJournal()
+                {
+                    close();
+                    pthread_mutex_destroy(&mutex);
+                    pthread_mutex_destroy(&syncMutex);
+                }
+    };
+
+#endif
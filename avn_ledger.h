@@ -0,0 +1,284 @@
+#ifndef AVN_LEDGER_H
+#define AVN_LEDGER_H
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "avn_wire.h"
+
+//per-airline fine totals kept by the generator as AVNs are issued, paid and fall overdue, in a shared memory
+//segment the portal and StripePay map read-only, so "how much does PIA owe" is one hash probe and one copy
+//amounts are integer minor units (paisa), each entry is written under its own seqlock by the generator alone
+
+static const char* LEDGER_SEGMENT = "/aircontrolx.ledger";
+static const uint32_t LEDGER_MAGIC = 0x4c4e5641;       //"AVNL"
+static const uint32_t LEDGER_VERSION = 1;
+static const uint32_t LEDGER_SLOTS = 64;                //airlines, power of two
+static const int LEDGER_READ_ATTEMPTS = 100000;         //a sequence still odd after this many reads means the writer died mid-update
+
+inline int64_t toMinorUnits(double amount)
+    {
+        return llround(amount * 100);
+    }
+
+//"1234.56" without touching any stream's formatting state
+inline std::string formatMinorUnits(int64_t minor)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%s%lld.%02lld", minor < 0 ? "-" : "", (long long)(llabs(minor) / 100), (long long)(llabs(minor) % 100));
+        return text;
+    }
+
+struct LedgerTotals
+    {
+        int64_t issued = 0;         //AVNs ever issued to the airline
+        int64_t unpaid = 0;         //outstanding and not yet due
+        int64_t overdue = 0;        //outstanding past the due date, escalated amount
+        int64_t paid = 0;
+    };
+
+struct LedgerEntry
+    {
+        std::atomic<uint32_t> used;         //airline is valid once set
+        std::atomic<uint32_t> sequence;     //odd while the writer is mid-update
+        char airline[32];
+        std::atomic<int64_t> issued;
+        std::atomic<int64_t> unpaid;
+        std::atomic<int64_t> overdue;
+        std::atomic<int64_t> paid;
+    };
+
+struct LedgerHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slots;
+        std::atomic<uint32_t> ready;
+        char pad[48];
+    };
+
+static_assert(sizeof(LedgerHeader) == 64, "ledger header layout changed, bump LEDGER_VERSION");
+static_assert(sizeof(LedgerEntry) == 72, "ledger entry layout changed, bump LEDGER_VERSION");
+
+class AvnLedger
+    {
+        private:
+            LedgerHeader* hdr = nullptr;
+            size_t mappedSize = 0;
+
+            LedgerEntry* entries() const
+                {
+                    return reinterpret_cast<LedgerEntry*>(hdr + 1);
+                }
+
+            static size_t segmentSize()
+                {
+                    return sizeof(LedgerHeader) + LEDGER_SLOTS * sizeof(LedgerEntry);
+                }
+
+            static uint32_t hashOf(const char* airline)
+                {
+                    uint32_t h = 2166136261u;
+                    for(size_t i = 0; i < sizeof(LedgerEntry::airline) && airline[i]; i++)
+                        h = (h ^ uint8_t(airline[i])) * 16777619u;
+                    return h;
+                }
+
+            //the airline's entry, or with create the free slot it now owns; nullptr if unknown or the table is full
+            LedgerEntry* entryFor(const char* airline, bool create)
+                {
+                    LedgerEntry* e = entries();
+                    uint32_t mask = hdr->slots - 1;
+                    uint32_t i = hashOf(airline) & mask;
+                    for(uint32_t probes = 0; probes < hdr->slots; probes++, i = (i + 1) & mask)
+                        {
+                            if(!e[i].used.load(std::memory_order_acquire))
+                                {
+                                    if(!create)
+                                        return nullptr;
+                                    strncpy(e[i].airline, airline, sizeof(e[i].airline) - 1);
+                                    e[i].airline[sizeof(e[i].airline) - 1] = '\0';
+                                    e[i].used.store(1, std::memory_order_release);
+                                    return &e[i];
+                                }
+                            if(strncmp(e[i].airline, airline, sizeof(e[i].airline)) == 0)
+                                return &e[i];
+                        }
+                    return nullptr;
+                }
+
+            template<typename Change>
+            void write(const char* airline, Change change)
+                {
+                    LedgerEntry* e = hdr ? entryFor(airline, true) : nullptr;
+                    if(!e)
+                        return;
+                    uint32_t s = e->sequence.load(std::memory_order_relaxed);
+                    e->sequence.store(s + 1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release);
+                    change(*e);
+                    e->sequence.store(s + 2, std::memory_order_release);
+                }
+
+            static void add(std::atomic<int64_t>& field, int64_t delta)
+                {
+                    field.store(field.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+                }
+
+        public:
+            //generator side: creates the segment, or takes over the one a previous run left (readers keep their
+            //mapping) and zeroes it so the totals can be rebuilt from the store
+            bool create()
+                {
+                    close();
+                    int fd = shm_open(LEDGER_SEGMENT, O_RDWR | O_CREAT, 0666);
+                    if(fd < 0)
+                        return false;
+                    struct stat st;
+                    if(fstat(fd, &st) < 0 || (size_t(st.st_size) < segmentSize() && ftruncate(fd, segmentSize()) < 0))
+                        {
+                            ::close(fd);
+                            return false;
+                        }
+                    void* mem = mmap(nullptr, segmentSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                    ::close(fd);
+                    if(mem == MAP_FAILED)
+                        return false;
+                    hdr = static_cast<LedgerHeader*>(mem);
+                    mappedSize = segmentSize();
+                    if(hdr->magic != LEDGER_MAGIC || hdr->version != LEDGER_VERSION || hdr->slots != LEDGER_SLOTS)
+                        {
+                            hdr->ready.store(0, std::memory_order_relaxed);
+                            memset(static_cast<void*>(entries()), 0, LEDGER_SLOTS * sizeof(LedgerEntry));
+                            hdr->magic = LEDGER_MAGIC;
+                            hdr->version = LEDGER_VERSION;
+                            hdr->slots = LEDGER_SLOTS;
+                        }
+                    for(uint32_t i = 0; i < LEDGER_SLOTS; i++)
+                        if(entries()[i].used.load(std::memory_order_relaxed))
+                            write(entries()[i].airline, [](LedgerEntry& e)
+                                {
+                                    e.issued.store(0, std::memory_order_relaxed);
+                                    e.unpaid.store(0, std::memory_order_relaxed);
+                                    e.overdue.store(0, std::memory_order_relaxed);
+                                    e.paid.store(0, std::memory_order_relaxed);
+                                });
+                    hdr->ready.store(1, std::memory_order_release);
+                    return true;
+                }
+
+            //portal / StripePay side: maps the generator's segment read-only, false until the generator has created it
+            bool attach()
+                {
+                    close();
+                    int fd = shm_open(LEDGER_SEGMENT, O_RDONLY, 0);
+                    if(fd < 0)
+                        return false;
+                    struct stat st;
+                    if(fstat(fd, &st) < 0 || size_t(st.st_size) < segmentSize())
+                        {
+                            ::close(fd);
+                            errno = EAGAIN;
+                            return false;
+                        }
+                    void* mem = mmap(nullptr, segmentSize(), PROT_READ, MAP_SHARED, fd, 0);
+                    ::close(fd);
+                    if(mem == MAP_FAILED)
+                        return false;
+                    hdr = static_cast<LedgerHeader*>(mem);
+                    mappedSize = segmentSize();
+                    if(!hdr->ready.load(std::memory_order_acquire) || hdr->magic != LEDGER_MAGIC || hdr->version != LEDGER_VERSION)
+                        {
+                            close();
+                            errno = EAGAIN;
+                            return false;
+                        }
+                    return true;
+                }
+
+            bool isOpen() const
+                {
+                    return hdr != nullptr;
+                }
+
+            //the transitions below are the only writers, each keeps the totals consistent for one AVN event
+            void issued(const AVN& avn)
+                {
+                    write(avn.airlineName, [&](LedgerEntry& e)
+                        {
+                            add(e.issued, 1);
+                            add(strcmp(avn.paymentStatus, "paid") == 0 ? e.paid : strcmp(avn.paymentStatus, "overdue") == 0 ? e.overdue : e.unpaid,
+                                toMinorUnits(avn.fineAmount));
+                        });
+                }
+
+            void paid(const AVN& before, const AVN& after)
+                {
+                    write(after.airlineName, [&](LedgerEntry& e)
+                        {
+                            add(strcmp(before.paymentStatus, "overdue") == 0 ? e.overdue : e.unpaid, -toMinorUnits(before.fineAmount));
+                            add(e.paid, toMinorUnits(after.fineAmount));
+                        });
+                }
+
+            void overdue(const AVN& before, const AVN& after)
+                {
+                    write(after.airlineName, [&](LedgerEntry& e)
+                        {
+                            add(e.unpaid, -toMinorUnits(before.fineAmount));
+                            add(e.overdue, toMinorUnits(after.fineAmount));
+                        });
+                }
+
+            //consistent copy of one airline's totals; false with errno ENOENT if it has no AVNs yet, EAGAIN if no
+            //consistent copy could be read (the generator stopped in the middle of updating the entry)
+            bool totals(const std::string& airline, LedgerTotals& out)
+                {
+                    errno = ENOENT;
+                    if(!hdr)
+                        return false;
+                    LedgerEntry* e = entryFor(airline.c_str(), false);
+                    if(!e)
+                        return false;
+                    for(int attempt = 0; attempt < LEDGER_READ_ATTEMPTS; attempt++)
+                        {
+                            uint32_t before = e->sequence.load(std::memory_order_acquire);
+                            if(before & 1)
+                                continue;       //writer is mid-update, it finishes in a few instructions
+                            out.issued = e->issued.load(std::memory_order_relaxed);
+                            out.unpaid = e->unpaid.load(std::memory_order_relaxed);
+                            out.overdue = e->overdue.load(std::memory_order_relaxed);
+                            out.paid = e->paid.load(std::memory_order_relaxed);
+                            std::atomic_thread_fence(std::memory_order_acquire);
+                            if(e->sequence.load(std::memory_order_relaxed) == before)
+                                return true;
+                        }
+                    errno = EAGAIN;
+                    return false;
+                }
+
+            void close()
+                {
+                    if(hdr)
+                        munmap(hdr, mappedSize);
+                    hdr = nullptr;
+                    mappedSize = 0;
+                }
+
+            ~AvnLedger()
+                {
+                    close();
+                }
+    };
+
+#endif
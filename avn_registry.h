@@ -0,0 +1,213 @@
+#ifndef AVN_REGISTRY_H
+#define AVN_REGISTRY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <string>
+#include <pthread.h>
+
+#include "avn_store.h"
+
+//the generator's AVNs split over hash-striped shards, each its own AvnStore (base.NN.log + base.NN.idx) behind
+//its own mutex, so ingest and confirmations running on different threads only contend when they hit the
+//same shard; every call holds one shard lock for a lookup or an append and never for any I/O on a link
+
+static const size_t REGISTRY_SHARDS = 16;           //power of two
+static const size_t REGISTRY_MAX_SHARDS = 256;
+
+class AvnRegistry
+    {
+        private:
+            struct Shard
+                {
+                    pthread_mutex_t mutex;
+                    AvnStore store;
+                };
+
+            Shard shards[REGISTRY_MAX_SHARDS];
+            size_t shardCount = 0;
+            int shardShift = 64;
+
+            //top bits of the mixed key, the store's own slot choice uses the low ones
+            Shard& shardOf(uint64_t id)
+                {
+                    return shards[shardCount > 1 ? AvnStore::mix(id) >> shardShift : 0];
+                }
+
+        public:
+            AvnRegistry()
+                {
+                    for(Shard& s : shards)
+                        pthread_mutex_init(&s.mutex, nullptr);
+                }
+
+            AvnRegistry(const AvnRegistry&) = delete;
+            AvnRegistry& operator=(const AvnRegistry&) = delete;
+
+            //opens (or recovers) every shard, count must be a power of two and must not change between runs
+            bool open(const std::string& base, size_t count = REGISTRY_SHARDS)
+                {
+                    close();
+                    if(count == 0 || count > REGISTRY_MAX_SHARDS || (count & (count - 1)))
+                        {
+                            errno = EINVAL;
+                            return false;
+                        }
+                    shardCount = count;
+                    shardShift = 64;
+                    for(size_t c = count; c > 1; c >>= 1)
+                        shardShift--;
+                    for(size_t i = 0; i < count; i++)
+                        {
+                            char suffix[8];
+                            snprintf(suffix, sizeof(suffix), ".%02zx", i);
+                            if(!shards[i].store.open(base + suffix))
+                                {
+                                    int err = errno;
+                                    close();
+                                    errno = err;
+                                    return false;
+                                }
+                        }
+                    return true;
+                }
+
+            bool put(const AVN& avn)
+                {
+                    Shard& s = shardOf(avn.id);
+                    pthread_mutex_lock(&s.mutex);
+                    bool ok = s.store.put(avn);
+                    pthread_mutex_unlock(&s.mutex);
+                    return ok;
+                }
+
+            //copies the latest state out, the store's own pointer is only valid under the shard lock
+            bool find(uint64_t id, AVN& out)
+                {
+                    Shard& s = shardOf(id);
+                    pthread_mutex_lock(&s.mutex);
+                    const AVN* avn = s.store.find(id);
+                    if(avn)
+                        out = *avn;
+                    pthread_mutex_unlock(&s.mutex);
+                    return avn != nullptr;
+                }
+
+            bool setStatus(uint64_t id, const char* status, AVN& updated)
+                {
+                    Shard& s = shardOf(id);
+                    pthread_mutex_lock(&s.mutex);
+                    bool ok = s.store.setStatus(id, status, updated);
+                    pthread_mutex_unlock(&s.mutex);
+                    return ok;
+                }
+
+            //mutate(AVN&) runs under the shard lock, see AvnStore::update()
+            template<typename Mutate>
+            bool update(uint64_t id, StoreEvent event, Mutate mutate, AVN& updated)
+                {
+                    Shard& s = shardOf(id);
+                    pthread_mutex_lock(&s.mutex);
+                    bool ok = s.store.update(id, event, mutate, updated);
+                    pthread_mutex_unlock(&s.mutex);
+                    return ok;
+                }
+
+            //fn(const AVN&) runs under one shard lock at a time and must not call back into the registry
+            template<typename Fn>
+            void forEach(Fn fn)
+                {
+                    for(size_t i = 0; i < shardCount; i++)
+                        {
+                            pthread_mutex_lock(&shards[i].mutex);
+                            shards[i].store.forEach(fn);
+                            pthread_mutex_unlock(&shards[i].mutex);
+                        }
+                }
+
+            //fn(const AVN&) under one shard lock at a time, see AvnStore::forEachSince()
+            template<typename Fn>
+            void forEachSince(uint64_t revision, Fn fn)
+                {
+                    for(size_t i = 0; i < shardCount; i++)
+                        {
+                            pthread_mutex_lock(&shards[i].mutex);
+                            shards[i].store.forEachSince(revision, fn);
+                            pthread_mutex_unlock(&shards[i].mutex);
+                        }
+                }
+
+            size_t size()
+                {
+                    size_t n = 0;
+                    for(size_t i = 0; i < shardCount; i++)
+                        {
+                            pthread_mutex_lock(&shards[i].mutex);
+                            n += shards[i].store.size();
+                            pthread_mutex_unlock(&shards[i].mutex);
+                        }
+                    return n;
+                }
+
+            uint64_t logRecords()
+                {
+                    uint64_t n = 0;
+                    for(size_t i = 0; i < shardCount; i++)
+                        {
+                            pthread_mutex_lock(&shards[i].mutex);
+                            n += shards[i].store.logRecords();
+                            pthread_mutex_unlock(&shards[i].mutex);
+                        }
+                    return n;
+                }
+
+            size_t count() const
+                {
+                    return shardCount;
+                }
+
+            //read-only pass over every shard's files without opening the registry, see AvnStore::scan()
+            template<typename Fn>
+            static bool scan(const std::string& base, Fn fn, size_t count = REGISTRY_SHARDS)
+                {
+                    for(size_t i = 0; i < count; i++)
+                        {
+                            char suffix[8];
+                            snprintf(suffix, sizeof(suffix), ".%02zx", i);
+                            if(!AvnStore::scan(base + suffix, fn))
+                                return false;
+                        }
+                    return true;
+                }
+
+            void sync(bool wait = false)
+                {
+                    for(size_t i = 0; i < shardCount; i++)
+                        {
+                            pthread_mutex_lock(&shards[i].mutex);
+                            shards[i].store.sync(wait);
+                            pthread_mutex_unlock(&shards[i].mutex);
+                        }
+                }
+
+            void close()
+                {
+                    for(size_t i = 0; i < shardCount; i++)
+                        {
+                            pthread_mutex_lock(&shards[i].mutex);
+                            shards[i].store.close();
+                            pthread_mutex_unlock(&shards[i].mutex);
+                        }
+                    shardCount = 0;
+                }
+
+            ~AvnRegistry()
+                {
+                    close();
+                    for(Shard& s : shards)
+                        pthread_mutex_destroy(&s.mutex);
+                }
+    };
+
+#endif
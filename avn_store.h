@@ -0,0 +1,455 @@
+#ifndef AVN_STORE_H
+#define AVN_STORE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "avn_wire.h"
+
+//durable AVN registry for the generator: an append-only log of AVN events (issued, payment status changed, overdue)
+//and an open-addressing hash index from the numeric AVN ID to the log record holding that AVN's latest state
+//both files are mmap'd, so a lookup is a hash plus one probe sequence, growth is a remap rather than heap
+//churn, and a restart recovers by mapping the files again instead of waiting for the pipes to replay
+
+static const uint32_t STORE_LOG_MAGIC = 0x474c5641;    //"AVLG"
+static const uint32_t STORE_INDEX_MAGIC = 0x58495641;  //"AVIX"
+static const uint32_t STORE_VERSION = 5;            //1 keyed the index by a hash of the printable ID, 2 to 4 held older AVN layouts
+
+enum StoreEvent : uint32_t { STORE_ISSUED = 1, STORE_STATUS_CHANGED = 2, STORE_OVERDUE = 3 };
+
+struct StoreLogHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t reserved;
+        std::atomic<uint64_t> records;      //committed records, bumped only after the record bytes are in place
+        uint64_t capacity;                  //records the file currently has room for
+        char pad[32];
+    };
+
+struct StoreRecord                          //one log entry, always the whole AVN as of that event
+    {
+        uint32_t event;
+        uint32_t checksum;                  //over avn, a torn write at the tail is detected on recovery
+        uint64_t sequence;
+        AVN avn;
+    };
+
+struct StoreIndexHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t capacity;                  //slots, power of two
+        uint64_t count;                     //distinct AVNs
+        uint64_t indexedRecords;            //log records already reflected in the slots, recovery resumes here
+        char pad[32];
+    };
+
+struct StoreSlot
+    {
+        uint64_t key;                       //AVN::id, 0 = empty
+        uint64_t record;                    //log record number of the latest state
+    };
+
+static_assert(sizeof(StoreLogHeader) == 64 && sizeof(StoreIndexHeader) == 64, "store header layout changed, bump STORE_VERSION");
+static_assert(sizeof(StoreRecord) == 208, "store record layout changed, bump STORE_VERSION");
+
+class AvnStore
+    {
+        private:
+            std::string logPath, indexPath;
+            int logFd = -1, indexFd = -1;
+            StoreLogHeader* log = nullptr;
+            StoreIndexHeader* index = nullptr;
+            size_t logMapped = 0, indexMapped = 0;
+
+            static const uint64_t INITIAL_LOG_RECORDS = 4096;
+            static const uint64_t INITIAL_INDEX_SLOTS = 8192;
+
+            StoreRecord* records() const
+                {
+                    return reinterpret_cast<StoreRecord*>(log + 1);
+                }
+
+            StoreSlot* slots() const
+                {
+                    return reinterpret_cast<StoreSlot*>(index + 1);
+                }
+
+            static uint32_t checksum(const AVN& avn)
+                {
+                    const unsigned char* p = reinterpret_cast<const unsigned char*>(&avn) + sizeof(WireHeader);     //header holds a send timestamp
+                    uint32_t h = 2166136261u;
+                    for(size_t i = sizeof(WireHeader); i < sizeof(AVN); i++, p++)
+                        h = (h ^ *p) * 16777619u;
+                    return h;
+                }
+
+            static void* mapFile(int fd, size_t size)
+                {
+                    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                    return p == MAP_FAILED ? nullptr : p;
+                }
+
+            bool growLog()
+                {
+                    uint64_t capacity = log->capacity * 2;
+                    size_t size = sizeof(StoreLogHeader) + capacity * sizeof(StoreRecord);
+                    if(ftruncate(logFd, size) < 0)
+                        return false;
+                    void* p = mremap(log, logMapped, size, MREMAP_MAYMOVE);
+                    if(p == MAP_FAILED)
+                        return false;
+                    log = static_cast<StoreLogHeader*>(p);
+                    logMapped = size;
+                    log->capacity = capacity;
+                    return true;
+                }
+
+            //slot for key, either the one holding it or the empty one where it belongs
+            StoreSlot* probe(uint64_t key) const
+                {
+                    uint64_t mask = index->capacity - 1;
+                    StoreSlot* s = slots();
+                    for(uint64_t i = mix(key) & mask;; i = (i + 1) & mask)
+                        if(s[i].key == key || s[i].key == 0)
+                            return &s[i];
+                }
+
+            //builds a fresh index file with capacity slots from the current one (or from scratch) and swaps it in
+            bool rebuildIndex(uint64_t capacity, bool keepSlots)
+                {
+                    std::string tmpPath = indexPath + ".tmp";
+                    int fd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                    size_t size = sizeof(StoreIndexHeader) + capacity * sizeof(StoreSlot);
+                    if(fd < 0 || ftruncate(fd, size) < 0)
+                        {
+                            if(fd >= 0)
+                                ::close(fd);
+                            return false;
+                        }
+                    StoreIndexHeader* fresh = static_cast<StoreIndexHeader*>(mapFile(fd, size));
+                    if(!fresh)
+                        {
+                            ::close(fd);
+                            return false;
+                        }
+                    fresh->magic = STORE_INDEX_MAGIC;
+                    fresh->version = STORE_VERSION;
+                    fresh->capacity = capacity;
+
+                    StoreIndexHeader* old = index;
+                    size_t oldMapped = indexMapped;
+                    int oldFd = indexFd;
+                    index = fresh;
+                    indexMapped = size;
+                    indexFd = fd;
+                    if(old && keepSlots)
+                        {
+                            StoreSlot* s = reinterpret_cast<StoreSlot*>(old + 1);
+                            for(uint64_t i = 0; i < old->capacity; i++)
+                                if(s[i].key)
+                                    *probe(s[i].key) = s[i];
+                            fresh->count = old->count;
+                            fresh->indexedRecords = old->indexedRecords;
+                        }
+                    if(old)
+                        munmap(old, oldMapped);
+                    if(oldFd >= 0)
+                        ::close(oldFd);
+                    return rename(tmpPath.c_str(), indexPath.c_str()) == 0;
+                }
+
+            bool indexRecord(uint64_t n)
+                {
+                    if((index->count + 1) * 10 > index->capacity * 7 && !rebuildIndex(index->capacity * 2, true))      //keep load under 70%
+                        return false;
+                    const AVN& avn = records()[n].avn;
+                    StoreSlot* slot = probe(avn.id);
+                    if(slot->key == 0)
+                        {
+                            slot->key = avn.id;
+                            index->count++;
+                        }
+                    slot->record = n;
+                    index->indexedRecords = n + 1;
+                    return true;
+                }
+
+            bool openLog()
+                {
+                    logFd = ::open(logPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+                    struct stat st;
+                    if(logFd < 0 || fstat(logFd, &st) < 0)
+                        return false;
+                    bool fresh = st.st_size < off_t(sizeof(StoreLogHeader));
+                    size_t size = fresh ? sizeof(StoreLogHeader) + INITIAL_LOG_RECORDS * sizeof(StoreRecord) : st.st_size;
+                    if(fresh && ftruncate(logFd, size) < 0)
+                        return false;
+                    log = static_cast<StoreLogHeader*>(mapFile(logFd, size));
+                    if(!log)
+                        return false;
+                    logMapped = size;
+                    if(fresh)
+                        {
+                            log->version = STORE_VERSION;
+                            log->recordSize = sizeof(StoreRecord);
+                            log->capacity = INITIAL_LOG_RECORDS;
+                            log->records.store(0);
+                            log->magic = STORE_LOG_MAGIC;
+                        }
+                    if(log->magic != STORE_LOG_MAGIC || log->version != STORE_VERSION || log->recordSize != sizeof(StoreRecord) ||
+                       sizeof(StoreLogHeader) + log->capacity * sizeof(StoreRecord) > logMapped)
+                        {
+                            errno = EPROTO;
+                            return false;
+                        }
+                    //a record whose bytes never fully landed ends the log
+                    uint64_t n = log->records.load(std::memory_order_acquire);
+                    while(n > 0 && records()[n - 1].checksum != checksum(records()[n - 1].avn))
+                        n--;
+                    log->records.store(n, std::memory_order_release);
+                    return true;
+                }
+
+            bool openIndex()
+                {
+                    indexFd = ::open(indexPath.c_str(), O_RDWR | O_CLOEXEC);
+                    struct stat st;
+                    if(indexFd >= 0 && fstat(indexFd, &st) == 0 && st.st_size >= off_t(sizeof(StoreIndexHeader)))
+                        {
+                            index = static_cast<StoreIndexHeader*>(mapFile(indexFd, st.st_size));
+                            indexMapped = index ? st.st_size : 0;
+                        }
+                    uint64_t committed = log->records.load(std::memory_order_acquire);
+                    bool usable = index && index->magic == STORE_INDEX_MAGIC && index->version == STORE_VERSION &&
+                                  sizeof(StoreIndexHeader) + index->capacity * sizeof(StoreSlot) <= indexMapped &&
+                                  index->indexedRecords <= committed;
+                    if(!usable)     //missing, foreign or ahead of a truncated log: rebuild from the log
+                        {
+                            uint64_t capacity = INITIAL_INDEX_SLOTS;
+                            while(capacity * 7 < committed * 10)
+                                capacity <<= 1;
+                            if(!rebuildIndex(capacity, false))
+                                return false;
+                        }
+                    for(uint64_t n = index->indexedRecords; n < committed; n++)        //catch up on what was appended after the last index write
+                        if(!indexRecord(n))
+                            return false;
+                    return true;
+                }
+
+            bool append(StoreEvent event, const AVN& avn)
+                {
+                    uint64_t n = log->records.load(std::memory_order_relaxed);
+                    if(n == log->capacity && !growLog())
+                        return false;
+                    StoreRecord& r = records()[n];
+                    r.event = event;
+                    r.sequence = n;
+                    r.avn = avn;
+                    r.checksum = checksum(avn);
+                    log->records.store(n + 1, std::memory_order_release);
+                    return indexRecord(n);
+                }
+
+        public:
+            //IDs of one millisecond differ only in their low bits, mixing spreads them over the table
+            static uint64_t mix(uint64_t key)
+                {
+                    key ^= key >> 33;
+                    key *= 0xff51afd7ed558ccdull;
+                    key ^= key >> 33;
+                    return key;
+                }
+
+            //maps base.log and base.idx, creating them on first use and recovering whatever a previous run left
+            bool open(const std::string& base)
+                {
+                    close();
+                    logPath = base + ".log";
+                    indexPath = base + ".idx";
+                    if(openLog() && openIndex())
+                        return true;
+                    int err = errno;
+                    close();
+                    errno = err;
+                    return false;
+                }
+
+            bool isOpen() const
+                {
+                    return log != nullptr;
+                }
+
+            //latest state of the AVN, nullptr if unknown; valid until the next put() or update()
+            const AVN* find(uint64_t id) const
+                {
+                    if(id == 0)
+                        return nullptr;
+                    const StoreSlot* slot = probe(id);
+                    return slot->key ? &records()[slot->record].avn : nullptr;
+                }
+
+            bool put(const AVN& avn)
+                {
+                    if(avn.id == 0)
+                        {
+                            errno = EINVAL;
+                            return false;
+                        }
+                    return append(STORE_ISSUED, avn);
+                }
+
+            //records a payment status change, copies the updated AVN into updated; false if id is unknown
+            bool setStatus(uint64_t id, const char* status, AVN& updated)
+                {
+                    return update(id, STORE_STATUS_CHANGED, [&](AVN& avn)
+                        {
+                            wireSetString(avn.paymentStatus, status);
+                            return true;
+                        }, updated);
+                }
+
+            //logs mutate(AVN&) applied to the latest state as event and copies the result into updated;
+            //false if id is unknown or mutate returned false (nothing is logged then)
+            template<typename Mutate>
+            bool update(uint64_t id, StoreEvent event, Mutate mutate, AVN& updated)
+                {
+                    const AVN* current = find(id);
+                    if(!current)
+                        return false;
+                    updated = *current;
+                    if(!mutate(updated))
+                        return false;
+                    return append(event, updated);
+                }
+
+            //calls fn(const AVN&) with the latest state of every AVN, in no particular order
+            template<typename Fn>
+            void forEach(Fn fn) const
+                {
+                    StoreSlot* s = slots();
+                    for(uint64_t i = 0; i < index->capacity; i++)
+                        if(s[i].key)
+                            fn(records()[s[i].record].avn);
+                }
+
+            //calls fn(const AVN&) with the latest state of every AVN changed after revision; the generator hands out
+            //revisions in increasing order, so those are the log's tail and the walk stops at the first older record
+            template<typename Fn>
+            void forEachSince(uint64_t revision, Fn fn) const
+                {
+                    if(revision == 0)
+                        {
+                            forEach(fn);
+                            return;
+                        }
+                    for(uint64_t n = log->records.load(std::memory_order_acquire); n > 0 && records()[n - 1].avn.revision > revision; n--)
+                        {
+                            const AVN& avn = records()[n - 1].avn;
+                            if(probe(avn.id)->record == n - 1)      //a later record of the same AVN was already visited
+                                fn(avn);
+                        }
+                }
+
+            //read-only pass over the latest state of every AVN in base.log / base.idx, safe while the generator has them
+            //open; reads through a bounded buffer with pread() instead of mapping the files, so a scan of millions of
+            //AVNs keeps a flat RSS. AVNs logged after the index was last written are not seen
+            template<typename Fn>
+            static bool scan(const std::string& base, Fn fn)
+                {
+                    errno = 0;
+                    int logFd = ::open((base + ".log").c_str(), O_RDONLY | O_CLOEXEC);
+                    int idxFd = ::open((base + ".idx").c_str(), O_RDONLY | O_CLOEXEC);
+                    alignas(StoreLogHeader) char logBuf[sizeof(StoreLogHeader)];
+                    StoreIndexHeader idx;
+                    const StoreLogHeader* lh = reinterpret_cast<const StoreLogHeader*>(logBuf);
+                    bool ok = logFd >= 0 && idxFd >= 0 &&
+                              pread(logFd, logBuf, sizeof(logBuf), 0) == ssize_t(sizeof(logBuf)) &&
+                              pread(idxFd, &idx, sizeof(idx), 0) == ssize_t(sizeof(idx)) &&
+                              lh->magic == STORE_LOG_MAGIC && lh->version == STORE_VERSION && lh->recordSize == sizeof(StoreRecord) &&
+                              idx.magic == STORE_INDEX_MAGIC && idx.version == STORE_VERSION;
+                    if(!ok && errno == 0)
+                        errno = EPROTO;
+                    uint64_t committed = ok ? lh->records.load(std::memory_order_acquire) : 0;
+                    std::vector<StoreSlot> block(4096);
+                    StoreRecord record;
+                    for(uint64_t first = 0; ok && first < idx.capacity; first += block.size())
+                        {
+                            size_t want = std::min<uint64_t>(block.size(), idx.capacity - first);
+                            ssize_t got = pread(idxFd, block.data(), want * sizeof(StoreSlot), sizeof(StoreIndexHeader) + first * sizeof(StoreSlot));
+                            if(got != ssize_t(want * sizeof(StoreSlot)))
+                                {
+                                    ok = false;
+                                    break;
+                                }
+                            for(size_t i = 0; i < want; i++)
+                                {
+                                    if(!block[i].key || block[i].record >= committed)
+                                        continue;
+                                    off_t at = sizeof(StoreLogHeader) + block[i].record * sizeof(StoreRecord);
+                                    if(pread(logFd, &record, sizeof(record), at) == ssize_t(sizeof(record)) && record.checksum == checksum(record.avn))
+                                        fn(record.avn);
+                                }
+                        }
+                    int err = errno;
+                    if(logFd >= 0)
+                        ::close(logFd);
+                    if(idxFd >= 0)
+                        ::close(idxFd);
+                    errno = err;
+                    return ok;
+                }
+
+            size_t size() const
+                {
+                    return index ? index->count : 0;
+                }
+
+            uint64_t logRecords() const
+                {
+                    return log ? log->records.load(std::memory_order_acquire) : 0;
+                }
+
+            void sync(bool wait = false)            //schedules (or waits for) write-back of both maps
+                {
+                    if(log)
+                        msync(log, logMapped, wait ? MS_SYNC : MS_ASYNC);
+                    if(index)
+                        msync(index, indexMapped, wait ? MS_SYNC : MS_ASYNC);
+                }
+
+            void close()
+                {
+                    if(log)
+                        munmap(log, logMapped);
+                    if(index)
+                        munmap(index, indexMapped);
+                    if(logFd >= 0)
+                        ::close(logFd);
+                    if(indexFd >= 0)
+                        ::close(indexFd);
+                    log = nullptr;
+                    index = nullptr;
+                    logFd = indexFd = -1;
+                    logMapped = indexMapped = 0;
+                }
+
+            ~AvnStore()
+                {
+                    close();
+                }
+    };
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef AVN_WIRE_H
+#define AVN_WIRE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+//the one definition of every record that travels between atc, the AVN generator, the airline portal and StripePay
+//each record is a fixed-width, naturally aligned layout that starts with a WireHeader, so senders hand the struct
+//itself to writev() and receivers read fields straight out of the receive buffer through wireView()
+
+static const uint32_t WIRE_MAGIC = 0x4e564158;     //"XAVN"
+static const uint16_t WIRE_VERSION = 2;            //1 was the unversioned field-by-field memcpy format
+
+enum WireKind : uint16_t { WIRE_AVN = 1, WIRE_PAYMENT_CONFIRMATION = 2, WIRE_VIOLATION_CLEARED = 3, WIRE_SUBSCRIBE = 4 };
+
+enum FlightType : int32_t { COMMERCIAL, CARGO, EMERGENCY };
+
+enum ViolationRule : uint16_t { RULE_NONE = 0, RULE_SPEED = 1, RULE_AIRSPACE = 2 };
+
+struct WireHeader
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t kind;
+        uint32_t size;              //whole record including this header
+        uint32_t reserved;
+        uint64_t sentAtNs;          //CLOCK_MONOTONIC when the sender queued it, for end-to-end latency
+    };
+
+struct AVN
+    {
+        static const WireKind KIND = WIRE_AVN;
+
+        WireHeader header;
+        uint64_t id;                //AvnIdGenerator value, the key in every index; avnID is its printable form
+        char avnID[32];
+        char airlineName[32];
+        char flightNumber[16];
+        FlightType type;
+        float speedRecorded;
+        float permissibleSpeed;
+        uint16_t rule;              //ViolationRule
+        uint16_t phase;             //flight phase the rule was broken in, atc's Status
+        int64_t issuanceTime;       //seconds since the epoch
+        double fineAmount;          //for all violationCount violations
+        char paymentStatus[16];
+        int64_t dueDate;            //seconds since the epoch
+        uint32_t violationCount;    //violations of this rule by this aircraft merged into the one AVN
+        float maxExcess;            //worst overshoot among them, km/h for RULE_SPEED and metres for RULE_AIRSPACE
+        int64_t paidTime;           //seconds since the epoch when the payment was applied, 0 until then
+        uint64_t revision;          //generator-wide sequence number of the change that produced this state, 0 before the generator stores it
+    };
+
+struct PaymentConfirmation          //StripePay -> generator and portal
+    {
+        static const WireKind KIND = WIRE_PAYMENT_CONFIRMATION;
+
+        WireHeader header;
+        uint64_t id;
+        char avnID[32];
+        char flightNumber[16];
+        uint8_t paymentSuccessful;
+        uint8_t forwardRequest;     //not a payment: StripePay (re)started and wants every outstanding AVN forwarded again
+        uint8_t reserved[2];
+        uint32_t batchSize;         //confirmations StripePay sent together for one payall, 0 for a single payment
+    };
+
+struct ViolationClearedNotification     //generator -> atc once an AVN is paid
+    {
+        static const WireKind KIND = WIRE_VIOLATION_CLEARED;
+
+        WireHeader header;
+        uint64_t id;
+        char avnID[32];
+        char flightNumber[16];
+    };
+
+struct SubscribeRequest             //portal -> generator hub, (re)selects the airline whose AVNs it receives
+    {
+        static const WireKind KIND = WIRE_SUBSCRIBE;
+
+        WireHeader header;
+        char airlineName[32];
+        uint64_t sinceRevision;     //the portal already holds every change up to this revision, only later ones are replayed
+    };
+
+//layouts are shared by separately built binaries, any drift has to be a compile error rather than garbage on the wire
+static_assert(sizeof(WireHeader) == 24, "WireHeader layout changed");
+static_assert(sizeof(AVN) == 192, "AVN wire layout changed, bump WIRE_VERSION");
+static_assert(offsetof(AVN, issuanceTime) == 128 && offsetof(AVN, dueDate) == 160, "AVN wire layout changed, bump WIRE_VERSION");
+static_assert(sizeof(PaymentConfirmation) == 88, "PaymentConfirmation wire layout changed, bump WIRE_VERSION");
+static_assert(sizeof(ViolationClearedNotification) == 80, "ViolationClearedNotification wire layout changed, bump WIRE_VERSION");
+static_assert(sizeof(SubscribeRequest) == 64, "SubscribeRequest wire layout changed, bump WIRE_VERSION");
+static_assert(sizeof(AVN) % 8 == 0 && sizeof(PaymentConfirmation) % 8 == 0 && sizeof(ViolationClearedNotification) % 8 == 0,
+              "records must keep the next one in a receive buffer 8-byte aligned");
+
+inline const char* violationRuleToStr(uint16_t rule)
+    {
+        return rule == RULE_SPEED ? "speed" : rule == RULE_AIRSPACE ? "airspace" : "unspecified";
+    }
+
+inline uint64_t wireNowNs()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+//zeroes a record and fills its header, call before setting any field
+template<typename Record>
+inline void wireInit(Record& r)
+    {
+        memset(&r, 0, sizeof(r));
+        r.header.magic = WIRE_MAGIC;
+        r.header.version = WIRE_VERSION;
+        r.header.kind = Record::KIND;
+        r.header.size = sizeof(Record);
+    }
+
+//refreshes the send timestamp, call right before the record goes out
+template<typename Record>
+inline void wireStamp(Record& r)
+    {
+        r.header.sentAtNs = wireNowNs();
+    }
+
+//read-only view over a received record without copying it out, nullptr if it is not a current Record
+template<typename Record>
+inline const Record* wireView(const char* record)
+    {
+        const WireHeader* h = reinterpret_cast<const WireHeader*>(record);
+        if(h->magic != WIRE_MAGIC || h->version != WIRE_VERSION || h->kind != Record::KIND || h->size != sizeof(Record))
+            return nullptr;
+        return reinterpret_cast<const Record*>(record);
+    }
+
+//bounded copy into one of the fixed char fields, always NUL terminated
+template<size_t N>
+inline void wireSetString(char (&field)[N], const std::string& value)
+    {
+        strncpy(field, value.c_str(), N - 1);
+        field[N - 1] = '\0';
+    }
+
+#endif
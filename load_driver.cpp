@@ -0,0 +1,221 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avn_channel.h"
+#include "avn_driver.h"
+#include "avn_id.h"
+#include "avn_wire.h"
+
+using namespace std;
+
+//stands in for atc: issues AVNs into atc_to_avn.fifo at a fixed rate and times each one until its
+//ViolationClearedNotification comes back on avn_to_atc.fifo, the whole ATC -> AVN -> StripePay -> AVN -> ATC path
+//run it against the generator, StripePay and (optionally) the portal in driver mode instead of the real atc, e.g.
+//  AIRCONTROLX_DRIVER=driver.conf ./supervisor --skip atc   then   AIRCONTROLX_DRIVER=driver.conf ./load_driver 100000 5000
+//AVNs are spread over the driver config's login airlines (PIA without one), so StripePay pays every one of them
+//build: g++ -O2 -std=c++17 load_driver.cpp -o load_driver -pthread -lrt
+//usage: ./load_driver [avns] [avnsPerSecond] [latency.csv]
+
+static const int OPEN_ATTEMPTS = 20;
+static const int READY_TIMEOUT_SEC = 60;        //the generator signals ready only once StripePay has opened its link
+static const int DRAIN_TIMEOUT_SEC = 30;        //gives up on clearances that have not come back this long after the last one
+
+struct LoadAvn
+    {
+        uint64_t id;
+        uint32_t airline;           //index into the airline list
+        uint64_t issuedNs;
+        uint64_t clearedNs;         //0 until cleared
+    };
+
+static double percentileUs(const vector<uint64_t>& sorted, double p)
+    {
+        return sorted.empty() ? 0 : sorted[min(sorted.size() - 1, size_t(sorted.size() * p))] / 1e3;
+    }
+
+int main(int argc, char* argv[])
+    {
+        size_t avns = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+        double rate = argc > 2 ? atof(argv[2]) : 1000;
+        const char* csvPath = argc > 3 ? argv[3] : "load_latency.csv";
+        if(avns == 0 || rate <= 0)
+            {
+                cout << "usage: " << argv[0] << " [avns] [avnsPerSecond] [latency.csv]\n";
+                return 1;
+            }
+
+        vector<string> airlines;
+        if(const char* path = driverConfigPath())
+            {
+                DriverConfig config;
+                string error;
+                if(!loadDriverConfig(path, config, error))
+                    {
+                        cout << "[ERROR] Invalid driver config " << error << endl;
+                        return 1;
+                    }
+                for(const DriverLogin& login : config.logins)
+                    airlines.push_back(login.airline);
+            }
+        if(airlines.empty())
+            airlines.push_back("PIA");
+
+        if((mkfifo("atc_to_avn.fifo", 0666) == -1 && errno != EEXIST) || (mkfifo("avn_to_atc.fifo", 0666) == -1 && errno != EEXIST) ||
+           (mkfifo("avn_ctrl.fifo", 0666) == -1 && errno != EEXIST))
+            {
+                cout << "[ERROR] Failed to create the atc links: " << strerror(errno) << endl;
+                return 1;
+            }
+        int ctrlFd = openLink("avn_ctrl.fifo", O_RDONLY | O_NONBLOCK);     //the generator's readiness signal, as atc waits for it
+        AvnChannel out, in;
+        for(int attempt = 1; attempt <= OPEN_ATTEMPTS && !in.isOpen(); attempt++)
+            if(!in.openReader("avn_to_atc.fifo", sizeof(ViolationClearedNotification)))
+                usleep(500000);
+        for(int attempt = 1; attempt <= OPEN_ATTEMPTS && !out.isOpen(); attempt++)
+            if(!out.openWriter("atc_to_avn.fifo", sizeof(AVN)))
+                usleep(500000);     //the generator is not reading yet
+        if(ctrlFd < 0 || !in.isOpen() || !out.isOpen())
+            {
+                cout << "[ERROR] Failed to open the atc links (is the AVN Generator running?): " << strerror(errno) << endl;
+                return 1;
+            }
+        char ready[16];
+        ssize_t got = 0;
+        for(time_t waitStart = time(nullptr); got <= 0 && time(nullptr) - waitStart < READY_TIMEOUT_SEC; )
+            {
+                pollfd ctrl = { ctrlFd, POLLIN, 0 };
+                poll(&ctrl, 1, 500);
+                got = read(ctrlFd, ready, sizeof(ready));
+                if(got == 0 && (ctrl.revents & POLLHUP))
+                    usleep(50000);
+            }
+        close(ctrlFd);
+        if(got <= 0)
+            {
+                cout << "[ERROR] No readiness signal from the AVN Generator on avn_ctrl.fifo\n";
+                return 1;
+            }
+
+        cout << "===== Load Driver: " << avns << " AVNs at " << rate << "/s over " << airlines.size() << " airline(s) =====\n" << flush;
+
+        AvnIdGenerator ids(avnNodeFromEnv());
+        vector<LoadAvn> issued;
+        issued.reserve(avns);
+        unordered_map<uint64_t, size_t> byId;
+        byId.reserve(avns * 2);
+        vector<AVN> batch;
+        size_t cleared = 0, unknown = 0;
+        uint64_t start = wireNowNs(), lastProgress = start;
+        time_t lastReport = time(nullptr);
+
+        while(cleared < avns)
+            {
+                uint64_t now = wireNowNs();
+                size_t owed = min(avns, size_t((now - start) / 1e9 * rate) + 1);     //AVNs the rate allows by now
+                while(issued.size() + batch.size() < owed)
+                    {
+                        size_t n = issued.size() + batch.size();
+                        AVN avn;
+                        wireInit(avn);
+                        avn.id = ids.next();
+                        avnIdToStr(avn.id, avn.avnID);
+                        wireSetString(avn.airlineName, airlines[n % airlines.size()]);
+                        snprintf(avn.flightNumber, sizeof(avn.flightNumber), "LD-%u", unsigned(n));
+                        avn.type = COMMERCIAL;
+                        avn.speedRecorded = 700;
+                        avn.permissibleSpeed = 600;
+                        avn.rule = RULE_SPEED;
+                        avn.violationCount = 1;
+                        avn.maxExcess = 100;
+                        avn.issuanceTime = time(nullptr);
+                        avn.fineAmount = 500000 * 1.15;
+                        wireSetString(avn.paymentStatus, "unpaid");
+                        avn.dueDate = avn.issuanceTime + 3 * 24 * 3600;
+                        batch.push_back(avn);
+                    }
+                if(!batch.empty())
+                    {
+                        ssize_t sent = out.sendRecords(batch);
+                        now = wireNowNs();
+                        for(ssize_t i = 0; i < sent; i++)
+                            {
+                                byId[batch[i].id] = issued.size();
+                                issued.push_back({ batch[i].id, uint32_t(issued.size() % airlines.size()), now, 0 });
+                            }
+                        if(sent > 0)
+                            batch.erase(batch.begin(), batch.begin() + sent);
+                    }
+                if(out.txPending())
+                    out.flushPending();
+
+                ssize_t n = in.drain([&](const char* record)
+                    {
+                        const ViolationClearedNotification* notification = wireView<ViolationClearedNotification>(record);
+                        auto it = notification ? byId.find(notification->id) : byId.end();
+                        if(it == byId.end() || issued[it->second].clearedNs)
+                            {
+                                unknown++;      //malformed, not ours or a repeat
+                                return;
+                            }
+                        issued[it->second].clearedNs = wireNowNs();
+                        cleared++;
+                        lastProgress = wireNowNs();
+                    });
+                if(n < 0)
+                    {
+                        cout << "[ERROR] Failed to read from avn_to_atc.fifo: " << strerror(errno) << endl;
+                        break;
+                    }
+                if(time(nullptr) != lastReport)
+                    {
+                        lastReport = time(nullptr);
+                        cout << "[Load Driver] issued " << issued.size() << ", cleared " << cleared << "\n" << flush;
+                    }
+                if(issued.size() == avns && wireNowNs() - lastProgress > DRAIN_TIMEOUT_SEC * 1000000000ull)
+                    {
+                        cout << "[ERROR] " << avns - cleared << " AVN(s) not cleared after " << DRAIN_TIMEOUT_SEC << " s, giving up\n";
+                        break;
+                    }
+                if(issued.size() == owed && batch.empty())
+                    in.waitReadable(1);
+            }
+        uint64_t end = wireNowNs();
+
+        FILE* csv = fopen(csvPath, "w");
+        if(!csv)
+            cout << "[ERROR] Failed to open " << csvPath << ": " << strerror(errno) << endl;
+        vector<uint64_t> latencies;
+        latencies.reserve(cleared);
+        if(csv)
+            fputs("id,airline,issuedNs,clearedNs,latencyUs\n", csv);
+        for(const LoadAvn& a : issued)
+            {
+                if(a.clearedNs)
+                    latencies.push_back(a.clearedNs - a.issuedNs);
+                if(csv)
+                    fprintf(csv, "%llu,%s,%llu,%llu,%.1f\n", (unsigned long long)a.id, airlines[a.airline].c_str(), (unsigned long long)a.issuedNs,
+                            (unsigned long long)a.clearedNs, a.clearedNs ? (a.clearedNs - a.issuedNs) / 1e3 : -1.0);
+            }
+        if(csv)
+            fclose(csv);
+
+        sort(latencies.begin(), latencies.end());
+        double seconds = (end - start) / 1e9;
+        cout << "===== Load Driver Results =====\n"
+             << "issued " << issued.size() << ", cleared " << cleared << ", unmatched notifications " << unknown << "\n"
+             << fixed << setprecision(0) << "clearances/sec " << (seconds > 0 ? cleared / seconds : 0) << " over " << setprecision(2) << seconds << " s\n"
+             << setprecision(1) << "violation-to-clearance p50 " << percentileUs(latencies, 0.5) << " us, p99 " << percentileUs(latencies, 0.99)
+             << " us, max " << (latencies.empty() ? 0 : latencies.back() / 1e3) << " us\n"
+             << "per-AVN timings in " << csvPath << "\n" << flush;
+        return cleared == avns ? 0 : 1;
+    }
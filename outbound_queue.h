@@ -0,0 +1,280 @@
+#ifndef OUTBOUND_QUEUE_H
+#define OUTBOUND_QUEUE_H
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <deque>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "avn_channel.h"
+
+//bounded queue of records waiting for one outbound link
+//a full pipe (or a reader that is not up yet) no longer loses the record, it waits here until the link is
+//writable again; only when the queue itself is full does the backpressure policy decide what happens
+//AIRCONTROLX_BACKPRESSURE=block|drop-oldest|drop-newest, AIRCONTROLX_QUEUE_RECORDS, AIRCONTROLX_BLOCK_MS
+
+enum BackpressurePolicy { BP_BLOCK, BP_DROP_OLDEST, BP_DROP_NEWEST };
+
+enum EnqueueResult
+    {
+        ENQUEUED,
+        ENQUEUED_HIGH_WATER,        //queued, and the queue just crossed its high-water mark
+        ENQUEUED_DROPPED_OLDEST,    //queued by evicting the oldest pending record
+        DROPPED_NEWEST              //queue stayed full (after blocking, if the policy blocks), this record was lost
+    };
+
+struct OutboundConfig
+    {
+        BackpressurePolicy policy = BP_BLOCK;
+        size_t capacity = 8192;     //records
+        int blockMs = 20;           //longest a producer waits for space under BP_BLOCK
+    };
+
+inline OutboundConfig outboundConfigFromEnv()
+    {
+        OutboundConfig config;
+        const char* policy = getenv("AIRCONTROLX_BACKPRESSURE");
+        if(policy && strcmp(policy, "drop-oldest") == 0)
+            config.policy = BP_DROP_OLDEST;
+        else if(policy && strcmp(policy, "drop-newest") == 0)
+            config.policy = BP_DROP_NEWEST;
+        const char* capacity = getenv("AIRCONTROLX_QUEUE_RECORDS");
+        if(capacity && atol(capacity) > 0)
+            config.capacity = atol(capacity);
+        const char* blockMs = getenv("AIRCONTROLX_BLOCK_MS");
+        if(blockMs && atoi(blockMs) >= 0)
+            config.blockMs = atoi(blockMs);
+        return config;
+    }
+
+inline const char* backpressureToStr(BackpressurePolicy p)
+    {
+        return p == BP_DROP_OLDEST ? "drop-oldest" : p == BP_DROP_NEWEST ? "drop-newest" : "block";
+    }
+
+struct OutboundStats
+    {
+        uint64_t enqueued = 0;
+        uint64_t sent = 0;
+        uint64_t droppedOldest = 0;
+        uint64_t droppedNewest = 0;
+        uint64_t blockedProducers = 0;  //enqueue() calls that had to wait for space
+        size_t depth = 0;
+        size_t highWater = 0;           //deepest the queue has been
+    };
+
+template<typename Record>
+class OutboundQueue
+    {
+        private:
+            AvnChannel& channel;
+            OutboundConfig config;
+            bool selfFlushing;              //no flusher thread, a blocked producer drains the link itself
+            std::deque<Record> pending;
+            pthread_mutex_t mutex;
+            pthread_cond_t changed;         //signalled on enqueue (for a flusher) and after a flush (for blocked producers)
+            pthread_mutex_t flushMutex;     //one flush at a time keeps the records in order
+            OutboundStats stats;
+            uint64_t evicted = 0;           //records popped off the front by BP_DROP_OLDEST, ever
+            bool overHighWater = false;
+
+            size_t highWaterMark() const
+                {
+                    return config.capacity * 3 / 4;
+                }
+
+            static void deadlineAfter(timespec& ts, int ms)
+                {
+                    clock_gettime(CLOCK_REALTIME, &ts);
+                    ts.tv_sec += ms / 1000;
+                    ts.tv_nsec += (ms % 1000) * 1000000L;
+                    if(ts.tv_nsec >= 1000000000L)
+                        {
+                            ts.tv_sec++;
+                            ts.tv_nsec -= 1000000000L;
+                        }
+                }
+
+            //waits for room under BP_BLOCK, called and returns with mutex held
+            bool waitForRoom()
+                {
+                    stats.blockedProducers++;
+                    timespec deadline;
+                    deadlineAfter(deadline, config.blockMs);
+                    while(pending.size() >= config.capacity)
+                        {
+                            if(selfFlushing)
+                                {
+                                    pthread_mutex_unlock(&mutex);
+                                    flush();
+                                    bool progress = channel.waitWritable(config.blockMs);
+                                    pthread_mutex_lock(&mutex);
+                                    if(!progress && pending.size() >= config.capacity)
+                                        return false;
+                                }
+                            else if(pthread_cond_timedwait(&changed, &mutex, &deadline) == ETIMEDOUT)
+                                return pending.size() < config.capacity;
+                        }
+                    return true;
+                }
+
+        public:
+            //selfFlushing: true when the producer thread is also the one that calls flush()
+            OutboundQueue(AvnChannel& ch, const OutboundConfig& cfg, bool selfFlushing)
+                : channel(ch), config(cfg), selfFlushing(selfFlushing)
+                {
+                    pthread_mutex_init(&mutex, nullptr);
+                    pthread_cond_init(&changed, nullptr);
+                    pthread_mutex_init(&flushMutex, nullptr);
+                }
+
+            OutboundQueue(const OutboundQueue&) = delete;
+            OutboundQueue& operator=(const OutboundQueue&) = delete;
+
+            EnqueueResult enqueue(const Record& record)
+                {
+                    EnqueueResult result = ENQUEUED;
+                    pthread_mutex_lock(&mutex);
+                    if(pending.size() >= config.capacity)
+                        {
+                            if(config.policy == BP_DROP_OLDEST)
+                                {
+                                    pending.pop_front();
+                                    evicted++;
+                                    stats.droppedOldest++;
+                                    result = ENQUEUED_DROPPED_OLDEST;
+                                }
+                            else if(config.policy == BP_DROP_NEWEST || !waitForRoom())
+                                {
+                                    stats.droppedNewest++;
+                                    pthread_mutex_unlock(&mutex);
+                                    return DROPPED_NEWEST;
+                                }
+                        }
+                    pending.push_back(record);
+                    stats.enqueued++;
+                    if(pending.size() > stats.highWater)
+                        stats.highWater = pending.size();
+                    if(!overHighWater && pending.size() >= highWaterMark())
+                        {
+                            overHighWater = true;
+                            if(result == ENQUEUED)
+                                result = ENQUEUED_HIGH_WATER;
+                        }
+                    pthread_cond_broadcast(&changed);
+                    pthread_mutex_unlock(&mutex);
+                    return result;
+                }
+
+            //sends as much as the link takes right now without blocking, onSent(const Record&) runs for each
+            //record that went out; returns how many were sent
+            template<typename OnSent>
+            size_t flush(OnSent onSent)
+                {
+                    const size_t CHUNK = 256;
+                    size_t total = 0;
+                    pthread_mutex_lock(&flushMutex);
+                    channel.flushPending();
+                    while(true)
+                        {
+                            pthread_mutex_lock(&mutex);
+                            std::vector<Record> chunk(pending.begin(), pending.begin() + (pending.size() < CHUNK ? pending.size() : CHUNK));
+                            uint64_t evictedBefore = evicted;
+                            pthread_mutex_unlock(&mutex);
+                            if(chunk.empty() || !channel.isOpen())
+                                break;
+
+                            ssize_t sent = channel.sendRecords(chunk);
+                            if(sent <= 0)
+                                break;
+
+                            pthread_mutex_lock(&mutex);
+                            //an enqueue may have evicted the front of the chunk while it was being sent, those
+                            //records are gone already and the rest of what went out now starts the queue
+                            size_t gone = size_t(evicted - evictedBefore);
+                            size_t sentGone = gone < size_t(sent) ? gone : size_t(sent);
+                            pending.erase(pending.begin(), pending.begin() + (size_t(sent) - sentGone));
+                            stats.droppedOldest -= sentGone;        //they were sent after all
+                            stats.sent += sent;
+                            if(overHighWater && pending.size() < highWaterMark() / 2)
+                                overHighWater = false;
+                            pthread_cond_broadcast(&changed);
+                            pthread_mutex_unlock(&mutex);
+
+                            for(ssize_t i = 0; i < sent; i++)
+                                onSent(chunk[i]);
+                            total += sent;
+                            if(size_t(sent) < chunk.size())
+                                break;      //link is full again
+                        }
+                    pthread_mutex_unlock(&flushMutex);
+                    return total;
+                }
+
+            size_t flush()
+                {
+                    return flush([](const Record&) {});
+                }
+
+            //for a flusher thread: sleeps until something is pending or timeoutMs passes
+            bool waitPending(int timeoutMs)
+                {
+                    timespec deadline;
+                    deadlineAfter(deadline, timeoutMs);
+                    pthread_mutex_lock(&mutex);
+                    while(pending.empty() && !channel.txPending())
+                        if(pthread_cond_timedwait(&changed, &mutex, &deadline) == ETIMEDOUT)
+                            break;
+                    bool any = !pending.empty() || channel.txPending();
+                    pthread_mutex_unlock(&mutex);
+                    return any;
+                }
+
+            //records still queued, or half a record still inside the channel; either way the link wants EPOLLOUT
+            bool backlog()
+                {
+                    return size() > 0 || channel.txPending();
+                }
+
+            void wakeAll()          //lets a flusher blocked in waitPending() re-check its exit condition
+                {
+                    pthread_mutex_lock(&mutex);
+                    pthread_cond_broadcast(&changed);
+                    pthread_mutex_unlock(&mutex);
+                }
+
+            size_t size()
+                {
+                    pthread_mutex_lock(&mutex);
+                    size_t n = pending.size();
+                    pthread_mutex_unlock(&mutex);
+                    return n;
+                }
+
+            OutboundStats snapshot()
+                {
+                    pthread_mutex_lock(&mutex);
+                    OutboundStats s = stats;
+                    s.depth = pending.size();
+                    pthread_mutex_unlock(&mutex);
+                    return s;
+                }
+
+            const OutboundConfig& configuration() const
+                {
+                    return config;
+                }
+
+            ~OutboundQueue()
+                {
+                    pthread_mutex_destroy(&flushMutex);
+                    pthread_cond_destroy(&changed);
+                    pthread_mutex_destroy(&mutex);
+                }
+    };
+
+#endif
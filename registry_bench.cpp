@@ -0,0 +1,159 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <cstdlib>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "avn_registry.h"
+#include "avn_id.h"
+
+using namespace std;
+
+//measures generator registry throughput for AVN ingest (put) and payment confirmation (setStatus) as the number
+//of threads grows, with one shard (the old single avnMutex) against the hash-striped registry
+//build: g++ -O2 -std=c++17 registry_bench.cpp -o registry_bench -pthread
+//usage: ./registry_bench [avns] [maxThreads]
+
+struct BenchShared
+    {
+        AvnRegistry* registry;
+        AvnIdGenerator* ids;
+        size_t perThread;
+        pthread_barrier_t start;        //all threads begin a phase together
+        pthread_barrier_t ingested;
+    };
+
+struct BenchWorker
+    {
+        BenchShared* shared;
+        int index;
+        vector<uint64_t> ids;
+        uint64_t ingestNs;
+        uint64_t confirmNs;
+        size_t failures;
+    };
+
+static const char* BENCH_AIRLINES[] = { "PIA", "AirBlue", "FedEx", "Pakistan Airforce", "Blue Dart", "AghaKhan Air" };
+
+static void* worker(void* arg)
+    {
+        BenchWorker& w = *static_cast<BenchWorker*>(arg);
+        BenchShared& s = *w.shared;
+        AVN avn;
+        wireInit(avn);
+        wireSetString(avn.airlineName, BENCH_AIRLINES[w.index % 6]);
+        wireSetString(avn.flightNumber, "BENCH" + to_string(w.index));
+        wireSetString(avn.paymentStatus, "unpaid");
+        avn.fineAmount = 575000;
+
+        pthread_barrier_wait(&s.start);
+        uint64_t begin = wireNowNs();
+        for(size_t i = 0; i < s.perThread; i++)
+            {
+                avn.id = s.ids->next();
+                avnIdToStr(avn.id, avn.avnID);
+                if(!s.registry->put(avn))
+                    w.failures++;
+                w.ids.push_back(avn.id);
+            }
+        w.ingestNs = wireNowNs() - begin;
+
+        pthread_barrier_wait(&s.ingested);
+        begin = wireNowNs();
+        AVN updated;
+        for(uint64_t id : w.ids)
+            if(!s.registry->setStatus(id, "paid", updated))
+                w.failures++;
+        w.confirmNs = wireNowNs() - begin;
+        return nullptr;
+    }
+
+static void removeDir(const string& dir)
+    {
+        DIR* d = opendir(dir.c_str());
+        if(!d)
+            return;
+        while(dirent* e = readdir(d))
+            if(strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+                unlink((dir + "/" + e->d_name).c_str());
+        closedir(d);
+        rmdir(dir.c_str());
+    }
+
+static bool runOnce(size_t avns, int threads, size_t shards, double& ingestRate, double& confirmRate)
+    {
+        char dir[] = "/tmp/registry_bench.XXXXXX";
+        if(!mkdtemp(dir))
+            return false;
+        AvnRegistry registry;
+        if(!registry.open(string(dir) + "/avn_store", shards))
+            {
+                cout << "[ERROR] Failed to open registry in " << dir << ": " << strerror(errno) << endl;
+                removeDir(dir);
+                return false;
+            }
+        AvnIdGenerator ids(1);
+        BenchShared shared;
+        shared.registry = &registry;
+        shared.ids = &ids;
+        shared.perThread = avns / threads;
+        pthread_barrier_init(&shared.start, nullptr, threads);
+        pthread_barrier_init(&shared.ingested, nullptr, threads);
+
+        vector<BenchWorker> workers(threads);
+        vector<pthread_t> tids(threads);
+        for(int t = 0; t < threads; t++)
+            {
+                workers[t] = BenchWorker{ &shared, t, {}, 0, 0, 0 };
+                workers[t].ids.reserve(shared.perThread);
+                pthread_create(&tids[t], nullptr, worker, &workers[t]);
+            }
+        uint64_t ingestNs = 0, confirmNs = 0;
+        size_t failures = 0;
+        for(int t = 0; t < threads; t++)
+            {
+                pthread_join(tids[t], nullptr);
+                ingestNs = max(ingestNs, workers[t].ingestNs);      //the phase lasts as long as its slowest thread
+                confirmNs = max(confirmNs, workers[t].confirmNs);
+                failures += workers[t].failures;
+            }
+        pthread_barrier_destroy(&shared.start);
+        pthread_barrier_destroy(&shared.ingested);
+        registry.close();
+        removeDir(dir);
+
+        size_t total = shared.perThread * threads;
+        ingestRate = total / (ingestNs / 1e9);
+        confirmRate = total / (confirmNs / 1e9);
+        if(failures)
+            cout << "[ERROR] " << failures << " registry operations failed\n";
+        return failures == 0;
+    }
+
+int main(int argc, char* argv[])
+    {
+        size_t avns = argc > 1 ? strtoul(argv[1], nullptr, 10) : 400000;
+        int maxThreads = argc > 2 ? atoi(argv[2]) : 8;
+
+        cout << "===== Registry Benchmark: " << avns << " AVNs, " << sysconf(_SC_NPROCESSORS_ONLN) << " CPUs =====\n";
+        cout << left << setw(10) << "threads" << setw(10) << "shards"
+             << right << setw(16) << "ingest/sec" << setw(16) << "confirm/sec" << "\n";
+
+        size_t shardCounts[] = { 1, REGISTRY_SHARDS };
+        for(int threads = 1; threads <= maxThreads; threads *= 2)
+            for(size_t shards : shardCounts)
+                {
+                    double ingest = 0, confirm = 0;
+                    if(!runOnce(avns, threads, shards, ingest, confirm))
+                        return 1;
+                    cout << left << setw(10) << threads << setw(10) << shards << right << fixed << setprecision(0)
+                         << setw(16) << ingest << setw(16) << confirm << "\n" << flush;
+                }
+        return 0;
+    }
@@ -0,0 +1,245 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+//single-producer/single-consumer ring of fixed-size records living in POSIX shared memory
+//the consumer sleeps on a futex over the tail index, so an idle link costs no syscalls at all
+//and a busy link costs one memcpy per record instead of a write() and a read()
+
+static const uint32_t SHM_RING_MAGIC = 0x41435852;     //"ACXR"
+
+struct ShmRingHeader
+    {
+        uint32_t magic;
+        std::atomic<uint32_t> ready;            //set by the creator once the layout below is valid
+        uint32_t recordSize;
+        uint32_t capacity;                      //power of two
+        alignas(64) std::atomic<uint32_t> head; //next slot the consumer reads, only the consumer writes it
+        alignas(64) std::atomic<uint32_t> tail; //next slot the producer writes, futex word for the consumer
+        std::atomic<uint32_t> consumerWaiting;  //consumer is (about to be) asleep on tail
+    };
+
+class ShmRing
+    {
+        private:
+            ShmRingHeader* hdr = nullptr;
+            char* slots = nullptr;
+            size_t mappedSize = 0;
+
+            static size_t dataOffset()
+                {
+                    return (sizeof(ShmRingHeader) + 63) & ~size_t(63);
+                }
+
+            static long futex(std::atomic<uint32_t>* word, int op, uint32_t val, const timespec* timeout)
+                {
+                    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, val, timeout, nullptr, 0);
+                }
+
+        public:
+            //maps "atc_to_avn.fifo" style names onto a shared memory object name
+            static std::string segmentName(const std::string& channelName)
+                {
+                    std::string base = channelName.substr(0, channelName.find('.'));
+                    return "/aircontrolx." + base;
+                }
+
+            static void unlink(const std::string& channelName)
+                {
+                    shm_unlink(segmentName(channelName).c_str());
+                }
+
+            //creates the segment or attaches to the one the other side already created
+            bool open(const std::string& channelName, uint32_t recordSize, uint32_t capacity)
+                {
+                    close();
+                    uint32_t cap = 1;
+                    while(cap < capacity)
+                        cap <<= 1;
+                    std::string name = segmentName(channelName);
+                    size_t size = dataOffset() + size_t(cap) * recordSize;
+
+                    bool creator = true;
+                    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+                    if(fd < 0 && errno == EEXIST)
+                        {
+                            creator = false;
+                            fd = shm_open(name.c_str(), O_RDWR, 0666);
+                        }
+                    if(fd < 0)
+                        return false;
+
+                    if(creator)
+                        {
+                            if(ftruncate(fd, size) < 0)
+                                {
+                                    ::close(fd);
+                                    shm_unlink(name.c_str());
+                                    return false;
+                                }
+                        }
+                    else
+                        {
+                            struct stat st;
+                            for(int i = 0; i < 200; i++)    //creator may not have sized it yet
+                                {
+                                    if(fstat(fd, &st) == 0 && size_t(st.st_size) >= size)
+                                        break;
+                                    usleep(1000);
+                                }
+                            if(fstat(fd, &st) < 0 || size_t(st.st_size) < size)
+                                {
+                                    ::close(fd);
+                                    errno = EINVAL;
+                                    return false;
+                                }
+                        }
+
+                    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                    ::close(fd);
+                    if(mem == MAP_FAILED)
+                        return false;
+                    hdr = static_cast<ShmRingHeader*>(mem);
+                    slots = static_cast<char*>(mem) + dataOffset();
+                    mappedSize = size;
+
+                    if(creator)
+                        {
+                            hdr->magic = SHM_RING_MAGIC;
+                            hdr->recordSize = recordSize;
+                            hdr->capacity = cap;
+                            hdr->head.store(0, std::memory_order_relaxed);
+                            hdr->tail.store(0, std::memory_order_relaxed);
+                            hdr->consumerWaiting.store(0, std::memory_order_relaxed);
+                            hdr->ready.store(1, std::memory_order_release);
+                        }
+                    else
+                        {
+                            for(int i = 0; i < 200 && !hdr->ready.load(std::memory_order_acquire); i++)
+                                usleep(1000);
+                            if(!hdr->ready.load(std::memory_order_acquire) || hdr->magic != SHM_RING_MAGIC ||
+                               hdr->recordSize != recordSize || hdr->capacity != cap)
+                                {
+                                    close();
+                                    errno = EINVAL;    //stale segment from a build with a different layout
+                                    return false;
+                                }
+                        }
+                    return true;
+                }
+
+            bool isOpen() const
+                {
+                    return hdr != nullptr;
+                }
+
+            uint32_t recordSize() const
+                {
+                    return hdr->recordSize;
+                }
+
+            //producer side, false when the ring is full
+            bool push(const void* record)
+                {
+                    uint32_t t = hdr->tail.load(std::memory_order_relaxed);
+                    if(t - hdr->head.load(std::memory_order_acquire) >= hdr->capacity)
+                        return false;
+                    memcpy(slots + size_t(t & (hdr->capacity - 1)) * hdr->recordSize, record, hdr->recordSize);
+                    hdr->tail.store(t + 1, std::memory_order_release);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);   //pairs with the fence in waitReadable
+                    if(hdr->consumerWaiting.load(std::memory_order_relaxed))
+                        futex(&hdr->tail, FUTEX_WAKE, 1, nullptr);
+                    return true;
+                }
+
+            //consumer side, copies up to maxRecords into out and returns how many it took
+            size_t popMany(void* out, size_t maxRecords)
+                {
+                    uint32_t h = hdr->head.load(std::memory_order_relaxed);
+                    uint32_t avail = hdr->tail.load(std::memory_order_acquire) - h;
+                    size_t n = avail < maxRecords ? avail : maxRecords;
+                    char* dst = static_cast<char*>(out);
+                    for(size_t i = 0; i < n; i++)
+                        memcpy(dst + i * hdr->recordSize, slots + size_t((h + i) & (hdr->capacity - 1)) * hdr->recordSize, hdr->recordSize);
+                    if(n)
+                        hdr->head.store(h + n, std::memory_order_release);
+                    return n;
+                }
+
+            bool full() const
+                {
+                    return hdr->tail.load(std::memory_order_relaxed) - hdr->head.load(std::memory_order_acquire) >= hdr->capacity;
+                }
+
+            bool empty() const
+                {
+                    return hdr->tail.load(std::memory_order_acquire) == hdr->head.load(std::memory_order_relaxed);
+                }
+
+            //consumer side, sleeps until a record is available or timeoutMs passes (-1 waits forever)
+            bool waitReadable(int timeoutMs)
+                {
+                    uint32_t seen = hdr->tail.load(std::memory_order_acquire);
+                    if(seen != hdr->head.load(std::memory_order_relaxed))
+                        return true;
+                    hdr->consumerWaiting.store(1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if(hdr->tail.load(std::memory_order_acquire) == seen)
+                        {
+                            timespec ts = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+                            futex(&hdr->tail, FUTEX_WAIT, seen, timeoutMs < 0 ? nullptr : &ts);
+                        }
+                    hdr->consumerWaiting.store(0, std::memory_order_relaxed);
+                    return !empty();
+                }
+
+            uint32_t tailIndex() const
+                {
+                    return hdr->tail.load(std::memory_order_acquire);
+                }
+
+            //sleeps until the producer moves tail past seen, for a helper thread that turns pushes into fd events
+            uint32_t waitTailChange(uint32_t seen, int timeoutMs)
+                {
+                    hdr->consumerWaiting.store(1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if(hdr->tail.load(std::memory_order_acquire) == seen)
+                        {
+                            timespec ts = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+                            futex(&hdr->tail, FUTEX_WAIT, seen, timeoutMs < 0 ? nullptr : &ts);
+                        }
+                    return hdr->tail.load(std::memory_order_acquire);
+                }
+
+            void close()
+                {
+                    if(hdr)
+                        munmap(hdr, mappedSize);
+                    hdr = nullptr;
+                    slots = nullptr;
+                    mappedSize = 0;
+                }
+
+            ShmRing() = default;
+            ShmRing(const ShmRing&) = delete;
+            ShmRing& operator=(const ShmRing&) = delete;
+
+            ~ShmRing()
+                {
+                    close();
+                }
+    };
+
+#endif
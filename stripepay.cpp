@@ -8,121 +8,66 @@
 #include <map>
 #include <pthread.h>
 #include <sstream>
+#include <atomic>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <queue>
+#include <set>
+#include <unordered_map>
+
+#include "avn_channel.h"
+#include "avn_wire.h"
+#include "avn_ledger.h"
+#include "avn_journal.h"
+#include "avn_driver.h"
 
 using namespace std;
 
-enum FlightType { COMMERCIAL, CARGO, EMERGENCY };           //ENUMS FLightType , Same as what is in ATC file
-
-struct AVN        //it is also same as the AVN in ATC file, kyunkay same data pipe say lakr aaaana hoata   (same as avn.cpp)
-    {
-        char avnID[32];
-        char airlineName[32];
-        char flightNumber[16];
-        FlightType type;
-        float speedRecorded;
-        float permissibleSpeed;
-        time_t issuanceTime;
-        double fineAmount;
-        char paymentStatus[16];
-        time_t dueDate;
-
-        void serialize(char* buffer, int& offset) const      //this function is used to convert the AVN object data into stream of bytes
-            {                                                   //-hence necessary to transfer data through pipe or fifio
-                memcpy(buffer + offset, avnID, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(buffer + offset, airlineName, sizeof(airlineName));
-                offset += sizeof(airlineName);
-                memcpy(buffer + offset, flightNumber, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(buffer + offset, &type, sizeof(type));
-                offset += sizeof(type);
-                memcpy(buffer + offset, &speedRecorded, sizeof(speedRecorded));
-                offset += sizeof(speedRecorded);
-                memcpy(buffer + offset, &permissibleSpeed, sizeof(permissibleSpeed));
-                offset += sizeof(permissibleSpeed);
-                memcpy(buffer + offset, &issuanceTime, sizeof(issuanceTime));
-                offset += sizeof(issuanceTime);
-                memcpy(buffer + offset, &fineAmount, sizeof(fineAmount));
-                offset += sizeof(fineAmount);
-                memcpy(buffer + offset, paymentStatus, sizeof(paymentStatus));
-                offset += sizeof(paymentStatus);
-                memcpy(buffer + offset, &dueDate, sizeof(dueDate));
-                offset += sizeof(dueDate);
-            }
-
-        void deserialize(const char* buffer, int& offset)            //to convert back to it's original object form
-            {
-                memcpy(avnID, buffer + offset, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(airlineName, buffer + offset, sizeof(airlineName));
-                offset += sizeof(airlineName);
-                memcpy(flightNumber, buffer + offset, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(&type, buffer + offset, sizeof(type));
-                offset += sizeof(type);
-                memcpy(&speedRecorded, buffer + offset, sizeof(speedRecorded));
-                offset += sizeof(speedRecorded);
-                memcpy(&permissibleSpeed, buffer + offset, sizeof(permissibleSpeed));
-                offset += sizeof(permissibleSpeed);
-                memcpy(&issuanceTime, buffer + offset, sizeof(issuanceTime));
-                offset += sizeof(issuanceTime);
-                memcpy(&fineAmount, buffer + offset, sizeof(fineAmount));
-                offset += sizeof(fineAmount);
-                memcpy(paymentStatus, buffer + offset, sizeof(paymentStatus));
-                offset += sizeof(paymentStatus);
-                memcpy(&dueDate, buffer + offset, sizeof(dueDate));
-                offset += sizeof(dueDate);
-            }
-
-        static int serializedSize()          //funciton to calculate and return size of stream produced by serialization funciton
-            {
-                return sizeof(avnID) + sizeof(airlineName) + sizeof(flightNumber) +
-                    sizeof(type) + sizeof(speedRecorded) + sizeof(permissibleSpeed) +
-                    sizeof(issuanceTime) + sizeof(fineAmount) + sizeof(paymentStatus) +
-                    sizeof(dueDate);
-            }
-    };
-
-struct PaymentConfirmation          //struct for payment details such as avnID, flightNum and ispaid (same as avn.cpp)
-    {
-        char avnID[32];
-        char flightNumber[16];
-        bool paymentSuccessful;
-
-        void serialize(char* buffer, int& offset) const         //converting 
-            {
-                memcpy(buffer + offset, avnID, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(buffer + offset, flightNumber, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(buffer + offset, &paymentSuccessful, sizeof(paymentSuccessful));
-                offset += sizeof(paymentSuccessful);
-            }
-
-        void deserialize(const char* buffer, int& offset)   //convertingf back to object
-            {
-                memcpy(avnID, buffer + offset, sizeof(avnID));
-                offset += sizeof(avnID);
-                memcpy(flightNumber, buffer + offset, sizeof(flightNumber));
-                offset += sizeof(flightNumber);
-                memcpy(&paymentSuccessful, buffer + offset, sizeof(paymentSuccessful));
-                offset += sizeof(paymentSuccessful);
-            }
-
-        static int serializedSize() 
-            {
-                return sizeof(avnID) + sizeof(flightNumber) + sizeof(paymentSuccessful);
-            }
-    };
-
 class StripePay 
     {
         private:
-            int fdAvnPipe = -1;        //for reading from avn_to_stripe.fifo
-            int fdAvnConfirmPipe = -1; //for writing to stripe_to_avn.fifo
-            int fdAirlineConfirmPipe = -1; //for writing to stripe_to_airline.fifo
+            AvnChannel avnPipe;        //for reading from avn_to_stripe.fifo
+            AvnChannel avnConfirmPipe; //for writing to stripe_to_avn.fifo
+            AvnChannel airlineConfirmPipe; //for writing to stripe_to_airline.fifo
             map<string, string> airlineCredentials; //for storing airline credentials
-            string loggedInAirline; //for tracking the currently logged-in airline
+            string loggedInAirline; //for tracking the currently logged-in airline, written under pendingMutex
+            AvnLedger ledger;       //the generator's per-airline totals, mapped read-only on first use
+
+            //the intake thread owns avnPipe and drains it as soon as poll reports data, whoever is logged in and
+            //whatever the terminal is doing; every AVN waits in pending under its airline until it is paid
+            pthread_t intakeThread;
+            pthread_mutex_t pendingMutex;           //guards pending and loggedInAirline
+            map<string, map<uint64_t, AVN>> pending;        //airline -> AVN id -> AVN received and not paid yet
+            int wakeFd = -1;            //eventfd, pulls the intake thread out of poll for shutdown
+            atomic<bool> running{false};
+
+            PaymentJournal journal;     //every accepted payment, durable before its confirmations go out
+            time_t lastReplay = 0;      //intake thread only once it runs, it replays every REPLAY_SEC from its poll timeout
+            pthread_mutex_t sendMutex;  //the command loop, the intake thread and drive() all send confirmations
+
+            //driver mode (AIRCONTROLX_DRIVER): no terminal, the intake thread schedules every AVN of a driven airline
+            //and drive() pays whatever fell due, timing each AVN from the generator's forward to its acknowledgement
+            struct DriverTiming
+                {
+                    string airline;
+                    uint64_t forwardedNs;       //generator's send stamp on the AVN, CLOCK_MONOTONIC like every other stamp
+                    uint64_t receivedNs;
+                    uint64_t paidNs;
+                    uint32_t attempts;
+                };
+            typedef pair<uint64_t, uint64_t> DueAvn;       //due time, AVN id
+            const DriverConfig* driver = nullptr;
+            set<string> drivenAirlines;
+            unordered_map<uint64_t, DriverTiming> timings;                          //under pendingMutex
+            priority_queue<DueAvn, vector<DueAvn>, greater<DueAvn>> schedule;      //under pendingMutex
+            pthread_cond_t scheduled;               //signalled by the intake thread when it schedules an AVN
+            FILE* timingsFile = nullptr;            //written by the intake thread only
+            unsigned failSeed = 0;
+            atomic<uint64_t> acknowledgedCount{0};
+
+            static const int SEND_TIMEOUT_MS = 5000;    //longest a confirmation batch waits for a full link to drain
+            static const int REPLAY_SEC = 30;           //an unacknowledged payment older than this is sent again
+            static const int DRIVER_IDLE_MS = 100;      //longest drive() sleeps without checking for shutdown
 
             string flightTypeToStr(FlightType f) 
                 {
@@ -135,6 +80,30 @@ class StripePay
                         }
                 }
 
+            void showLedger()           //the generator keeps these totals up to date, reading them is one lookup
+                {
+                    if(!ledger.isOpen() && !ledger.attach()) 
+                        {
+                            cout << "[StripePay] Fine ledger not available yet (is the AVN Generator running?)\n" << flush;
+                            return;
+                        }
+                    LedgerTotals t;
+                    if(!ledger.totals(loggedInAirline, t)) 
+                        {
+                            if(errno == EAGAIN)
+                                cout << "[StripePay] Fine ledger not available (an update to it never finished)\n" << flush;
+                            else
+                                cout << "[StripePay] No AVNs have been issued to " << loggedInAirline << "\n" << flush;
+                            return;
+                        }
+                    cout << "\n===== Fine Ledger for " << loggedInAirline << " =====\n"
+                        << "AVNs Issued: " << t.issued << "\n"
+                        << "Unpaid (not yet due): PKR " << formatMinorUnits(t.unpaid) << "\n"
+                        << "Overdue: PKR " << formatMinorUnits(t.overdue) << "\n"
+                        << "Paid: PKR " << formatMinorUnits(t.paid) << "\n"
+                        << "==============================================\n" << flush;
+                }
+
             bool authenticate()         //function to authenticate airline admins credentials
                 {
                     while(1)
@@ -144,12 +113,20 @@ class StripePay
                             getline(cin, username);
                             cout << "[StripePay] Enter password: ";
                             getline(cin, password);
+                            if(!cin)        //stdin closed (e.g. started by the supervisor without the terminal)
+                                {
+                                    cout << "\n[StripePay] No input available, cannot log in\n" << flush;
+                                    return false;
+                                }
 
                             auto it = airlineCredentials.find(username);
                             if(it != airlineCredentials.end() && it->second == password) 
                                 {
+                                    pthread_mutex_lock(&pendingMutex);
                                     loggedInAirline = username;
+                                    pthread_mutex_unlock(&pendingMutex);
                                     cout << "[StripePay] Successfully logged in as " << username << "\n" << flush;
+                                    showPending("", false);     //whatever arrived for this airline meanwhile is waiting already
                                     return true;
                                 } 
                             else 
@@ -160,11 +137,17 @@ class StripePay
                 }
 
         public:
-            StripePay() 
+            explicit StripePay(const DriverConfig* driverConfig) 
+                : driver(driverConfig)
                 {
-                    pthread_mutex_t mutex; // Dummy mutex for compilation (not used in this version)
-                    pthread_mutex_init(&mutex, nullptr);
-                    cout << "[StripePay] Starting initialization...\n" << flush;
+                    pthread_mutex_init(&pendingMutex, nullptr);
+                    pthread_mutex_init(&sendMutex, nullptr);
+                    pthread_condattr_t attr;
+                    pthread_condattr_init(&attr);
+                    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);        //due times are wireNowNs() stamps
+                    pthread_cond_init(&scheduled, &attr);
+                    pthread_condattr_destroy(&attr);
+                    cout << "[StripePay] Starting initialization (transport: " << transportToStr(selectedTransport()) << ")...\n" << flush;
 
                     // Initialize airline credentials (username: airline name, password)
                     airlineCredentials["PIA"] = "pia123";
@@ -174,6 +157,37 @@ class StripePay
                     airlineCredentials["Blue Dart"] = "bluedart123";
                     airlineCredentials["AghaKhan Air"] = "ak123";
 
+                    if(driver) 
+                        {
+                            for(const DriverLogin& login : driver->logins)
+                                {
+                                    auto it = airlineCredentials.find(login.airline);
+                                    if(it == airlineCredentials.end() || it->second != login.password) 
+                                        {
+                                            cout << "[ERROR] Driver config credentials for " << login.airline << " were rejected" << endl << flush;
+                                            exit(1);
+                                        }
+                                    drivenAirlines.insert(login.airline);
+                                }
+                            if(!driver->timingsPath.empty()) 
+                                {
+                                    timingsFile = fopen(driver->timingsPath.c_str(), "w");
+                                    if(!timingsFile) 
+                                        {
+                                            cout << "[ERROR] Failed to open " << driver->timingsPath << ": " << strerror(errno) << endl << flush;
+                                            exit(1);
+                                        }
+                                    fputs("id,avnID,airline,forwardedNs,receivedNs,paidNs,clearedNs,acknowledgedNs,attempts\n", timingsFile);
+                                }
+                            failSeed = driver->seed;
+                        }
+
+                    if(!journal.open("stripe_payments.journal")) 
+                        {
+                            cout << "[ERROR] Failed to open stripe_payments.journal: " << strerror(errno) << endl << flush;
+                            exit(1);
+                        }
+
                     // Create new FIFO for communication with Airline Portal
                     if(mkfifo("stripe_to_airline.fifo", 0666) == -1 && errno != EEXIST) 
                         {
@@ -183,8 +197,7 @@ class StripePay
 
                     for(int attempt = 1; attempt <= 20; attempt++)        //ifAVN file not opened the nit will wait and retry 20 times until writer avn.cpp opens
                         {
-                            fdAvnPipe = open("avn_to_stripe.fifo", O_RDONLY | O_NONBLOCK);
-                            if(fdAvnPipe < 0) 
+                            if(!avnPipe.openReader("avn_to_stripe.fifo", sizeof(AVN))) 
                                 {
                                     cout << "[StripePay] Attempt " << attempt << " failed to open avn_to_stripe.fifo: " << strerror(errno) << ", retrying...\n" << flush;
                                     usleep(500000);
@@ -193,7 +206,7 @@ class StripePay
                             cout << "[StripePay] Successfully opened avn_to_stripe.fifo\n" << flush;
                             break;
                         }
-                    if(fdAvnPipe < 0) 
+                    if(!avnPipe.isOpen()) 
                         {
                             cout << "[ERROR] Failed to open avn_to_stripe.fifo after retries: " << strerror(errno) << endl << flush;
                             exit(1);
@@ -201,8 +214,7 @@ class StripePay
 
                     for(int attempt = 1; attempt <= 20; attempt++)        //ifAVN file not opened the nit will wait and retry 20 times until reader avn.cpp opens
                         {
-                            fdAvnConfirmPipe = open("stripe_to_avn.fifo", O_WRONLY | O_NONBLOCK);
-                            if(fdAvnConfirmPipe < 0) 
+                            if(!avnConfirmPipe.openWriter("stripe_to_avn.fifo", sizeof(PaymentConfirmation))) 
                                 {
                                     cout << "[StripePay] Attempt " << attempt << " failed to open stripe_to_avn.fifo: " << strerror(errno) << ", retrying...\n" << flush;
                                     usleep(500000);
@@ -211,18 +223,17 @@ class StripePay
                             cout << "[StripePay] Successfully opened stripe_to_avn.fifo\n" << flush;
                             break;
                         }
-                    if(fdAvnConfirmPipe < 0) 
+                    if(!avnConfirmPipe.isOpen()) 
                         {
                             cout << "[ERROR] Failed to open stripe_to_avn.fifo after retries: " << strerror(errno) << endl << flush;
-                            close(fdAvnPipe);
+                            avnPipe.close();
                             exit(1);
                         }
 
                     //opening stripe_to_airline.fifo for writing
                     for(int attempt = 1; attempt <= 10; attempt++) 
                         {
-                            fdAirlineConfirmPipe = open("stripe_to_airline.fifo", O_WRONLY | O_NONBLOCK);
-                            if(fdAirlineConfirmPipe < 0) 
+                            if(!airlineConfirmPipe.openWriter("stripe_to_airline.fifo", sizeof(PaymentConfirmation))) 
                                 {
                                     cout << "[StripePay] Attempt " << attempt << " failed to open stripe_to_airline.fifo: " << strerror(errno) << ", retrying...\n" << flush;
                                     usleep(500000);
@@ -231,120 +242,572 @@ class StripePay
                             cout << "[StripePay] Successfully opened stripe_to_airline.fifo\n" << flush;
                             break;
                         }
-                    if(fdAirlineConfirmPipe < 0) 
+                    if(!airlineConfirmPipe.isOpen()) 
                         {
                             cout << "[ERROR] Failed to open stripe_to_airline.fifo after retries: " << strerror(errno) << endl << flush;
-                            close(fdAvnPipe);
-                            close(fdAvnConfirmPipe);
+                            avnPipe.close();
+                            avnConfirmPipe.close();
                             exit(1);
                         }
 
-                    //authenticating user before proceeding
-                    if(!authenticate()) 
+                    replayUnacknowledged(time(nullptr));       //payments a previous run accepted that the generator never applied
+                    startIntake();                 //AVNs queue up from here on, before and during the login prompt
+                    requestOutstanding();
+                    reportReady("stripepay");      //links are up, logging in is up to the user
+
+                    //authenticating user before proceeding, a driver logged in from its config already
+                    if(!driver && !authenticate()) 
                         {
-                            close(fdAvnPipe);
-                            close(fdAvnConfirmPipe);
-                            close(fdAirlineConfirmPipe);
+                            stopIntake();
+                            avnPipe.close();
+                            avnConfirmPipe.close();
+                            airlineConfirmPipe.close();
                             exit(1);
                         }
 
                     cout << "[StripePay] Initialization complete.\n" << flush;
                 }
 
-            void processPayment()       //processing the upcoming payment
+            //writes a batch of confirmations to one pipe with as few writevs as the link allows, waiting for a full
+            //link to drain rather than losing the tail of a large payall batch
+            void sendConfirmations(vector<PaymentConfirmation>& confirmations, AvnChannel& pipe, const char* target)
+                {
+                    if(confirmations.empty())
+                        return;
+                    pthread_mutex_lock(&sendMutex);
+                    size_t sent = 0;
+                    int err = 0;
+                    while(sent < confirmations.size() || pipe.txPending())
+                        {
+                            ssize_t n = sent < confirmations.size() ? pipe.sendRecords(confirmations, sent) : pipe.flushPending() ? 0 : -1;
+                            if(n > 0)
+                                {
+                                    sent += n;
+                                    continue;
+                                }
+                            if(n == 0 && !pipe.txPending())
+                                continue;
+                            err = errno;
+                            if((err != EAGAIN && err != EWOULDBLOCK && n < 0) || !pipe.waitWritable(SEND_TIMEOUT_MS))
+                                {
+                                    err = err == EAGAIN || err == EWOULDBLOCK ? ETIMEDOUT : err;
+                                    break;
+                                }
+                        }
+                    if(confirmations.front().batchSize)
+                        {
+                            if(!driver)     //a driver sends a batch every few milliseconds, only failures are worth a line
+                                cout << "[StripePay] Sent a batch of " << sent << " payment confirmation(s) to " << target << "\n";
+                            if(sent < confirmations.size())
+                                cout << "[ERROR] Failed to send the last " << confirmations.size() - sent << " confirmation(s) of the batch to " << target << ", error: " << strerror(err) << endl;
+                            cout << flush;
+                            pthread_mutex_unlock(&sendMutex);
+                            return;
+                        }
+                    for(size_t i = 0; i < confirmations.size(); i++)
+                        {
+                            const PaymentConfirmation& c = confirmations[i];
+                            if(i < sent)
+                                cout << "[StripePay] Sent payment confirmation to " << target << " for AVN " << c.avnID << " (status: " << (c.paymentSuccessful ? "success" : "failure") << ")\n";
+                            else
+                                cout << "[ERROR] Failed to send payment confirmation to " << target << " for AVN " << c.avnID << ", error: " << strerror(err) << endl;
+                        }
+                    cout << flush;
+                    pthread_mutex_unlock(&sendMutex);
+                }
+
+            //pending lives only in memory, so a restart asks the generator for every AVN still unpaid or overdue;
+            //the intake thread picks them up like new ones
+            void requestOutstanding()
+                {
+                    vector<PaymentConfirmation> request(1);
+                    wireInit(request[0]);
+                    request[0].forwardRequest = 1;
+                    pthread_mutex_lock(&sendMutex);
+                    bool sent = false;
+                    while(!sent || avnConfirmPipe.txPending())      //same loop as sendConfirmations() for a single record
+                        {
+                            ssize_t n = !sent ? avnConfirmPipe.sendRecords(request) : avnConfirmPipe.flushPending() ? 0 : -1;
+                            if(n > 0)
+                                {
+                                    sent = true;
+                                    continue;
+                                }
+                            if(n == 0 && !avnConfirmPipe.txPending())
+                                continue;
+                            if((errno != EAGAIN && errno != EWOULDBLOCK && n < 0) || !avnConfirmPipe.waitWritable(SEND_TIMEOUT_MS))
+                                {
+                                    sent = false;
+                                    break;
+                                }
+                        }
+                    int err = errno;
+                    pthread_mutex_unlock(&sendMutex);
+                    if(!sent)
+                        cout << "[ERROR] Failed to ask the AVN Generator for outstanding AVNs: " << strerror(err) << endl << flush;
+                }
+
+            static PaymentConfirmation confirmationFor(const AVN& avn, bool paymentSuccessful, uint32_t batchSize = 0)
                 {
-                    char buffer[AVN::serializedSize()];
-                    int bytesRead = read(fdAvnPipe, buffer, sizeof(buffer));
+                    PaymentConfirmation confirmation;
+                    wireInit(confirmation);
+                    confirmation.id = avn.id;
+                    memcpy(confirmation.avnID, avn.avnID, sizeof(confirmation.avnID));
+                    memcpy(confirmation.flightNumber, avn.flightNumber, sizeof(confirmation.flightNumber));
+                    confirmation.paymentSuccessful = paymentSuccessful;
+                    confirmation.batchSize = batchSize;
+                    return confirmation;
+                }
 
-                    if(bytesRead == sizeof(buffer)) 
+            void startIntake()
+                {
+                    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                    if(wakeFd < 0 || avnPipe.pollFd() < 0)
                         {
-                            AVN avn;
-                            int offset = 0;
-                            avn.deserialize(buffer, offset);
+                            cout << "[ERROR] Failed to set up the intake thread: " << strerror(errno) << endl << flush;
+                            exit(1);
+                        }
+                    running = true;
+                    if(pthread_create(&intakeThread, nullptr, intake, this) != 0)
+                        {
+                            cout << "[ERROR] Failed to start the intake thread" << endl << flush;
+                            exit(1);
+                        }
+                }
+
+            void stopIntake()
+                {
+                    if(!running)
+                        return;
+                    running = false;
+                    uint64_t one = 1;
+                    if(write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                        cout << "[ERROR] Failed to wake the intake thread: " << strerror(errno) << endl << flush;
+                    pthread_join(intakeThread, nullptr);
+                }
 
-                            cout << "[StripePay] Received AVN: " << avn.avnID << ", Flight: " << avn.flightNumber << ", Type: " << flightTypeToStr(avn.type) << ", Amount: PKR " << avn.fineAmount << endl << flush;
+            static void* intake(void* arg)
+                {
+                    static_cast<StripePay*>(arg)->intakeLoop();
+                    return nullptr;
+                }
 
-                            // Check if the AVN belongs to the logged-in airline
-                            if(strcmp(avn.airlineName, loggedInAirline.c_str()) != 0) 
+            //sleeps in poll until the generator forwards AVNs or the next replay is due, no keyboard involved
+            void intakeLoop()
+                {
+                    pollfd fds[2] = { { avnPipe.pollFd(), POLLIN, 0 }, { wakeFd, POLLIN, 0 } };
+                    while(running)
+                        {
+                            int timeoutMs = int(max<time_t>(0, lastReplay + REPLAY_SEC - time(nullptr))) * 1000;
+                            int ready = poll(fds, 2, timeoutMs);
+                            if(ready < 0 && errno != EINTR)
                                 {
-                                    cout << "[StripePay] Unauthorized: AVN " << avn.avnID << " belongs to " << avn.airlineName << ", not " << loggedInAirline << ". Payment not allowed.\n" << flush;
-                                    return;
+                                    cout << "[ERROR] Intake poll failed: " << strerror(errno) << endl << flush;
+                                    break;
                                 }
+                            if(ready > 0 && fds[0].revents)
+                                receiveAVNs();
+                            if(fds[0].revents & POLLHUP && !(fds[0].revents & POLLIN))
+                                usleep(100000);     //generator gone, the FIFO reports hangup until it opens again
+                            if(time(nullptr) - lastReplay >= REPLAY_SEC)
+                                replayUnacknowledged(time(nullptr) - REPLAY_SEC);
+                        }
+                }
 
-                            //simulating airline admin payment
-                            double paidAmount;
-                            cout << "[StripePay] Please enter the payment amount for AVN " << avn.avnID << " (expected: PKR " << avn.fineAmount << "): ";
-                            cin >> paidAmount;
-
-                            bool paymentSuccessful = (abs(paidAmount - avn.fineAmount) < 0.01); //allow for minor floating-point differences
-                            if(paymentSuccessful)   //if payment done
+            void receiveAVNs()      //drains avn_to_stripe.fifo into pending, intake thread only
+                {
+                    vector<AVN> batch;
+                    ssize_t n = avnPipe.drain([&](const char* record)
+                        {
+                            const AVN* avn = wireView<AVN>(record);
+                            if(!avn)
                                 {
-                                    cout << "[StripePay] Payment of PKR " << paidAmount << " accepted for AVN " << avn.avnID << endl << flush;
-                                } 
-                            else 
+                                    cout << "[ERROR] Dropping malformed record on avn_to_stripe.fifo\n" << flush;
+                                    return;
+                                }
+                            batch.push_back(*avn);
+                        });
+                    if(n < 0) 
+                        {
+                            cout << "[ERROR] Failed to read from avn_to_stripe.fifo: " << strerror(errno) << endl << flush;
+                        }
+                    if(batch.empty())
+                        return;
+
+                    ostringstream notice;       //one write, so it does not interleave with the command loop's output
+                    map<string, size_t> queued;     //AVNs of airlines not logged in, one line each
+                    size_t acknowledged = 0;
+                    bool due = false;
+                    uint64_t now = wireNowNs();
+                    pthread_mutex_lock(&pendingMutex);
+                    for(const AVN& avn : batch)
+                        {
+                            if(strcmp(avn.paymentStatus, "paid") == 0)      //the generator applied a payment, the journal stops replaying it
                                 {
-                                    cout << "[StripePay] Payment failed: Expected PKR " << avn.fineAmount << ", received PKR " << paidAmount << endl << flush;
+                                    journal.acknowledge(avn.id);
+                                    auto it = pending.find(avn.airlineName);
+                                    if(it != pending.end())
+                                        it->second.erase(avn.id);
+                                    acknowledged++;
+                                    auto t = timings.find(avn.id);
+                                    if(t != timings.end()) 
+                                        {
+                                            //clearedNs is the generator's stamp on the echo, sent in the pass that queued the ATC clearance
+                                            if(timingsFile)
+                                                fprintf(timingsFile, "%llu,%s,%s,%llu,%llu,%llu,%llu,%llu,%u\n", (unsigned long long)avn.id, avn.avnID,
+                                                        t->second.airline.c_str(), (unsigned long long)t->second.forwardedNs, (unsigned long long)t->second.receivedNs,
+                                                        (unsigned long long)t->second.paidNs, (unsigned long long)avn.header.sentAtNs, (unsigned long long)now, t->second.attempts);
+                                            timings.erase(t);
+                                        }
+                                    continue;
+                                }
+                            if(journal.contains(avn.id))
+                                continue;           //already paid, it never goes back into pending
+                            pending[avn.airlineName][avn.id] = avn;
+                            if(driver) 
+                                {
+                                    if(drivenAirlines.count(avn.airlineName) && timings.emplace(avn.id, DriverTiming{ avn.airlineName, avn.header.sentAtNs, now, 0, 0 }).second) 
+                                        {
+                                            schedule.push(DueAvn(now + uint64_t(driver->payAfterMs) * 1000000ull, avn.id));
+                                            due = true;
+                                        }
                                 }
+                            else if(loggedInAirline == avn.airlineName)
+                                notice << "[StripePay] Received AVN: " << avn.avnID << ", Flight: " << avn.flightNumber << ", Type: " << flightTypeToStr(avn.type)
+                                       << ", Violations: " << avn.violationCount << ", Amount: PKR " << avn.fineAmount << "\n";
+                            else
+                                queued[avn.airlineName]++;
+                        }
+                    pthread_mutex_unlock(&pendingMutex);
+                    if(due)
+                        pthread_cond_signal(&scheduled);
+                    if(driver)      //drive() reports progress once a second instead
+                        {
+                            acknowledgedCount += acknowledged;
+                            return;
+                        }
+                    for(const auto& entry : queued)
+                        notice << "[StripePay] Queued " << entry.second << " AVN(s) for " << entry.first << " until it logs in\n";
+                    if(acknowledged)
+                        notice << "[StripePay] AVN Generator applied " << acknowledged << " payment(s)\n";
+                    cout << notice.str() << flush;
+                }
+
+            //the logged-in airline's pending AVNs, only flightNumber's if given, in issue order
+            vector<AVN> pendingFor(const string& flightNumber)
+                {
+                    vector<AVN> selected;
+                    pthread_mutex_lock(&pendingMutex);
+                    auto it = pending.find(loggedInAirline);
+                    if(it != pending.end())
+                        for(const auto& entry : it->second)
+                            if(flightNumber.empty() || flightNumber == entry.second.flightNumber)
+                                selected.push_back(entry.second);
+                    pthread_mutex_unlock(&pendingMutex);
+                    return selected;
+                }
+
+            void settled(const vector<AVN>& paid)      //takes paid AVNs out of pending
+                {
+                    pthread_mutex_lock(&pendingMutex);
+                    for(const AVN& avn : paid)
+                        {
+                            auto it = pending.find(avn.airlineName);
+                            if(it == pending.end())
+                                continue;
+                            it->second.erase(avn.id);
+                            if(it->second.empty())
+                                pending.erase(it);
+                        }
+                    pthread_mutex_unlock(&pendingMutex);
+                }
+
+            void showPending(const string& flightNumber, bool list)     //the backlog summary, and every AVN in it if list
+                {
+                    vector<AVN> selected = pendingFor(flightNumber);
+                    string scope = loggedInAirline + (flightNumber.empty() ? "" : " flight " + flightNumber);
+                    if(selected.empty())
+                        {
+                            cout << "[StripePay] No AVNs pending payment for " << scope << "\n" << flush;
+                            return;
+                        }
+                    double total = 0;
+                    ostringstream out;
+                    for(const AVN& avn : selected)
+                        {
+                            total += avn.fineAmount;
+                            if(list)
+                                out << "  " << avn.avnID << ", Flight: " << avn.flightNumber << ", Type: " << flightTypeToStr(avn.type)
+                                    << ", Violations: " << avn.violationCount << ", Amount: PKR " << formatMinorUnits(toMinorUnits(avn.fineAmount)) << "\n";
+                        }
+                    cout << "[StripePay] " << selected.size() << " AVN(s) pending payment for " << scope << ", PKR " << formatMinorUnits(toMinorUnits(total)) << "\n"
+                         << out.str() << flush;
+                }
+
+            bool readAmount(double& amount)     //one line from the terminal, false if it is not a number
+                {
+                    string line;
+                    if(!getline(cin, line))
+                        return false;
+                    char* end = nullptr;
+                    amount = strtod(line.c_str(), &end);
+                    return end != line.c_str();
+                }
+
+            void pay(const string& avnID)       //settles one pending AVN of the logged-in airline
+                {
+                    vector<AVN> match;
+                    for(const AVN& avn : pendingFor(""))
+                        if(avnID == avn.avnID)
+                            match.push_back(avn);
+                    if(match.empty())
+                        {
+                            cout << "[StripePay] AVN " << avnID << " is not pending payment for " << loggedInAirline << "\n" << flush;
+                            return;
+                        }
+                    AVN avn = match.front();
+
+                    //simulating airline admin payment
+                    double paidAmount = 0;
+                    cout << "[StripePay] Please enter the payment amount for AVN " << avn.avnID << " (expected: PKR " << avn.fineAmount << "): ";
+                    bool paymentSuccessful = readAmount(paidAmount) && abs(paidAmount - avn.fineAmount) < 0.01; //allow for minor floating-point differences
+                    if(paymentSuccessful && !journal.recordPayments(match, 0)) 
+                        {
+                            cout << "[ERROR] Failed to journal the payment for AVN " << avn.avnID << ", nothing was charged: " << strerror(errno) << endl << flush;
+                            return;
+                        }
+                    if(paymentSuccessful && match.empty()) 
+                        {
+                            cout << "[StripePay] AVN " << avnID << " was already paid\n" << flush;
+                            return;
+                        }
+                    if(paymentSuccessful)   //if payment done
+                        {
+                            cout << "[StripePay] Payment of PKR " << paidAmount << " accepted for AVN " << avn.avnID << endl << flush;
+                            settled(match);
+                        } 
+                    else 
+                        {
+                            cout << "[StripePay] Payment failed: Expected PKR " << avn.fineAmount << ", received PKR " << paidAmount << ", the AVN stays pending" << endl << flush;
+                        }
+
+                    vector<PaymentConfirmation> confirmations(1, confirmationFor(avn, paymentSuccessful));
+                    sendConfirmations(confirmations, avnConfirmPipe, "AVN Generator");     //senfing payment confirmation to AVN Generator
+
+                    sendConfirmations(confirmations, airlineConfirmPipe, "Airline Portal"); //confirming payment to Airline Portal
+                }
 
-                            //senfing payment confirmation to AVN Generator
+            //settles every pending AVN of the logged-in airline (only flightNumber's if given) with one amount; the
+            //confirmations leave as one batch per pipe, which the generator and the portal apply in a single pass
+            void payAll(const string& flightNumber)
+                {
+                    vector<AVN> selected = pendingFor(flightNumber);
+                    double total = 0;
+                    for(const AVN& avn : selected)
+                        total += avn.fineAmount;
+                    if(selected.empty())
+                        {
+                            cout << "[StripePay] No AVNs pending payment for " << loggedInAirline << (flightNumber.empty() ? "" : " flight " + flightNumber) << "\n" << flush;
+                            return;
+                        }
+
+                    cout << "[StripePay] Please enter the payment amount for " << selected.size() << " AVN(s) of " << loggedInAirline
+                         << (flightNumber.empty() ? "" : " flight " + flightNumber) << " (expected: PKR " << formatMinorUnits(toMinorUnits(total)) << "): ";
+                    double paidAmount = 0;
+                    bool entered = readAmount(paidAmount);
+                    if(!entered || abs(paidAmount - total) >= 0.01)
+                        {
+                            cout << "[StripePay] Payment failed: Expected PKR " << formatMinorUnits(toMinorUnits(total)) << ", received " << (entered ? "PKR " + formatMinorUnits(toMinorUnits(paidAmount)) : "no amount")
+                                 << ", nothing was charged\n" << flush;
+                            return;
+                        }
+
+                    uint32_t batchSize = selected.size();
+                    if(!journal.recordPayments(selected, batchSize))        //one write and one fdatasync for the whole batch
+                        {
+                            cout << "[ERROR] Failed to journal the payment, nothing was charged: " << strerror(errno) << endl << flush;
+                            return;
+                        }
+
+                    vector<PaymentConfirmation> confirmations;
+                    confirmations.reserve(selected.size());
+                    for(const AVN& avn : selected)
+                        confirmations.push_back(confirmationFor(avn, true, batchSize));
+                    settled(selected);
+                    cout << "[StripePay] Payment of PKR " << formatMinorUnits(toMinorUnits(paidAmount)) << " accepted for " << selected.size() << " AVN(s)\n" << flush;
+
+                    sendConfirmations(confirmations, avnConfirmPipe, "AVN Generator");
+                    sendConfirmations(confirmations, airlineConfirmPipe, "Airline Portal");
+                }
+
+            //resends the confirmations of journaled payments the generator has not acknowledged, paid at or before
+            //paidBefore; the generator and the portal both ignore a payment they already applied
+            void replayUnacknowledged(time_t paidBefore)
+                {
+                    lastReplay = time(nullptr);
+                    vector<PaymentConfirmation> confirmations;
+                    for(const JournalRecord& r : journal.unacknowledged(paidBefore))
+                        {
                             PaymentConfirmation confirmation;
-                            strncpy(confirmation.avnID, avn.avnID, sizeof(confirmation.avnID) - 1);
-                            confirmation.avnID[sizeof(confirmation.avnID) - 1] = '\0';
-                            strncpy(confirmation.flightNumber, avn.flightNumber, sizeof(confirmation.flightNumber) - 1);
-                            confirmation.flightNumber[sizeof(confirmation.flightNumber) - 1] = '\0';
-                            confirmation.paymentSuccessful = paymentSuccessful;
-
-                            char confirmBuffer[PaymentConfirmation::serializedSize()];
-                            offset = 0;
-                            confirmation.serialize(confirmBuffer, offset);
-
-                            int bytesWritten = write(fdAvnConfirmPipe, confirmBuffer, sizeof(confirmBuffer));
-                            if(bytesWritten == sizeof(confirmBuffer)) 
+                            wireInit(confirmation);
+                            confirmation.id = r.id;
+                            memcpy(confirmation.avnID, r.avnID, sizeof(confirmation.avnID));
+                            memcpy(confirmation.flightNumber, r.flightNumber, sizeof(confirmation.flightNumber));
+                            confirmation.paymentSuccessful = 1;
+                            confirmation.batchSize = r.batchSize;
+                            confirmations.push_back(confirmation);
+                        }
+                    if(confirmations.empty())
+                        return;
+                    cout << "[StripePay] Replaying " << confirmations.size() << " journaled payment(s) the AVN Generator has not acknowledged\n" << flush;
+                    sendConfirmations(confirmations, avnConfirmPipe, "AVN Generator");
+                    sendConfirmations(confirmations, airlineConfirmPipe, "Airline Portal");
+                }
+
+            //pays one round of AVNs that fell due, drawing fail_percent per attempt; the successful ones are journaled
+            //with one group commit and every confirmation of the round leaves as one batch
+            void payDue(vector<AVN>& due, uint64_t& paid, uint64_t& failed)
+                {
+                    vector<AVN> ok, rejected;
+                    for(const AVN& avn : due)
+                        (int(rand_r(&failSeed) % 100) < driver->failPercent ? rejected : ok).push_back(avn);
+                    if(!ok.empty() && !journal.recordPayments(ok, due.size())) 
+                        {
+                            cout << "[ERROR] Failed to journal " << ok.size() << " payment(s), retrying them: " << strerror(errno) << endl << flush;
+                            rejected.insert(rejected.end(), ok.begin(), ok.end());
+                            ok.clear();
+                        }
+
+                    uint64_t now = wireNowNs();
+                    settled(ok);
+                    pthread_mutex_lock(&pendingMutex);
+                    for(const AVN& avn : ok)
+                        {
+                            auto t = timings.find(avn.id);
+                            if(t != timings.end())
+                                t->second.paidNs = now;
+                        }
+                    for(const AVN& avn : rejected)
+                        schedule.push(DueAvn(now + uint64_t(driver->retryMs) * 1000000ull, avn.id));
+                    pthread_mutex_unlock(&pendingMutex);
+                    paid += ok.size();
+                    failed += rejected.size();
+
+                    vector<PaymentConfirmation> confirmations;
+                    confirmations.reserve(ok.size() + rejected.size());
+                    for(const AVN& avn : ok)
+                        confirmations.push_back(confirmationFor(avn, true, ok.size() + rejected.size()));
+                    for(const AVN& avn : rejected)
+                        confirmations.push_back(confirmationFor(avn, false, ok.size() + rejected.size()));
+                    sendConfirmations(confirmations, avnConfirmPipe, "AVN Generator");
+                    sendConfirmations(confirmations, airlineConfirmPipe, "Airline Portal");
+                }
+
+            void drive()        //driver mode in place of run(), until SIGINT or SIGTERM
+                {
+                    cout << "[StripePay] Driving payments for " << drivenAirlines.size() << " airline(s): pay after " << driver->payAfterMs << " ms, "
+                         << driver->failPercent << "% of attempts fail, retry after " << driver->retryMs << " ms\n" << flush;
+                    uint64_t paid = 0, failed = 0, reported = ~0ull;
+                    time_t lastReport = time(nullptr);
+                    while(!shutdownRequested())
+                        {
+                            vector<AVN> due;
+                            uint64_t now = wireNowNs();
+                            pthread_mutex_lock(&pendingMutex);
+                            if(schedule.empty() || schedule.top().first > now)
                                 {
-                                    cout << "[StripePay] Sent payment confirmation to AVN Generator for AVN " << avn.avnID << " (status: " << (paymentSuccessful ? "success" : "failure") << ")\n" << flush;
-                                } 
-                            else 
+                                    uint64_t until = now + DRIVER_IDLE_MS * 1000000ull;
+                                    if(!schedule.empty() && schedule.top().first < until)
+                                        until = schedule.top().first;
+                                    timespec ts = { time_t(until / 1000000000ull), long(until % 1000000000ull) };
+                                    pthread_cond_timedwait(&scheduled, &pendingMutex, &ts);
+                                    now = wireNowNs();
+                                }
+                            while(!schedule.empty() && schedule.top().first <= now)
                                 {
-                                    cout << "[ERROR] Failed to send payment confirmation to AVN Generator for AVN " << avn.avnID << ", bytes written: " << bytesWritten << ", expected: " << sizeof(confirmBuffer) << ", error: " << strerror(errno) << endl << flush;
+                                    uint64_t id = schedule.top().second;
+                                    schedule.pop();
+                                    auto t = timings.find(id);
+                                    if(t == timings.end())
+                                        continue;
+                                    auto a = pending.find(t->second.airline);
+                                    auto p = a == pending.end() ? map<uint64_t, AVN>::iterator() : a->second.find(id);
+                                    if(a == pending.end() || p == a->second.end())
+                                        continue;       //paid meanwhile
+                                    t->second.attempts++;
+                                    due.push_back(p->second);
                                 }
+                            size_t waiting = schedule.size();
+                            pthread_mutex_unlock(&pendingMutex);
 
-                            //confirming payment to Airline Portal
-                            bytesWritten = write(fdAirlineConfirmPipe, confirmBuffer, sizeof(confirmBuffer));
-                            if(bytesWritten == sizeof(confirmBuffer)) 
+                            if(!due.empty())
+                                payDue(due, paid, failed);
+                            if(time(nullptr) != lastReport && paid + failed + acknowledgedCount != reported)
                                 {
-                                    cout << "[StripePay] Sent payment confirmation to Airline Portal for AVN " << avn.avnID << " (status: " << (paymentSuccessful ? "success" : "failure") << ")\n" << flush;
-                                } 
-                            else 
-                                {
-                                    cout << "[ERROR] Failed to send payment confirmation to Airline Portal for AVN " << avn.avnID << ", bytes written: " << bytesWritten << ", expected: " << sizeof(confirmBuffer) << ", error: " << strerror(errno) << endl << flush;
+                                    lastReport = time(nullptr);
+                                    reported = paid + failed + acknowledgedCount;
+                                    cout << "[StripePay] Driver: " << paid << " paid, " << failed << " failed attempt(s), " << acknowledgedCount
+                                         << " acknowledged, " << waiting << " scheduled\n" << flush;
                                 }
-                        } 
-                    else if(bytesRead < 0 && errno != EAGAIN) 
-                        {
-                            cout << "[ERROR] Failed to read from avn_to_stripe.fifo: " << strerror(errno) << endl << flush;
                         }
+                    cout << "[StripePay] Driver stopping: " << paid << " paid, " << failed << " failed attempt(s), " << acknowledgedCount << " acknowledged\n" << flush;
                 }
 
             void run() 
                 {
                     cout << "[StripePay] Commands:\n"
+                        << "  pending [flightNumber] - List your airline's AVNs waiting for payment (or one flight's)\n"
+                        << "  pay <avnID> - Pay one pending AVN\n"
+                        << "  payall [flightNumber] - Pay every pending AVN of your airline (or of one flight) with a single amount\n"
+                        << "  ledger - Show issued, unpaid, overdue and paid fine totals for your airline\n"
                         << "  relogin - Log out and log in as a different airline\n"
                         << "  exit - Quit the process\n"
-                        << "Press Enter to continue polling.\n" << flush;
+                        << "Press Enter for a summary of what is pending.\n" << flush;
 
                     while(true) 
                         {
                             cout << "[StripePay] Enter command: ";
                             string commandLine;
-                            getline(cin, commandLine);
+                            if(!getline(cin, commandLine))
+                                break;      //stdin closed
 
                             istringstream iss(commandLine);
                             string command;
                             iss >> command;
 
-                            if(command == "relogin") 
+                            if(command.empty()) 
                                 {
-                                    loggedInAirline.clear(); // Clear the current login
+                                    showPending("", false);
+                                } 
+                            else if(command == "pending") 
+                                {
+                                    string flightNumber;
+                                    iss >> flightNumber;
+                                    showPending(flightNumber, true);
+                                } 
+                            else if(command == "pay") 
+                                {
+                                    string avnID;
+                                    if(iss >> avnID)
+                                        pay(avnID);
+                                    else
+                                        cout << "[ERROR] Usage: pay <avnID>\n" << flush;
+                                } 
+                            else if(command == "ledger") 
+                                {
+                                    showLedger();
+                                } 
+                            else if(command == "payall") 
+                                {
+                                    string flightNumber;
+                                    iss >> flightNumber;
+                                    payAll(flightNumber);
+                                } 
+                            else if(command == "relogin") 
+                                {
+                                    pthread_mutex_lock(&pendingMutex);
+                                    loggedInAirline.clear(); // Clear the current login, the old airline's AVNs stay pending for its next login
+                                    pthread_mutex_unlock(&pendingMutex);
                                     if(!authenticate()) 
                                         {
                                             break; // Exit if authentication fails after relogin attempt
@@ -354,28 +817,43 @@ class StripePay
                                 {
                                     break;
                                 }
-
-                            processPayment();
-                            usleep(100000); // Sleep for 100ms to prevent busy-waiting
                         }
                 }
 
             ~StripePay()    //closing all pipes
                 {
-                    if(fdAvnPipe >= 0) 
-                        close(fdAvnPipe);
-                    if(fdAvnConfirmPipe >= 0) 
-                        close(fdAvnConfirmPipe);
-                    if(fdAirlineConfirmPipe >= 0) 
-                        close(fdAirlineConfirmPipe);                   
+                    stopIntake();
+                    if(wakeFd >= 0)
+                        close(wakeFd);
+                    if(timingsFile)
+                        fclose(timingsFile);
+                    pthread_cond_destroy(&scheduled);
+                    pthread_mutex_destroy(&pendingMutex);
+                    pthread_mutex_destroy(&sendMutex);
+                    avnPipe.close();
+                    avnConfirmPipe.close();
+                    airlineConfirmPipe.close();
                 }
     };
 
 int main() 
     {
         cout << "===== StripePay Starting =====\n" << flush;
-        StripePay stripePay;
-        stripePay.run();
+        DriverConfig driverConfig;
+        const char* driverPath = driverConfigPath();
+        string error;
+        if(driverPath && !loadDriverConfig(driverPath, driverConfig, error)) 
+            {
+                cout << "[ERROR] Invalid driver config " << error << endl << flush;
+                return 1;
+            }
+        if(driverPath)
+            blockShutdownSignals();     //before the intake thread starts, so it inherits the mask
+        StripePay stripePay(driverPath ? &driverConfig : nullptr);
+        if(driverPath)
+            stripePay.drive();
+        else
+            stripePay.run();
         cout << "===== StripePay Complete =====\n" << flush;
         return 0;
     }
@@ -0,0 +1,376 @@
+#include <iostream>
+#include <iomanip>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <ctime>
+
+#include "avn_channel.h"
+#include "avn_driver.h"
+#include "avn_hub.h"
+#include "avn_wire.h"
+
+using namespace std;
+
+//starts the four processes with every link already created and held open, so nobody sits in a retry loop,
+//waits for each one to report ready and restarts whichever one crashes
+//build: g++ -std=c++17 supervisor.cpp -o supervisor -pthread -lrt
+//usage: ./supervisor [--tty airline_portal|stripepay] [--skip <component>]... [--no-restart]
+
+struct Link             //one FIFO between two components, recordSize 0 for the raw control FIFO
+    {
+        const char* name;
+        size_t recordSize;
+    };
+
+static const Link LINKS[] =
+    {
+        { "atc_to_avn.fifo", sizeof(AVN) },
+        { "avn_to_atc.fifo", sizeof(ViolationClearedNotification) },
+        { "avn_to_stripe.fifo", sizeof(AVN) },
+        { "stripe_to_avn.fifo", sizeof(PaymentConfirmation) },
+        { "stripe_to_airline.fifo", sizeof(PaymentConfirmation) },
+        { "avn_ctrl.fifo", 0 },
+    };
+
+struct Component
+    {
+        const char* name;           //what it reports through reportReady()
+        const char* binary;
+        bool interactive;           //reads commands from stdin, only the --tty one gets the terminal
+        bool enabled;
+        pid_t pid;
+        uint64_t startedNs;
+        bool ready;
+        vector<time_t> restarts;    //restart times inside RESTART_WINDOW_SEC
+    };
+
+static const int MAX_RESTARTS = 5;              //per RESTART_WINDOW_SEC, after that the component stays down
+static const int RESTART_WINDOW_SEC = 60;
+static const int EXEC_FAILED = 127;
+
+class Supervisor
+    {
+        private:
+            vector<Component> components;
+            vector<int> linkFds;
+            vector<unique_ptr<ShmRing>> rings;      //pre-created so a shm peer attaches without waiting
+            int readyPipe[2] = { -1, -1 };
+            int signalFd = -1;
+            string ttyComponent;
+            bool restart = true;
+            bool stopping = false;
+            bool allReadyReported = false;
+            uint64_t bootNs = 0;
+
+            static double msSince(uint64_t startNs)
+                {
+                    return (wireNowNs() - startNs) / 1e6;
+                }
+
+            Component* find(const string& name)
+                {
+                    for(Component& c : components)
+                        if(name == c.name)
+                            return &c;
+                    return nullptr;
+                }
+
+            void createLinks()
+                {
+                    string fdList;
+                    for(const Link& link : LINKS)
+                        {
+                            if(mkfifo(link.name, 0666) == -1 && errno != EEXIST)
+                                {
+                                    cout << "[ERROR] Failed to create " << link.name << ": " << strerror(errno) << endl << flush;
+                                    exit(1);
+                                }
+                            //O_RDWR never blocks on a FIFO and keeps both ends alive for the whole session,
+                            //so children (and restarted children) get a working link straight away
+                            int fd = open(link.name, O_RDWR | O_NONBLOCK);
+                            if(fd < 0)
+                                {
+                                    cout << "[ERROR] Failed to open " << link.name << ": " << strerror(errno) << endl << flush;
+                                    exit(1);
+                                }
+                            linkFds.push_back(fd);
+                            fdList += string(fdList.empty() ? "" : ",") + link.name + "=" + to_string(fd);
+
+                            if(link.recordSize && selectedTransport() == TRANSPORT_SHM)
+                                {
+                                    ShmRing::unlink(link.name);         //drop whatever a previous session left behind
+                                    rings.emplace_back(new ShmRing());
+                                    if(!rings.back()->open(link.name, link.recordSize, SHM_RING_RECORDS))
+                                        {
+                                            cout << "[ERROR] Failed to create shared memory ring for " << link.name << ": " << strerror(errno) << endl << flush;
+                                            exit(1);
+                                        }
+                                }
+                        }
+
+                    //the hub socket is listened on here, a restarted generator takes it over without losing
+                    //portals that connect while it is down
+                    int hubFd = hubListen();
+                    if(hubFd < 0)
+                        {
+                            cout << "[ERROR] Failed to listen on " << AVN_HUB_SOCKET << ": " << strerror(errno) << endl << flush;
+                            exit(1);
+                        }
+                    fcntl(hubFd, F_SETFD, 0);
+                    linkFds.push_back(hubFd);
+                    fdList += string(",") + AVN_HUB_SOCKET + "=" + to_string(hubFd);
+                    setenv("AIRCONTROLX_FDS", fdList.c_str(), 1);
+
+                    if(pipe2(readyPipe, O_CLOEXEC) < 0)
+                        {
+                            cout << "[ERROR] Failed to create readiness pipe: " << strerror(errno) << endl << flush;
+                            exit(1);
+                        }
+                    fcntl(readyPipe[1], F_SETFD, 0);        //children inherit the write end
+                    fcntl(readyPipe[0], F_SETFL, O_NONBLOCK);
+                    setenv("AIRCONTROLX_READY_FD", to_string(readyPipe[1]).c_str(), 1);
+                }
+
+            void spawn(Component& c)
+                {
+                    c.ready = false;
+                    c.startedNs = wireNowNs();
+                    pid_t pid = fork();
+                    if(pid < 0)
+                        {
+                            cout << "[ERROR] Failed to fork " << c.name << ": " << strerror(errno) << endl << flush;
+                            return;
+                        }
+                    if(pid == 0)
+                        {
+                            sigset_t none;
+                            sigemptyset(&none);
+                            sigprocmask(SIG_SETMASK, &none, nullptr);
+                            if(ttyComponent != c.name)      //only one process may read the terminal
+                                {
+                                    int devNull = open("/dev/null", O_RDONLY);
+                                    if(devNull >= 0)
+                                        dup2(devNull, STDIN_FILENO);
+                                }
+                            string path = string("./") + c.binary;
+                            execl(path.c_str(), c.binary, (char*)nullptr);
+                            cout << "[ERROR] Failed to start " << path << ": " << strerror(errno) << endl << flush;
+                            _exit(EXEC_FAILED);
+                        }
+                    c.pid = pid;
+                    cout << "[Supervisor] Started " << c.name << " (pid " << pid << ")\n" << flush;
+                }
+
+            void readReady()
+                {
+                    char buffer[256];
+                    ssize_t n = read(readyPipe[0], buffer, sizeof(buffer) - 1);
+                    if(n <= 0)
+                        return;
+                    buffer[n] = '\0';
+                    for(char* line = strtok(buffer, "\n"); line; line = strtok(nullptr, "\n"))       //lines are < PIPE_BUF, never torn
+                        {
+                            Component* c = find(line);
+                            if(!c || c->pid <= 0)
+                                continue;
+                            c->ready = true;
+                            cout << "[Supervisor] " << c->name << " ready in " << fixed << setprecision(1) << msSince(c->startedNs) << " ms\n" << flush;
+                        }
+
+                    if(allReadyReported)
+                        return;
+                    for(const Component& c : components)
+                        if(c.enabled && !c.ready)
+                            return;
+                    allReadyReported = true;
+                    cout << "[Supervisor] All components ready in " << fixed << setprecision(1) << msSince(bootNs) << " ms\n" << flush;
+                }
+
+            bool mayRestart(Component& c)
+                {
+                    time_t now = time(nullptr);
+                    vector<time_t> recent;
+                    for(time_t t : c.restarts)
+                        if(now - t < RESTART_WINDOW_SEC)
+                            recent.push_back(t);
+                    c.restarts.swap(recent);
+                    if(int(c.restarts.size()) >= MAX_RESTARTS)
+                        return false;
+                    c.restarts.push_back(now);
+                    return true;
+                }
+
+            void reap()
+                {
+                    int status;
+                    pid_t pid;
+                    while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+                        {
+                            Component* c = nullptr;
+                            for(Component& candidate : components)
+                                if(candidate.pid == pid)
+                                    c = &candidate;
+                            if(!c)
+                                continue;
+                            c->pid = -1;
+                            c->ready = false;
+
+                            bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                            if(WIFSIGNALED(status))
+                                cout << "[Supervisor] " << c->name << " killed by signal " << WTERMSIG(status) << "\n" << flush;
+                            else
+                                cout << "[Supervisor] " << c->name << " exited with status " << WEXITSTATUS(status) << "\n" << flush;
+
+                            if(stopping || clean || !restart)
+                                continue;
+                            if(WIFEXITED(status) && WEXITSTATUS(status) == EXEC_FAILED)
+                                {
+                                    cout << "[Supervisor] Not restarting " << c->name << ", its binary could not be started\n" << flush;
+                                    continue;
+                                }
+                            if(!mayRestart(*c))
+                                {
+                                    cout << "[ERROR] " << c->name << " failed " << MAX_RESTARTS << " times within " << RESTART_WINDOW_SEC << "s, leaving it down\n" << flush;
+                                    continue;
+                                }
+                            cout << "[Supervisor] Restarting " << c->name << "\n" << flush;
+                            spawn(*c);
+                        }
+                }
+
+            bool anyRunning() const
+                {
+                    for(const Component& c : components)
+                        if(c.pid > 0)
+                            return true;
+                    return false;
+                }
+
+            void stopAll()
+                {
+                    stopping = true;
+                    for(const Component& c : components)
+                        if(c.pid > 0)
+                            kill(c.pid, SIGTERM);
+                }
+
+        public:
+            Supervisor(int argc, char* argv[])
+                {
+                    components =
+                        {
+                            { "avn", "exe", false, true, -1, 0, false, {} },
+                            { "atc", "sfml-app", false, true, -1, 0, false, {} },
+                            { "stripepay", "exe3", true, true, -1, 0, false, {} },
+                            { "airline_portal", "exe2", true, true, -1, 0, false, {} },
+                        };
+                    ttyComponent = "stripepay";
+                    for(int i = 1; i < argc; i++)
+                        {
+                            string arg = argv[i];
+                            if(arg == "--tty" && i + 1 < argc)
+                                ttyComponent = argv[++i];
+                            else if(arg == "--skip" && i + 1 < argc && find(argv[i + 1]))
+                                find(argv[++i])->enabled = false;
+                            else if(arg == "--no-restart")
+                                restart = false;
+                            else
+                                {
+                                    cout << "usage: " << argv[0] << " [--tty airline_portal|stripepay] [--skip <component>]... [--no-restart]\n"
+                                         << "components: avn, atc, stripepay, airline_portal\n" << flush;
+                                    exit(1);
+                                }
+                        }
+                    //an interactive component without the terminal would only see EOF, leave it to be started by hand,
+                    //unless AIRCONTROLX_DRIVER gives StripePay and the portal a config to run from instead
+                    for(Component& c : components)
+                        if(c.interactive && c.enabled && ttyComponent != c.name && !driverConfigPath())
+                            {
+                                c.enabled = false;
+                                cout << "[Supervisor] " << c.name << " needs a terminal, start ./" << c.binary << " in another one (its links are already open)\n" << flush;
+                            }
+                }
+
+            int run()
+                {
+                    bootNs = wireNowNs();
+                    cout << "[Supervisor] Creating links (transport: " << transportToStr(selectedTransport()) << ")\n" << flush;
+                    createLinks();
+
+                    sigset_t handled;
+                    sigemptyset(&handled);
+                    sigaddset(&handled, SIGCHLD);
+                    sigaddset(&handled, SIGINT);
+                    sigaddset(&handled, SIGTERM);
+                    sigprocmask(SIG_BLOCK, &handled, nullptr);
+                    signalFd = signalfd(-1, &handled, SFD_NONBLOCK | SFD_CLOEXEC);
+                    if(signalFd < 0)
+                        {
+                            cout << "[ERROR] Failed to create signalfd: " << strerror(errno) << endl << flush;
+                            return 1;
+                        }
+
+                    for(Component& c : components)
+                        if(c.enabled)
+                            spawn(c);
+
+                    while(anyRunning())
+                        {
+                            pollfd fds[2] = { { readyPipe[0], POLLIN, 0 }, { signalFd, POLLIN, 0 } };
+                            if(poll(fds, 2, -1) < 0 && errno != EINTR)
+                                break;
+                            if(fds[0].revents & POLLIN)
+                                readReady();
+                            if(fds[1].revents & POLLIN)
+                                {
+                                    signalfd_siginfo info;
+                                    bool childExited = false;
+                                    while(read(signalFd, &info, sizeof(info)) == sizeof(info))
+                                        {
+                                            if(info.ssi_signo == SIGCHLD)
+                                                childExited = true;
+                                            else if(!stopping)
+                                                {
+                                                    cout << "\n[Supervisor] Stopping all components\n" << flush;
+                                                    stopAll();
+                                                }
+                                        }
+                                    if(childExited)
+                                        reap();
+                                }
+                        }
+
+                    cout << "[Supervisor] All components stopped\n" << flush;
+                    return 0;
+                }
+
+            ~Supervisor()
+                {
+                    for(int fd : linkFds)
+                        close(fd);
+                    if(readyPipe[0] >= 0)
+                        close(readyPipe[0]);
+                    if(readyPipe[1] >= 0)
+                        close(readyPipe[1]);
+                    if(signalFd >= 0)
+                        close(signalFd);
+                }
+    };
+
+int main(int argc, char* argv[])
+    {
+        cout << "===== Supervisor Starting =====\n" << flush;
+        Supervisor supervisor(argc, argv);
+        int rc = supervisor.run();
+        cout << "===== Supervisor Complete =====\n" << flush;
+        return rc;
+    }
@@ -0,0 +1,172 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "avn_channel.h"
+
+using namespace std;
+
+//measures messages/sec and latency of one producer -> consumer link for the FIFO and the shared memory transport
+//build: g++ -O2 -std=c++17 transport_bench.cpp -o transport_bench -pthread -lrt
+//usage: ./transport_bench [records] [recordSize]
+
+static const char* BENCH_LINK = "bench_link.fifo";
+
+struct BenchResult
+    {
+        uint64_t received;
+        double seconds;
+        double p50Us;
+        double p99Us;
+        double maxUs;
+    };
+
+static uint64_t nowNs()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+//consumer side, runs in the forked child and reports back through resultFd
+static void consume(size_t records, size_t recordSize, int readyFd, int resultFd)
+    {
+        AvnChannel in;
+        if(!in.openReader(BENCH_LINK, recordSize))
+            {
+                cout << "[ERROR] consumer failed to open " << BENCH_LINK << ": " << strerror(errno) << endl;
+                _exit(1);
+            }
+        char ok = 1;
+        if(write(readyFd, &ok, 1) != 1)
+            _exit(1);
+
+        vector<uint64_t> latencies;
+        latencies.reserve(records);
+        vector<char> buffer(recordSize);    //one record per receive, like the processes do today
+        uint64_t first = 0, last = 0;
+        while(latencies.size() < records)
+            {
+                ssize_t n = in.receive(buffer.data(), buffer.size());
+                if(n <= 0)
+                    {
+                        in.waitReadable(100);
+                        continue;
+                    }
+                uint64_t now = nowNs(), stamp;
+                memcpy(&stamp, buffer.data(), sizeof(stamp));
+                if(!first)
+                    first = now;
+                last = now;
+                latencies.push_back(now - stamp);
+            }
+
+        sort(latencies.begin(), latencies.end());
+        BenchResult r;
+        r.received = latencies.size();
+        r.seconds = (last - first) / 1e9;
+        r.p50Us = latencies[latencies.size() / 2] / 1e3;
+        r.p99Us = latencies[latencies.size() * 99 / 100] / 1e3;
+        r.maxUs = latencies.back() / 1e3;
+        if(write(resultFd, &r, sizeof(r)) != sizeof(r))
+            _exit(1);
+        _exit(0);
+    }
+
+//producer side, paceNs == 0 sends as fast as the link accepts
+static BenchResult runOnce(TransportKind kind, size_t records, size_t recordSize, uint64_t paceNs)
+    {
+        setenv("AIRCONTROLX_TRANSPORT", kind == TRANSPORT_SHM ? "shm" : "fifo", 1);
+        ShmRing::unlink(BENCH_LINK);
+        unlink(BENCH_LINK);
+        if(kind == TRANSPORT_FIFO)
+            mkfifo(BENCH_LINK, 0666);
+
+        int readyPipe[2], resultPipe[2];
+        if(pipe(readyPipe) < 0 || pipe(resultPipe) < 0)
+            {
+                perror("pipe");
+                exit(1);
+            }
+        pid_t child = fork();
+        if(child == 0)
+            consume(records, recordSize, readyPipe[1], resultPipe[1]);
+
+        char ok;
+        if(read(readyPipe[0], &ok, 1) != 1)
+            {
+                cout << "[ERROR] consumer did not start\n";
+                exit(1);
+            }
+        AvnChannel out;
+        if(!out.openWriter(BENCH_LINK, recordSize))
+            {
+                cout << "[ERROR] producer failed to open " << BENCH_LINK << ": " << strerror(errno) << endl;
+                exit(1);
+            }
+
+        vector<char> record(recordSize, 'x');
+        uint64_t next = nowNs();
+        for(size_t i = 0; i < records; i++)
+            {
+                if(paceNs)
+                    {
+                        timespec at = { time_t(next / 1000000000ull), long(next % 1000000000ull) };
+                        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, nullptr);
+                        next += paceNs;
+                    }
+                uint64_t stamp = nowNs();
+                memcpy(record.data(), &stamp, sizeof(stamp));
+                while(out.send(record.data(), recordSize) != ssize_t(recordSize))
+                    sched_yield();     //link full, let the consumer drain
+            }
+
+        BenchResult r;
+        if(read(resultPipe[0], &r, sizeof(r)) != sizeof(r))
+            memset(&r, 0, sizeof(r));
+        waitpid(child, nullptr, 0);
+        out.close();
+        close(readyPipe[0]);
+        close(readyPipe[1]);
+        close(resultPipe[0]);
+        close(resultPipe[1]);
+        ShmRing::unlink(BENCH_LINK);
+        unlink(BENCH_LINK);
+        return r;
+    }
+
+static void report(const char* label, TransportKind kind, const BenchResult& r)
+    {
+        cout << left << setw(12) << label << setw(16) << transportToStr(kind)
+             << right << setw(14) << fixed << setprecision(0) << (r.seconds > 0 ? r.received / r.seconds : 0)
+             << setw(12) << setprecision(1) << r.p50Us
+             << setw(12) << r.p99Us
+             << setw(12) << r.maxUs << "\n";
+    }
+
+int main(int argc, char* argv[])
+    {
+        size_t records = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+        size_t recordSize = argc > 2 ? strtoul(argv[2], nullptr, 10) : sizeof(AVN);   //current AVN wire size
+        if(recordSize < sizeof(uint64_t))
+            recordSize = sizeof(uint64_t);
+
+        cout << "===== Transport Benchmark: " << records << " records of " << recordSize << " bytes =====\n";
+        cout << left << setw(12) << "run" << setw(16) << "transport"
+             << right << setw(14) << "msgs/sec" << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(12) << "max us" << "\n";
+
+        TransportKind kinds[] = { TRANSPORT_FIFO, TRANSPORT_SHM };
+        for(TransportKind k : kinds)
+            report("saturated", k, runOnce(k, records, recordSize, 0));
+        for(TransportKind k : kinds)
+            report("paced 20us", k, runOnce(k, records / 10, recordSize, 20000));
+        return 0;
+    }